@@ -198,10 +198,24 @@ mov ax, SELECTOR_VIDEO
 mov gs, ax
 
 ; -------------------------   加载kernel  ----------------------
-mov edi, KERNEL_BIN_BASE_ADDR  ; 从磁盘读出后，写入到 edi 指定的地址
-mov ecx, KERNEL_START_SECTOR   ; kernel.bin 所在的扇区号
-mov ebx, 200 ; 读入的扇区数 
-call read_hd
+mov edi, KERNEL_BIN_BASE_ADDR  ; 从磁盘读出后，写入到 edi 指定的地址, read_hd 每读一个字 edi 加 2
+mov eax, KERNEL_START_SECTOR   ; kernel.bin 所在的扇区号
+mov esi, KERNEL_SECTOR_CNT     ; 还要读入的扇区数
+
+; 扇区数端口 0x1f2 只有 8 位, 每次最多读 255 个扇区
+.load_kernel:
+    mov ebx, esi
+    cmp ebx, 255
+    jbe .load_chunk
+    mov ebx, 255
+.load_chunk:
+    mov ecx, eax
+    push eax                   ; read_hd 会用到 eax
+    call read_hd
+    pop eax
+    add eax, ebx
+    sub esi, ebx
+    jnz .load_kernel
 
 ; 创建页目录及页表并初始化页内存位图
 call setup_page
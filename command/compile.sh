@@ -14,7 +14,7 @@ CFLAGS="-Wall -c -fno-builtin -W -Wstrict-prototypes \
       -Wmissing-prototypes -Wsystem-headers"
 LIB="../lib/"
 OBJS="../build/string.o ../build/syscall.o \
-      ../build/stdio.o ../build/assert.o"
+      ../build/stdio.o ../build/assert.o ../build/malloc.o"
 DD_IN=$BIN
 DD_OUT="/data/my_os/code/zy_os/hd60M.img" 
 
@@ -405,6 +405,7 @@ static void partition_scan(struct disk* hd, uint32_t ext_lba) {
             if (ext_lba == 0) {  // 此时全是主分区
                 hd->prim_parts[p_no].start_lba = ext_lba + p->start_lba;
                 hd->prim_parts[p_no].sec_cnt = p->sec_cnt;
+                hd->prim_parts[p_no].fs_type = p->fs_type;
                 hd->prim_parts[p_no].my_disk = hd;
                 list_append(&partition_list, &hd->prim_parts[p_no].part_tag);
                 uint32_t name_len = sizeof(hd->prim_parts[p_no].name);
@@ -414,6 +415,7 @@ static void partition_scan(struct disk* hd, uint32_t ext_lba) {
             } else {
                 hd->logic_parts[l_no].start_lba = ext_lba + p->start_lba;
                 hd->logic_parts[l_no].sec_cnt = p->sec_cnt;
+                hd->logic_parts[l_no].fs_type = p->fs_type;
                 hd->logic_parts[l_no].my_disk = hd;
                 list_append(&partition_list, &hd->logic_parts[l_no].part_tag);
                 // 逻辑分区数字是从 5 开始,主分区是 1～4
@@ -482,8 +484,9 @@ void intr_hd_handler(uint8_t irq_no) {
 void ide_init() {
     printk("ide_init start\n");
     // 获取硬盘的数量
-    // 注意：低端 1M 以内的虚拟地址和物理地址相同。所以虚拟地址 0x475 可以映射到物理地址 0x475 中
-    uint8_t hd_cnt = *((uint8_t*)(0x475));
+    // BIOS 把硬盘数量存放在物理地址 0x475 处
+    // mem_init 已去掉低端 1M 的恒等映射，只能经内核空间的 0xc0000475 访问
+    uint8_t hd_cnt = *((uint8_t*)(0xc0000475));
     printk("    ide_init hd_cnt: %d\n", hd_cnt);
     ASSERT(hd_cnt > 0);
     list_init(&partition_list);
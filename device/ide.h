@@ -16,6 +16,9 @@
 #include "thread/sync.h"
 #include "lib/kernel/bitmap.h"
 
+// 分区表中 Linux 交换分区的类型，这种分区用作交换区，不创建文件系统
+#define PART_TYPE_SWAP 0x82
+
 /**
  * @brief 分区结构
  * 
@@ -29,6 +32,8 @@ struct partition {
     struct disk* my_disk;
     // 用于队列中的标记
     struct list_elem part_tag;
+    // 分区表中的分区类型
+    uint8_t fs_type;
     // 分区名称
     char name[8];
     // 本分区的超级块
@@ -37,8 +42,11 @@ struct partition {
     struct bitmap block_bitmap;
     // i结点位图
     struct bitmap inode_bitmap;
-    // 本分区打开的i结点队列
-    struct list open_inodes;
+    // 位图的各扇区是否修改过而尚未写入缓冲区缓存，块位图的扇区在前，inode 位图的在后
+    uint8_t* bitmap_dirty;
+    // 为文件预留而尚未使用的块, 与 block_bitmap.bits 按位对应
+    // 这些块在内存的块位图中是占用的, 写入硬盘时去掉, 预留不会因为宕机而泄漏
+    uint8_t* block_reserved;
 };
 
 /**
@@ -20,6 +20,26 @@
 
 // 内核自中断开启以来总共的滴答数
 uint32_t ticks;
+// 在 timer_sleep 中阻塞的线程, 挂的是 general_tag
+static struct list sleep_list;
+
+/**
+ * @brief 唤醒睡眠时间已到的线程，在时钟中断中调用
+ * 
+ */
+static void sleep_list_expire(void) {
+    struct list_elem* elem = sleep_list.head.next;
+    while (elem != &sleep_list.tail) {
+        struct list_elem* next = elem->next;
+        struct task_struct* pthread = elem2entry(struct task_struct, general_tag, elem);
+        // 按差值比较, ticks 回绕时也正确
+        if ((int32_t)(ticks - pthread->wakeup_tick) >= 0) {
+            list_remove(elem);
+            thread_unblock(pthread);
+        }
+        elem = next;
+    }
+}
 
 /**
  * @brief 时钟中断的处理函数
@@ -32,6 +52,9 @@ static void intr_timer_handler(void) {
     cur_thread->elapsed_ticks++;
     // 从内核第一次处理时间中断后开始至今的滴答数，内核态和用户态总共的滴答数
     ticks++;
+    if (!list_empty(&sleep_list)) {
+        sleep_list_expire();
+    }
     if (cur_thread->ticks == 0) {
         // 如果任务的时间片使用完了，就开始调度到新的任务上 CPU
         schedule();
@@ -65,6 +88,36 @@ void mtime_sleep(uint32_t m_seconds) {
     ticks_to_sleep(sleep_ticks);
 }
 
+/**
+ * @brief 阻塞当前线程 sleep_ticks 个滴答，期间不占用 CPU
+ *        与 mtime_sleep 不同，睡眠的线程不在就绪队列中，空闲时 idle 线程可以运行
+ * 
+ * @param sleep_ticks 
+ */
+void timer_sleep(uint32_t sleep_ticks) {
+    ASSERT(sleep_ticks > 0);
+    struct task_struct* cur = running_thread();
+    enum intr_status old_status = intr_disable();
+    cur->wakeup_tick = ticks + sleep_ticks;
+    list_append(&sleep_list, &cur->general_tag);
+    thread_block(TASK_BLOCKED);
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 提前唤醒在 timer_sleep 中睡眠的线程 pthread，它不在睡眠时什么也不做
+ * 
+ * @param pthread 
+ */
+void timer_wakeup(struct task_struct* pthread) {
+    enum intr_status old_status = intr_disable();
+    if (pthread->status == TASK_BLOCKED && elem_find(&sleep_list, &pthread->general_tag)) {
+        list_remove(&pthread->general_tag);
+        thread_unblock(pthread);
+    }
+    intr_set_status(old_status);
+}
+
 /**
  * @brief 把操作的计数器counter_no、读写锁属性rwl、计数器模式counter_mode写入模式控制寄存器并赋予初始值counter_value
  * 
@@ -90,6 +143,7 @@ void timer_init() {
     put_str("timer_init start\n");
     // 设置8253的定时周期,也就是发中断的周期
     frequency_set(CONTRER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE, COUNTER0_VALUE);
+    list_init(&sleep_list);
     register_handler(0x20, intr_timer_handler);
     put_str("timer_init done\n");
 }
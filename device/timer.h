@@ -14,7 +14,13 @@
 
 #include "lib/stdint.h"
 
+extern uint32_t ticks;
+
+struct task_struct;
+
 void timer_init(void);
 void mtime_sleep(uint32_t m_seconds);
+void timer_sleep(uint32_t sleep_ticks);
+void timer_wakeup(struct task_struct* pthread);
 
 #endif  // DEVICE_TIME_H_
@@ -0,0 +1,661 @@
+#include "fs/buffer.h"
+#include "fs/fs.h"
+#include "kernel/memory.h"
+#include "kernel/interrupt.h"
+#include "kernel/debug.h"
+#include "kernel/global.h"
+#include "lib/string.h"
+#include "thread/thread.h"
+#include "device/timer.h"
+
+// 全部缓冲区
+static struct buffer_head* buffers;
+// 以 (hd, lba) 为键的哈希桶
+static struct list buffer_hash[BUFFER_HASH_SIZE];
+// 不被引用的缓冲区，表头是最久未使用的
+static struct list lru_list;
+static uint32_t buffer_cnt;
+
+// 脏缓冲区个数，超过 dirty_high 时写回线程立即写回全部脏缓冲区
+static uint32_t dirty_cnt;
+static uint32_t dirty_high;
+// 写回线程，没有脏缓冲区时阻塞
+static struct task_struct* flusher;
+static bool flusher_idle;
+// 同一时刻只进行一轮写回，flush_set 和 flush_buf 为各轮共用
+static struct lock flush_lock;
+// 一轮中要写回的缓冲区，按 (hd, lba) 排序
+static struct buffer_head** flush_set;
+// 合并写入时拼接相邻扇区的缓冲
+static uint8_t* flush_buf;
+
+/**
+ * @brief 预读请求，把硬盘 hd 上从 lba 开始的 sec_cnt 个扇区读入缓存
+ *
+ */
+struct ra_request {
+    struct disk* hd;
+    uint32_t lba;
+    uint32_t sec_cnt;
+};
+
+// 预读请求队列，ra_head 到 ra_tail 之间是待处理的请求，队列满时丢弃新请求
+static struct ra_request ra_queue[BUFFER_RA_QUEUE];
+static uint32_t ra_head;
+static uint32_t ra_tail;
+// 预读线程，没有请求时阻塞
+static struct task_struct* readahead;
+static bool readahead_idle;
+// 预读时一次读入多个扇区的缓冲
+static uint8_t* ra_buf;
+
+// 挑选要写回的缓冲区，调用时已关中断
+typedef bool (*flush_filter)(struct buffer_head* bh, const void* arg);
+
+static void buffer_flusher(void* arg);
+static void buffer_readahead_thread(void* arg);
+
+static uint32_t buffer_hash_idx(struct disk* hd, uint32_t lba) {
+    return (lba ^ ((uint32_t)hd >> 4)) & (BUFFER_HASH_SIZE - 1);
+}
+
+/**
+ * @brief 初始化缓冲区缓存
+ *
+ * @param buf_cnt 缓冲区个数
+ */
+void buffer_cache_init(uint32_t buf_cnt) {
+    buffers = sys_malloc(buf_cnt * sizeof(struct buffer_head));
+    uint8_t* data = sys_malloc_nozero(buf_cnt * SECTOR_SIZE);
+    flush_set = sys_malloc(buf_cnt * sizeof(struct buffer_head*));
+    flush_buf = sys_malloc_nozero(BUFFER_FLUSH_MAX_SECS * SECTOR_SIZE);
+    ra_buf = sys_malloc_nozero(BUFFER_RA_MAX_SECS * SECTOR_SIZE);
+    if (buffers == NULL || data == NULL || flush_set == NULL || flush_buf == NULL || ra_buf == NULL) {
+        PANIC("buffer_cache_init: alloc memory failed!");
+    }
+    buffer_cnt = buf_cnt;
+    dirty_high = buf_cnt / 2;
+    lock_init(&flush_lock);
+    uint32_t idx;
+    for (idx = 0; idx < BUFFER_HASH_SIZE; idx++) {
+        list_init(&buffer_hash[idx]);
+    }
+    list_init(&lru_list);
+    for (idx = 0; idx < buf_cnt; idx++) {
+        buffers[idx].data = data + idx * SECTOR_SIZE;
+        lock_init(&buffers[idx].io_lock);
+        list_append(&lru_list, &buffers[idx].lru_tag);
+    }
+    flusher = thread_start("flusher", 10, buffer_flusher, NULL);
+    readahead = thread_start("readahead", 10, buffer_readahead_thread, NULL);
+}
+
+/**
+ * @brief 将缓冲区标记为脏的，由干净变脏时记下时间并唤醒写回线程
+ *
+ * @param bh
+ */
+static void buffer_set_dirty(struct buffer_head* bh) {
+    enum intr_status old_status = intr_disable();
+    if (!bh->dirty) {
+        bh->dirty = true;
+        bh->dirty_tick = ticks;
+        dirty_cnt++;
+        if (flusher_idle) {
+            flusher_idle = false;
+            thread_unblock(flusher);
+        } else if (dirty_cnt >= dirty_high) {
+            // 脏缓冲区太多, 不等睡眠结束就写回
+            timer_wakeup(flusher);
+        }
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 清除缓冲区的脏标记，调用者需持有 io_lock 且随后把 data 写入硬盘
+ *
+ * @param bh
+ */
+static void buffer_clear_dirty(struct buffer_head* bh) {
+    enum intr_status old_status = intr_disable();
+    if (bh->dirty) {
+        bh->dirty = false;
+        dirty_cnt--;
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 在哈希桶中查找缓存 (hd, lba) 的缓冲区，调用者需关中断
+ *
+ * @param hd
+ * @param lba
+ * @return struct buffer_head* 没有时返回 NULL
+ */
+static struct buffer_head* buffer_lookup(struct disk* hd, uint32_t lba) {
+    struct list* bucket = &buffer_hash[buffer_hash_idx(hd, lba)];
+    struct list_elem* elem = bucket->head.next;
+    for (; elem != &bucket->tail; elem = elem->next) {
+        struct buffer_head* bh = elem2entry(struct buffer_head, hash_tag, elem);
+        if (bh->hd == hd && bh->lba == lba) {
+            return bh;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 若缓冲区是脏的，将其写回硬盘
+ *
+ * @param bh
+ */
+static void buffer_writeback(struct buffer_head* bh) {
+    lock_acquire(&bh->io_lock);
+    if (bh->dirty) {
+        // 先清除标记，写盘期间再被修改的话仍是脏的
+        buffer_clear_dirty(bh);
+        ide_write(bh->hd, bh->lba, bh->data, 1);
+    }
+    lock_release(&bh->io_lock);
+}
+
+/**
+ * @brief 取得缓存 (hd, lba) 的缓冲区并增加引用，不在缓存中时回收最久未使用的缓冲区
+ *        返回的缓冲区内容可能尚未读入
+ *
+ * @param hd
+ * @param lba
+ * @return struct buffer_head*
+ */
+static struct buffer_head* buffer_grab(struct disk* hd, uint32_t lba) {
+    enum intr_status old_status = intr_disable();
+    struct buffer_head* bh;
+    while (true) {
+        bh = buffer_lookup(hd, lba);
+        if (bh != NULL) {
+            if (bh->ref_cnt++ == 0) {
+                list_remove(&bh->lru_tag);
+            }
+            break;
+        }
+        if (list_empty(&lru_list)) {
+            PANIC("buffer_grab: all buffers are in use");
+        }
+        bh = elem2entry(struct buffer_head, lru_tag, list_pop(&lru_list));
+        if (!bh->dirty) {
+            if (bh->hd != NULL) {
+                list_remove(&bh->hash_tag);
+            }
+            bh->hd = hd;
+            bh->lba = lba;
+            bh->valid = false;
+            bh->ref_cnt = 1;
+            list_push(&buffer_hash[buffer_hash_idx(hd, lba)], &bh->hash_tag);
+            break;
+        }
+        // 脏缓冲区先写回再回收，写盘时会睡眠，醒来后要重新查找
+        // 通常写回线程会先把它写回，走到这里说明脏缓冲区积压过多
+        bh->ref_cnt = 1;
+        intr_set_status(old_status);
+        buffer_writeback(bh);
+        intr_disable();
+        // 已经是干净的了，放到表头使下次优先回收它
+        if (--bh->ref_cnt == 0) {
+            list_push(&lru_list, &bh->lru_tag);
+        }
+    }
+    intr_set_status(old_status);
+    return bh;
+}
+
+/**
+ * @brief 取得硬盘 hd 上扇区 lba 的缓冲区，内容不在缓存中时从硬盘读入
+ *        用完后须调用 buffer_put
+ *
+ * @param hd
+ * @param lba
+ * @return struct buffer_head*
+ */
+struct buffer_head* buffer_get(struct disk* hd, uint32_t lba) {
+    struct buffer_head* bh = buffer_grab(hd, lba);
+    lock_acquire(&bh->io_lock);
+    if (!bh->valid) {
+        ide_read(hd, lba, bh->data, 1);
+        bh->valid = true;
+    }
+    lock_release(&bh->io_lock);
+    return bh;
+}
+
+/**
+ * @brief 不再使用缓冲区 bh，没有其它引用时挂到 LRU 链表的表尾
+ *
+ * @param bh
+ */
+void buffer_put(struct buffer_head* bh) {
+    enum intr_status old_status = intr_disable();
+    ASSERT(bh->ref_cnt > 0);
+    if (--bh->ref_cnt == 0) {
+        list_append(&lru_list, &bh->lru_tag);
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 标记缓冲区 bh 已被修改，回收前会先写回硬盘
+ *
+ * @param bh
+ */
+void buffer_mark_dirty(struct buffer_head* bh) {
+    ASSERT(bh->ref_cnt > 0 && bh->valid);
+    buffer_set_dirty(bh);
+}
+
+/**
+ * @brief 经缓存从硬盘 hd 读取从 lba 开始的 sec_cnt 个扇区到 buf
+ *
+ * @param hd
+ * @param lba
+ * @param buf
+ * @param sec_cnt
+ */
+void buffer_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    uint32_t sec_idx;
+    for (sec_idx = 0; sec_idx < sec_cnt; sec_idx++) {
+        struct buffer_head* bh = buffer_get(hd, lba + sec_idx);
+        memcpy((uint8_t*)buf + sec_idx * SECTOR_SIZE, bh->data, SECTOR_SIZE);
+        buffer_put(bh);
+    }
+}
+
+/**
+ * @brief 经缓存把 buf 写入硬盘 hd 从 lba 开始的 sec_cnt 个扇区
+ *        整扇区覆盖，不必先读入原内容；数据留在缓存中，由写回线程或 buffer_sync 写回
+ *
+ * @param hd
+ * @param lba
+ * @param buf
+ * @param sec_cnt
+ */
+void buffer_write(struct disk* hd, uint32_t lba, const void* buf, uint32_t sec_cnt) {
+    uint32_t sec_idx;
+    for (sec_idx = 0; sec_idx < sec_cnt; sec_idx++) {
+        struct buffer_head* bh = buffer_grab(hd, lba + sec_idx);
+        // 与并发的读入互斥，已开始的读入完成后再覆盖
+        lock_acquire(&bh->io_lock);
+        memcpy(bh->data, (const uint8_t*)buf + sec_idx * SECTOR_SIZE, SECTOR_SIZE);
+        bh->valid = true;
+        buffer_set_dirty(bh);
+        lock_release(&bh->io_lock);
+        buffer_put(bh);
+    }
+}
+
+/**
+ * @brief 取得已缓存的 (hd, lba) 缓冲区并增加引用，不在缓存中时返回 NULL，不回收其它缓冲区
+ *        用完后须调用 buffer_put
+ *
+ * @param hd
+ * @param lba
+ * @return struct buffer_head*
+ */
+static struct buffer_head* buffer_peek(struct disk* hd, uint32_t lba) {
+    enum intr_status old_status = intr_disable();
+    struct buffer_head* bh = buffer_lookup(hd, lba);
+    if (bh != NULL && bh->ref_cnt++ == 0) {
+        list_remove(&bh->lru_tag);
+    }
+    intr_set_status(old_status);
+    return bh;
+}
+
+/**
+ * @brief 从硬盘 hd 读取从 lba 开始的 sec_cnt 个扇区直接到 buf，不占用缓冲区
+ *        已缓存的扇区以缓存中的为准，其余连续的扇区一次读入，供大块的文件数据使用
+ *        buf 在用户空间时须先用 user_pages_pin 钉住: 读硬盘时持有通道锁, 缺页处理可能在同一通道上换页或按需加载
+ *
+ * @param hd
+ * @param lba
+ * @param buf
+ * @param sec_cnt
+ */
+void buffer_read_direct(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    uint8_t* dst = buf;
+    // 尚未读入的一段未缓存扇区的起点
+    uint32_t run_start = 0;
+    uint32_t sec_idx;
+    for (sec_idx = 0; sec_idx < sec_cnt; sec_idx++) {
+        struct buffer_head* bh = buffer_peek(hd, lba + sec_idx);
+        if (bh == NULL) {
+            continue;
+        }
+        // 正在预读的扇区等它读完
+        if (!bh->valid) {
+            lock_acquire(&bh->io_lock);
+            lock_release(&bh->io_lock);
+        }
+        // 仍未读入的缓冲区与硬盘上的相同，算作未缓存
+        if (bh->valid) {
+            if (run_start < sec_idx) {
+                ide_read(hd, lba + run_start, dst + run_start * SECTOR_SIZE, sec_idx - run_start);
+            }
+            memcpy(dst + sec_idx * SECTOR_SIZE, bh->data, SECTOR_SIZE);
+            run_start = sec_idx + 1;
+        }
+        buffer_put(bh);
+    }
+    if (run_start < sec_cnt) {
+        ide_read(hd, lba + run_start, dst + run_start * SECTOR_SIZE, sec_cnt - run_start);
+    }
+}
+
+/**
+ * @brief 把 buf 直接写入硬盘 hd 从 lba 开始的 sec_cnt 个扇区，一次写入，不占用缓冲区
+ *        已缓存的扇区同时更新缓存中的内容并清除脏标记，避免旧数据稍后被写回
+ *        buf 在用户空间时须先钉住，原因同 buffer_read_direct
+ *
+ * @param hd
+ * @param lba
+ * @param buf
+ * @param sec_cnt
+ */
+void buffer_write_direct(struct disk* hd, uint32_t lba, const void* buf, uint32_t sec_cnt) {
+    uint32_t sec_idx;
+    for (sec_idx = 0; sec_idx < sec_cnt; sec_idx++) {
+        struct buffer_head* bh = buffer_peek(hd, lba + sec_idx);
+        if (bh == NULL) {
+            continue;
+        }
+        // 与写回、读入互斥
+        lock_acquire(&bh->io_lock);
+        memcpy(bh->data, (const uint8_t*)buf + sec_idx * SECTOR_SIZE, SECTOR_SIZE);
+        bh->valid = true;
+        buffer_clear_dirty(bh);
+        lock_release(&bh->io_lock);
+        buffer_put(bh);
+    }
+    ide_write(hd, lba, (void*)buf, sec_cnt);
+}
+
+/**
+ * @brief 缓冲区 a 是否应排在 b 之前，按硬盘、扇区号排序以便合并相邻扇区
+ *
+ * @param a
+ * @param b
+ * @return bool
+ */
+static bool buffer_before(struct buffer_head* a, struct buffer_head* b) {
+    if (a->hd != b->hd) {
+        return (uint32_t)a->hd < (uint32_t)b->hd;
+    }
+    return a->lba < b->lba;
+}
+
+/**
+ * @brief 把扇区号连续的 cnt 个缓冲区拼接起来，一次写入硬盘
+ *
+ * @param run
+ * @param cnt
+ */
+static void buffer_write_run(struct buffer_head** run, uint32_t cnt) {
+    ASSERT(cnt > 0 && cnt <= BUFFER_FLUSH_MAX_SECS);
+    uint32_t idx;
+    // 写回线程和预读线程之外的路径最多同时持有一个 io_lock，按扇区号顺序加锁不会死锁
+    for (idx = 0; idx < cnt; idx++) {
+        lock_acquire(&run[idx]->io_lock);
+        memcpy(flush_buf + idx * SECTOR_SIZE, run[idx]->data, SECTOR_SIZE);
+        buffer_clear_dirty(run[idx]);
+    }
+    ide_write(run[0]->hd, run[0]->lba, flush_buf, cnt);
+    for (idx = 0; idx < cnt; idx++) {
+        lock_release(&run[idx]->io_lock);
+    }
+}
+
+/**
+ * @brief 写回 filter 挑中的脏缓冲区，扇区号相邻的合并为一次写入
+ *
+ * @param filter
+ * @param arg 传给 filter 的参数
+ */
+static void buffer_flush(flush_filter filter, const void* arg) {
+    lock_acquire(&flush_lock);
+    uint32_t cnt = 0;
+    uint32_t idx;
+    // 收集并引用要写回的缓冲区，使其在写盘期间不被回收
+    enum intr_status old_status = intr_disable();
+    for (idx = 0; idx < buffer_cnt; idx++) {
+        struct buffer_head* bh = &buffers[idx];
+        if (!bh->dirty || !filter(bh, arg)) {
+            continue;
+        }
+        if (bh->ref_cnt++ == 0) {
+            list_remove(&bh->lru_tag);
+        }
+        // 插入排序，脏缓冲区大多本就按扇区号先后产生
+        uint32_t pos = cnt++;
+        while (pos > 0 && buffer_before(bh, flush_set[pos - 1])) {
+            flush_set[pos] = flush_set[pos - 1];
+            pos--;
+        }
+        flush_set[pos] = bh;
+    }
+    intr_set_status(old_status);
+
+    uint32_t start = 0;
+    while (start < cnt) {
+        uint32_t end = start + 1;
+        while (end < cnt && end - start < BUFFER_FLUSH_MAX_SECS && flush_set[end]->hd == flush_set[start]->hd
+            && flush_set[end]->lba == flush_set[end - 1]->lba + 1) {
+            end++;
+        }
+        buffer_write_run(flush_set + start, end - start);
+        start = end;
+    }
+    for (idx = 0; idx < cnt; idx++) {
+        buffer_put(flush_set[idx]);
+    }
+    lock_release(&flush_lock);
+}
+
+static bool flush_filter_disk(struct buffer_head* bh, const void* arg) {
+    return arg == NULL || bh->hd == arg;
+}
+
+static bool flush_filter_aged(struct buffer_head* bh, const void* arg) {
+    (void)arg;
+    return ticks - bh->dirty_tick >= BUFFER_DIRTY_AGE;
+}
+
+/**
+ * @brief buffer_sync_lbas 要写回的扇区
+ *
+ */
+struct lba_set {
+    struct disk* hd;
+    const uint32_t* lbas;
+    uint32_t lba_cnt;
+};
+
+static bool flush_filter_lbas(struct buffer_head* bh, const void* arg) {
+    const struct lba_set* set = arg;
+    if (bh->hd != set->hd) {
+        return false;
+    }
+    uint32_t idx;
+    for (idx = 0; idx < set->lba_cnt; idx++) {
+        if (set->lbas[idx] == bh->lba) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief buffer_sync_range 要写回的连续扇区
+ *
+ */
+struct lba_range {
+    struct disk* hd;
+    uint32_t lba;
+    uint32_t sec_cnt;
+};
+
+static bool flush_filter_range(struct buffer_head* bh, const void* arg) {
+    const struct lba_range* range = arg;
+    return bh->hd == range->hd && bh->lba - range->lba < range->sec_cnt;
+}
+
+/**
+ * @brief 写回线程
+ *        没有脏缓冲区时阻塞；有时每隔 BUFFER_FLUSH_INTERVAL 写回脏了足够久的缓冲区，
+ *        脏缓冲区超过一半时立即全部写回，使回收缓冲区时不必等待写盘
+ *
+ * @param arg
+ */
+static void buffer_flusher(void* arg) {
+    (void)arg;
+    while (true) {
+        enum intr_status old_status = intr_disable();
+        if (dirty_cnt == 0) {
+            flusher_idle = true;
+            thread_block(TASK_BLOCKED);
+        }
+        // 睡眠一个写回间隔, 不在就绪队列中空转; 脏缓冲区太多时由 buffer_set_dirty 提前唤醒
+        if (dirty_cnt < dirty_high) {
+            timer_sleep(BUFFER_FLUSH_INTERVAL);
+        }
+        intr_set_status(old_status);
+
+        if (dirty_cnt >= dirty_high) {
+            buffer_flush(flush_filter_disk, NULL);
+        } else {
+            buffer_flush(flush_filter_aged, NULL);
+        }
+    }
+}
+
+/**
+ * @brief 把硬盘 hd 的全部脏缓冲区写回，hd 为 NULL 时写回所有硬盘的
+ *
+ * @param hd
+ */
+void buffer_sync(struct disk* hd) {
+    buffer_flush(flush_filter_disk, hd);
+}
+
+/**
+ * @brief 把硬盘 hd 上 lbas 所列扇区中脏的缓冲区写回
+ *
+ * @param hd
+ * @param lbas
+ * @param lba_cnt
+ */
+void buffer_sync_lbas(struct disk* hd, const uint32_t* lbas, uint32_t lba_cnt) {
+    struct lba_set set = {hd, lbas, lba_cnt};
+    buffer_flush(flush_filter_lbas, &set);
+}
+
+/**
+ * @brief 把硬盘 hd 上从 lba 开始的 sec_cnt 个扇区中脏的缓冲区写回
+ *
+ * @param hd
+ * @param lba
+ * @param sec_cnt
+ */
+void buffer_sync_range(struct disk* hd, uint32_t lba, uint32_t sec_cnt) {
+    struct lba_range range = {hd, lba, sec_cnt};
+    buffer_flush(flush_filter_range, &range);
+}
+
+/**
+ * @brief 把硬盘 hd 上从 lba 开始的 sec_cnt 个扇区读入缓存，已缓存的扇区不再读
+ *        先取得全部缓冲区再按扇区顺序加锁，取缓冲区时可能要写回脏缓冲区，此时不能持有 io_lock
+ *
+ * @param hd
+ * @param lba
+ * @param sec_cnt 不超过 BUFFER_RA_MAX_SECS
+ * @param run 存放取得的缓冲区
+ */
+static void buffer_prefetch(struct disk* hd, uint32_t lba, uint32_t sec_cnt, struct buffer_head** run) {
+    ASSERT(sec_cnt > 0 && sec_cnt <= BUFFER_RA_MAX_SECS);
+    uint32_t idx;
+    for (idx = 0; idx < sec_cnt; idx++) {
+        run[idx] = buffer_grab(hd, lba + idx);
+    }
+    for (idx = 0; idx < sec_cnt; idx++) {
+        lock_acquire(&run[idx]->io_lock);
+    }
+    // 连续的未读入扇区一次读入
+    uint32_t start = 0;
+    for (idx = 0; idx <= sec_cnt; idx++) {
+        if (idx < sec_cnt && !run[idx]->valid) {
+            continue;
+        }
+        if (start < idx) {
+            ide_read(hd, lba + start, ra_buf, idx - start);
+            uint32_t sec_idx;
+            for (sec_idx = start; sec_idx < idx; sec_idx++) {
+                memcpy(run[sec_idx]->data, ra_buf + (sec_idx - start) * SECTOR_SIZE, SECTOR_SIZE);
+                run[sec_idx]->valid = true;
+            }
+        }
+        start = idx + 1;
+    }
+    for (idx = 0; idx < sec_cnt; idx++) {
+        lock_release(&run[idx]->io_lock);
+        buffer_put(run[idx]);
+    }
+}
+
+/**
+ * @brief 预读线程，依次处理队列中的预读请求，没有请求时阻塞
+ *
+ * @param arg
+ */
+static void buffer_readahead_thread(void* arg) {
+    (void)arg;
+    struct buffer_head* run[BUFFER_RA_MAX_SECS];
+    while (true) {
+        enum intr_status old_status = intr_disable();
+        while (ra_head == ra_tail) {
+            readahead_idle = true;
+            thread_block(TASK_BLOCKED);
+        }
+        struct ra_request req = ra_queue[ra_head & (BUFFER_RA_QUEUE - 1)];
+        ra_head++;
+        intr_set_status(old_status);
+        buffer_prefetch(req.hd, req.lba, req.sec_cnt, run);
+    }
+}
+
+/**
+ * @brief 请求把硬盘 hd 上从 lba 开始的 sec_cnt 个扇区预读到缓存，不等待读完
+ *        队列已满时放弃多出的部分
+ *
+ * @param hd
+ * @param lba
+ * @param sec_cnt
+ * @return uint32_t 放入队列的扇区数, 从 lba 开始连续
+ */
+uint32_t buffer_readahead(struct disk* hd, uint32_t lba, uint32_t sec_cnt) {
+    uint32_t queued = 0;
+    enum intr_status old_status = intr_disable();
+    while (sec_cnt > 0 && ra_tail - ra_head < BUFFER_RA_QUEUE) {
+        struct ra_request* req = &ra_queue[ra_tail & (BUFFER_RA_QUEUE - 1)];
+        req->hd = hd;
+        req->lba = lba;
+        req->sec_cnt = sec_cnt < BUFFER_RA_MAX_SECS ? sec_cnt : BUFFER_RA_MAX_SECS;
+        lba += req->sec_cnt;
+        sec_cnt -= req->sec_cnt;
+        queued += req->sec_cnt;
+        ra_tail++;
+    }
+    if (readahead_idle && ra_head != ra_tail) {
+        readahead_idle = false;
+        thread_unblock(readahead);
+    }
+    intr_set_status(old_status);
+    return queued;
+}
@@ -0,0 +1,74 @@
+/**
+ * @file buffer.h
+ * @author your name (you@domain.com)
+ * @brief 扇区缓冲区缓存，文件系统对硬盘的读写都经过这里
+ * @version 0.1
+ * @date 2023-07-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef FS_BUFFER_H_
+#define FS_BUFFER_H_
+
+#include "lib/stdint.h"
+#include "lib/kernel/list.h"
+#include "device/ide.h"
+#include "thread/sync.h"
+
+// 缓冲区个数，每个缓冲区缓存一个扇区，可按内存大小调整
+#define BUFFER_CNT 256
+// 哈希桶个数，须为 2 的幂
+#define BUFFER_HASH_SIZE 64
+// 写回线程检查脏缓冲区的间隔，以时钟滴答计，每秒 100 次
+#define BUFFER_FLUSH_INTERVAL 50
+// 缓冲区脏了这么久之后由写回线程写回
+#define BUFFER_DIRTY_AGE 300
+// 一次合并写入的最多扇区数
+#define BUFFER_FLUSH_MAX_SECS 16
+// 一个预读请求的最多扇区数
+#define BUFFER_RA_MAX_SECS 32
+// 预读请求队列的长度，须为 2 的幂
+#define BUFFER_RA_QUEUE 16
+
+/**
+ * @brief 一个扇区的缓冲区
+ *        以 (hd, lba) 为键挂在哈希桶中；不被引用时按最近使用的先后挂在 LRU 链表上，可被回收另作他用
+ */
+struct buffer_head {
+    // 缓存的是哪块硬盘的哪个扇区，hd 为 NULL 表示尚未使用过
+    struct disk* hd;
+    uint32_t lba;
+    // 正在使用此缓冲区的次数，为 0 时才可被回收
+    uint32_t ref_cnt;
+    // data 中是否已是扇区的内容
+    bool valid;
+    // data 是否被修改过、尚未写回硬盘
+    bool dirty;
+    // 由干净变脏时的 ticks，写回线程据此判断脏了多久
+    uint32_t dirty_tick;
+    // 读写硬盘期间持有，避免同一缓冲区被重复读入或在写回时被修改
+    struct lock io_lock;
+    // 哈希桶中的节点
+    struct list_elem hash_tag;
+    // LRU 链表中的节点
+    struct list_elem lru_tag;
+    // 扇区数据
+    uint8_t* data;
+};
+
+void buffer_cache_init(uint32_t buf_cnt);
+struct buffer_head* buffer_get(struct disk* hd, uint32_t lba);
+void buffer_put(struct buffer_head* bh);
+void buffer_mark_dirty(struct buffer_head* bh);
+void buffer_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+void buffer_write(struct disk* hd, uint32_t lba, const void* buf, uint32_t sec_cnt);
+void buffer_read_direct(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+void buffer_write_direct(struct disk* hd, uint32_t lba, const void* buf, uint32_t sec_cnt);
+uint32_t buffer_readahead(struct disk* hd, uint32_t lba, uint32_t sec_cnt);
+void buffer_sync(struct disk* hd);
+void buffer_sync_lbas(struct disk* hd, const uint32_t* lbas, uint32_t lba_cnt);
+void buffer_sync_range(struct disk* hd, uint32_t lba, uint32_t sec_cnt);
+
+#endif  // FS_BUFFER_H_
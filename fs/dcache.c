@@ -0,0 +1,181 @@
+#include "fs/dcache.h"
+#include "fs/fs.h"
+#include "kernel/memory.h"
+#include "kernel/interrupt.h"
+#include "kernel/debug.h"
+#include "lib/string.h"
+
+static struct dentry* dentries;
+static struct list dentry_hash[DENTRY_HASH_SIZE];
+static struct list dentry_lru;
+
+static struct list* dentry_bucket(struct partition* part, uint32_t parent_ino, const char* name) {
+    uint32_t hash = parent_ino ^ ((uint32_t)part >> 4);
+    while (*name) {
+        hash = hash * 31 + (uint8_t)*name++;
+    }
+    return &dentry_hash[hash & (DENTRY_HASH_SIZE - 1)];
+}
+
+/**
+ * @brief 初始化目录项缓存
+ *
+ */
+void dcache_init(void) {
+    dentries = sys_malloc(DENTRY_CNT * sizeof(struct dentry));
+    if (dentries == NULL) {
+        PANIC("dcache_init: alloc memory failed!");
+    }
+    uint32_t idx;
+    for (idx = 0; idx < DENTRY_HASH_SIZE; idx++) {
+        list_init(&dentry_hash[idx]);
+    }
+    list_init(&dentry_lru);
+    for (idx = 0; idx < DENTRY_CNT; idx++) {
+        list_append(&dentry_lru, &dentries[idx].lru_tag);
+    }
+}
+
+/**
+ * @brief 在哈希表中查找目录项，调用者需关中断
+ *
+ * @param part
+ * @param parent_ino
+ * @param name
+ * @return struct dentry* 没有时返回 NULL
+ */
+static struct dentry* dentry_find(struct partition* part, uint32_t parent_ino, const char* name) {
+    struct list* bucket = dentry_bucket(part, parent_ino, name);
+    struct list_elem* elem = bucket->head.next;
+    for (; elem != &bucket->tail; elem = elem->next) {
+        struct dentry* d = elem2entry(struct dentry, hash_tag, elem);
+        if (d->part == part && d->parent_ino == parent_ino && !strcmp(d->name, name)) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 从缓存中把目录项 d 去掉，放到 LRU 链表表头以便先被复用，调用者需关中断
+ *
+ * @param d
+ */
+static void dentry_drop(struct dentry* d) {
+    list_remove(&d->hash_tag);
+    d->part = NULL;
+    list_remove(&d->lru_tag);
+    list_push(&dentry_lru, &d->lru_tag);
+}
+
+/**
+ * @brief 在缓存中查找目录 parent_ino 下名为 name 的目录项
+ *
+ * @param part
+ * @param parent_ino
+ * @param name
+ * @param dir_e 命中时存入目录项，负目录项的 f_type 为 FT_UNKNOWN
+ * @return bool 缓存中有记录时返回 true，无论正负
+ */
+bool dcache_lookup(struct partition* part, uint32_t parent_ino, const char* name, struct dir_entry* dir_e) {
+    enum intr_status old_status = intr_disable();
+    struct dentry* d = dentry_find(part, parent_ino, name);
+    if (d != NULL) {
+        memset(dir_e, 0, sizeof(struct dir_entry));
+        memcpy(dir_e->filename, d->name, strlen(d->name));
+        dir_e->i_no = d->i_no;
+        dir_e->f_type = d->f_type;
+        // 移到表尾，成为最近使用的
+        list_remove(&d->lru_tag);
+        list_append(&dentry_lru, &d->lru_tag);
+    }
+    intr_set_status(old_status);
+    return d != NULL;
+}
+
+/**
+ * @brief 在缓存中查找子目录 dir_ino 的父目录及它在父目录中的名字，供 getcwd 使用
+ *        目录只有一个父目录，扫描全部目录项即可，不必读硬盘
+ *
+ * @param part
+ * @param dir_ino
+ * @param parent_ino 存入父目录的 inode 编号
+ * @param name 存入名字，至少 MAX_FILE_NAME_LEN + 1 字节
+ * @return bool 缓存中没有时返回 false
+ */
+bool dcache_lookup_parent(struct partition* part, uint32_t dir_ino, uint32_t* parent_ino, char* name) {
+    bool found = false;
+    enum intr_status old_status = intr_disable();
+    uint32_t idx;
+    for (idx = 0; idx < DENTRY_CNT; idx++) {
+        struct dentry* d = &dentries[idx];
+        // "." 和 ".." 也指向目录，但不是它在父目录中的名字
+        if (d->part == part && d->f_type == FT_DIRECTORY && d->i_no == dir_ino
+            && strcmp(d->name, ".") && strcmp(d->name, "..")) {
+            *parent_ino = d->parent_ino;
+            memcpy(name, d->name, strlen(d->name) + 1);
+            found = true;
+            break;
+        }
+    }
+    intr_set_status(old_status);
+    return found;
+}
+
+/**
+ * @brief 记录目录 parent_ino 下名为 name 的目录项，已有记录时覆盖
+ *
+ * @param part
+ * @param parent_ino
+ * @param name
+ * @param dir_e 为 NULL 时记录负目录项
+ */
+void dcache_add(struct partition* part, uint32_t parent_ino, const char* name, const struct dir_entry* dir_e) {
+    uint32_t name_len = strlen(name);
+    if (name_len > MAX_FILE_NAME_LEN) {
+        return;
+    }
+    enum intr_status old_status = intr_disable();
+    struct dentry* d = dentry_find(part, parent_ino, name);
+    if (d == NULL) {
+        // 复用最久未使用的目录项
+        d = elem2entry(struct dentry, lru_tag, dentry_lru.head.next);
+        if (d->part != NULL) {
+            list_remove(&d->hash_tag);
+        }
+        d->part = part;
+        d->parent_ino = parent_ino;
+        memcpy(d->name, name, name_len);
+        d->name[name_len] = 0;
+        list_push(dentry_bucket(part, parent_ino, name), &d->hash_tag);
+    }
+    if (dir_e != NULL) {
+        d->i_no = dir_e->i_no;
+        d->f_type = dir_e->f_type;
+    } else {
+        d->i_no = 0;
+        d->f_type = FT_UNKNOWN;
+    }
+    list_remove(&d->lru_tag);
+    list_append(&dentry_lru, &d->lru_tag);
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 目录 dir_ino 被删除后，去掉其下的全部目录项以及指向它的目录项
+ *        它的 inode 编号会被再次分配，不能留着旧的记录
+ *
+ * @param part
+ * @param dir_ino
+ */
+void dcache_purge_dir(struct partition* part, uint32_t dir_ino) {
+    enum intr_status old_status = intr_disable();
+    uint32_t idx;
+    for (idx = 0; idx < DENTRY_CNT; idx++) {
+        struct dentry* d = &dentries[idx];
+        if (d->part == part && (d->parent_ino == dir_ino || (d->f_type != FT_UNKNOWN && d->i_no == dir_ino))) {
+            dentry_drop(d);
+        }
+    }
+    intr_set_status(old_status);
+}
@@ -0,0 +1,48 @@
+/**
+ * @file dcache.h
+ * @author your name (you@domain.com)
+ * @brief 目录项缓存，记录 (父目录 inode, 名字) 到子 inode 的映射，路径解析时不必再读目录的扇区
+ * @version 0.1
+ * @date 2023-07-16
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef FS_DCACHE_H_
+#define FS_DCACHE_H_
+
+#include "lib/stdint.h"
+#include "lib/kernel/list.h"
+#include "device/ide.h"
+#include "fs/dir.h"
+
+// 缓存的目录项个数，可按内存大小调整
+#define DENTRY_CNT 256
+// 哈希桶个数，须为 2 的幂
+#define DENTRY_HASH_SIZE 64
+
+/**
+ * @brief 一个缓存的目录项
+ *        f_type 为 FT_UNKNOWN 时是负目录项，表示父目录中没有这个名字
+ */
+struct dentry {
+    // 所属分区，为 NULL 表示未使用
+    struct partition* part;
+    uint32_t parent_ino;
+    char name[MAX_FILE_NAME_LEN + 1];
+    uint32_t i_no;
+    enum file_types f_type;
+    // 以 (part, parent_ino, name) 为键的哈希桶中的节点
+    struct list_elem hash_tag;
+    // LRU 链表中的节点，表头是最久未使用的
+    struct list_elem lru_tag;
+};
+
+void dcache_init(void);
+bool dcache_lookup(struct partition* part, uint32_t parent_ino, const char* name, struct dir_entry* dir_e);
+bool dcache_lookup_parent(struct partition* part, uint32_t dir_ino, uint32_t* parent_ino, char* name);
+void dcache_add(struct partition* part, uint32_t parent_ino, const char* name, const struct dir_entry* dir_e);
+void dcache_purge_dir(struct partition* part, uint32_t dir_ino);
+
+#endif  // FS_DCACHE_H_
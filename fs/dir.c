@@ -1,4 +1,6 @@
 #include "fs/dir.h"
+#include "fs/buffer.h"
+#include "fs/dcache.h"
 #include "fs/file.h"
 #include "lib/kernel/stdio_kernel.h"
 #include "kernel/debug.h"
@@ -9,6 +11,27 @@
 
 // 根目录
 struct dir root_dir;
+// 目录对象缓存
+static struct kmem_cache* dir_cache;
+
+/**
+ * @brief dir 对象的构造函数
+ * 
+ * @param obj 
+ */
+static void dir_ctor(void* obj) {
+    struct dir* pdir = (struct dir*)obj;
+    pdir->inode = NULL;
+    pdir->dir_pos = 0;
+}
+
+/**
+ * @brief 创建目录对象缓存
+ * 
+ */
+void dir_cache_init(void) {
+    dir_cache = kmem_cache_create("dir", sizeof(struct dir), sizeof(uint32_t), dir_ctor);
+}
 
 /**
  * @brief 打开根目录
@@ -28,12 +51,327 @@ void open_root_dir(struct partition* part) {
  * @return struct dir* 
  */
 struct dir* dir_open(struct partition* part, uint32_t inode_no) {
-    struct dir* pdir = (struct dir*)sys_malloc(sizeof(struct dir));
+    // dir_buf 只是读目录项时的缓冲区, 无须清零
+    struct dir* pdir = (struct dir*)kmem_cache_alloc(dir_cache);
+    if (pdir == NULL) {
+        return NULL;
+    }
     pdir->inode = inode_open(part, inode_no);
     pdir->dir_pos = 0;
     return pdir;
 }
 
+/**
+ * @brief 目录项名字的散列值, 只保留高 24 位
+ *
+ * @param name
+ * @return uint32_t
+ */
+static uint32_t dir_name_hash(const char* name) {
+    uint32_t hash = 2166136261U;
+    uint32_t idx;
+    for (idx = 0; idx < MAX_FILE_NAME_LEN && name[idx]; idx++) {
+        hash = (hash ^ (uint8_t)name[idx]) * 16777619U;
+    }
+    return hash & DIR_HASH_MASK;
+}
+
+/**
+ * @brief 是否为目录项 "." 或 "..", 它们总在目录的第 0 块, 不参与散列
+ *
+ * @param name
+ * @return bool
+ */
+static bool dir_name_is_dot(const char* name) {
+    // 比较整个名字, ".profile" 之类以点开头的名字要照常散列
+    return name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0));
+}
+
+/**
+ * @brief 返回目录散列索引块的 lba, 没有建立索引时返回 0
+ *
+ * @param part
+ * @param dir_inode
+ * @return uint32_t
+ */
+static uint32_t dir_index_lba(struct partition* part, struct inode* dir_inode) {
+    uint32_t index_lba;
+    struct buffer_head* bh = buffer_get(part->my_disk, dir_inode->i_sectors[0]);
+    memcpy(&index_lba, ((struct dir_entry*)bh->data)->filename + DIR_INDEX_LBA_OFF, sizeof(uint32_t));
+    buffer_put(bh);
+    return index_lba;
+}
+
+/**
+ * @brief 在索引中找到负责散列值 hash 的项, 即最后一个散列值不大于 hash 的项
+ *
+ * @param index
+ * @param hash
+ * @return uint32_t 索引项的下标
+ */
+static uint32_t dir_index_slot(const struct dir_index* index, uint32_t hash) {
+    uint32_t low = 0, high = index->cnt;
+    while (high - low > 1) {
+        uint32_t mid = (low + high) / 2;
+        if ((index->entries[mid] & DIR_HASH_MASK) <= hash) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * @brief 名为 name 的目录项应在的叶子块的序号
+ *
+ * @param part
+ * @param index_lba
+ * @param name
+ * @return uint32_t
+ */
+static uint32_t dir_index_leaf(struct partition* part, uint32_t index_lba, const char* name) {
+    if (dir_name_is_dot(name)) {
+        return 0;
+    }
+    struct buffer_head* bh = buffer_get(part->my_disk, index_lba);
+    struct dir_index* index = (struct dir_index*)bh->data;
+    ASSERT(index->magic == DIR_INDEX_MAGIC);
+    uint32_t pos = index->entries[dir_index_slot(index, dir_name_hash(name))] & DIR_INDEX_POS_MASK;
+    buffer_put(bh);
+    return pos;
+}
+
+/**
+ * @brief 目录第 pos 个块的 lba, 该块不存在时返回 0
+ *
+ * @param part
+ * @param dir_inode
+ * @param pos
+ * @return uint32_t
+ */
+static uint32_t dir_block_lba(struct partition* part, struct inode* dir_inode, uint32_t pos) {
+    if (pos < 12) {
+        return dir_inode->i_sectors[pos];
+    }
+    if (dir_inode->i_sectors[12] == 0) {
+        return 0;
+    }
+    struct buffer_head* bh = buffer_get(part->my_disk, dir_inode->i_sectors[12]);
+    uint32_t lba = ((uint32_t*)bh->data)[pos - 12];
+    buffer_put(bh);
+    return lba;
+}
+
+/**
+ * @brief 为目录分配第 pos 个块, 需要时一并分配一级间接块表
+ *
+ * @param dir_inode
+ * @param pos
+ * @return int32_t 块的 lba, 失败返回 -1
+ */
+static int32_t dir_block_alloc(struct inode* dir_inode, uint32_t pos) {
+    // 目录的块都尽量靠近它的第 0 块
+    int32_t block_lba = block_bitmap_alloc_near(cur_part, dir_inode->i_sectors[0]);
+    if (block_lba == -1) {
+        return -1;
+    }
+    bitmap_sync(cur_part, block_lba - cur_part->sb->data_start_lba, BLOCK_BITMAP);
+    if (pos < 12) {
+        dir_inode->i_sectors[pos] = block_lba;
+        return block_lba;
+    }
+    uint32_t* table = (uint32_t*)sys_malloc(SECTOR_SIZE);
+    if (table == NULL) {
+        printk("dir_block_alloc: sys_malloc for table failed\n");
+        bitmap_set(&cur_part->block_bitmap, block_lba - cur_part->sb->data_start_lba, 0);
+        return -1;
+    }
+    if (dir_inode->i_sectors[12] == 0) {
+        int32_t table_lba = block_bitmap_alloc_near(cur_part, dir_inode->i_sectors[0]);
+        if (table_lba == -1) {
+            bitmap_set(&cur_part->block_bitmap, block_lba - cur_part->sb->data_start_lba, 0);
+            sys_free(table);
+            return -1;
+        }
+        bitmap_sync(cur_part, table_lba - cur_part->sb->data_start_lba, BLOCK_BITMAP);
+        dir_inode->i_sectors[12] = table_lba;
+    } else {
+        buffer_read(cur_part->my_disk, dir_inode->i_sectors[12], table, 1);
+    }
+    table[pos - 12] = block_lba;
+    buffer_write(cur_part->my_disk, dir_inode->i_sectors[12], table, 1);
+    sys_free(table);
+    return block_lba;
+}
+
+/**
+ * @brief 把目录项 p_de 放进块 leaf 中的空位
+ *
+ * @param leaf
+ * @param p_de
+ * @return bool 块已满时返回 false
+ */
+static bool dir_leaf_add(struct dir_entry* leaf, struct dir_entry* p_de) {
+    uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
+    uint32_t dir_entrys_per_sec = SECTOR_SIZE / dir_entry_size;
+    uint32_t idx;
+    for (idx = 0; idx < dir_entrys_per_sec; idx++) {
+        if (leaf[idx].f_type == FT_UNKNOWN) {
+            memcpy(leaf + idx, p_de, dir_entry_size);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 为只有第 0 块且已写满的目录建立散列索引, 此时第 0 块负责全部散列值,
+ *        随后插入目录项时会把它分裂
+ *
+ * @param dir_inode
+ * @param io_buf
+ * @return uint32_t 索引块的 lba, 失败返回 0
+ */
+static uint32_t dir_index_create(struct inode* dir_inode, void* io_buf) {
+    struct dir_index* index = (struct dir_index*)sys_malloc(SECTOR_SIZE);
+    if (index == NULL) {
+        printk("dir_index_create: sys_malloc for index failed\n");
+        return 0;
+    }
+    int32_t index_lba = block_bitmap_alloc_near(cur_part, dir_inode->i_sectors[0]);
+    if (index_lba == -1) {
+        printk("alloc block bitmap for dir_index_create failed\n");
+        sys_free(index);
+        return 0;
+    }
+    bitmap_sync(cur_part, index_lba - cur_part->sb->data_start_lba, BLOCK_BITMAP);
+    index->magic = DIR_INDEX_MAGIC;
+    index->cnt = 1;
+    index->entries[0] = 0;
+    buffer_write(cur_part->my_disk, index_lba, index, 1);
+    sys_free(index);
+
+    // 在 "." 中记下索引块
+    struct dir_entry* dot = (struct dir_entry*)io_buf;
+    buffer_read(cur_part->my_disk, dir_inode->i_sectors[0], dot, 1);
+    ASSERT(!strncmp(dot->filename, ".", 1));
+    memcpy(dot->filename + DIR_INDEX_LBA_OFF, &index_lba, sizeof(uint32_t));
+    buffer_write(cur_part->my_disk, dir_inode->i_sectors[0], dot, 1);
+    return index_lba;
+}
+
+/**
+ * @brief 把目录项 p_de 插入建立了散列索引的目录 parent_dir
+ *        叶子块满时把它按散列值分成两半, 后一半移到新分配的块
+ * @param parent_dir
+ * @param p_de
+ * @param io_buf 至少 2 个扇区
+ * @param index_lba
+ * @return true
+ * @return false
+ */
+static bool dir_index_insert(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf, uint32_t index_lba) {
+    struct inode* dir_inode = parent_dir->inode;
+    uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
+    uint32_t dir_entrys_per_sec = SECTOR_SIZE / dir_entry_size;
+    struct dir_index* index = (struct dir_index*)sys_malloc_nozero(SECTOR_SIZE);
+    if (index == NULL) {
+        printk("dir_index_insert: sys_malloc for index failed\n");
+        return false;
+    }
+    buffer_read(cur_part->my_disk, index_lba, index, 1);
+    ASSERT(index->magic == DIR_INDEX_MAGIC);
+
+    uint32_t hash = dir_name_hash(p_de->filename);
+    uint32_t slot = dir_index_slot(index, hash);
+    uint32_t leaf_lba = dir_block_lba(cur_part, dir_inode, index->entries[slot] & DIR_INDEX_POS_MASK);
+    struct dir_entry* leaf = (struct dir_entry*)io_buf;
+    buffer_read(cur_part->my_disk, leaf_lba, leaf, 1);
+    if (dir_leaf_add(leaf, p_de)) {
+        buffer_write(cur_part->my_disk, leaf_lba, leaf, 1);
+        goto done;
+    }
+
+    // 叶子块已满, 先找一个空闲的块序号, 索引块满或目录块用完时目录即满
+    uint32_t new_pos = 1;
+    while (new_pos < 140 && dir_block_lba(cur_part, dir_inode, new_pos) != 0) {
+        new_pos++;
+    }
+    if (index->cnt == DIR_INDEX_MAX || new_pos == 140) {
+        goto full;
+    }
+
+    // 以叶子块中散列值的中位数为界分裂, 中位数与本项下界相同时取第一个比下界大的散列值
+    uint32_t low = index->entries[slot] & DIR_HASH_MASK;
+    uint32_t keys[SECTOR_SIZE / sizeof(struct dir_entry)];
+    uint32_t key_cnt = 0, idx;
+    for (idx = 0; idx < dir_entrys_per_sec; idx++) {
+        if (leaf[idx].f_type == FT_UNKNOWN || dir_name_is_dot(leaf[idx].filename)) {
+            continue;
+        }
+        uint32_t key = dir_name_hash(leaf[idx].filename);
+        uint32_t pos = key_cnt++;
+        while (pos > 0 && keys[pos - 1] > key) {
+            keys[pos] = keys[pos - 1];
+            pos--;
+        }
+        keys[pos] = key;
+    }
+    uint32_t split = key_cnt > 0 ? keys[key_cnt / 2] : low;
+    for (idx = 0; split <= low && idx < key_cnt; idx++) {
+        split = keys[idx];
+    }
+    if (split <= low) {
+        // 块中目录项的散列值全都相同, 无法分裂
+        goto full;
+    }
+
+    int32_t new_lba = dir_block_alloc(dir_inode, new_pos);
+    if (new_lba == -1) {
+        printk("alloc block bitmap for sync_dir_entry failed\n");
+        sys_free(index);
+        return false;
+    }
+    struct dir_entry* new_leaf = (struct dir_entry*)((uint8_t*)io_buf + SECTOR_SIZE);
+    memset(new_leaf, 0, SECTOR_SIZE);
+    uint32_t moved = 0;
+    for (idx = 0; idx < dir_entrys_per_sec; idx++) {
+        if (leaf[idx].f_type == FT_UNKNOWN || dir_name_is_dot(leaf[idx].filename)) {
+            continue;
+        }
+        if (dir_name_hash(leaf[idx].filename) >= split) {
+            memcpy(new_leaf + moved++, leaf + idx, dir_entry_size);
+            memset(leaf + idx, 0, dir_entry_size);
+        }
+    }
+    // 插入新的索引项
+    for (idx = index->cnt; idx > slot + 1; idx--) {
+        index->entries[idx] = index->entries[idx - 1];
+    }
+    index->entries[slot + 1] = split | new_pos;
+    index->cnt++;
+
+    bool added = dir_leaf_add(hash >= split ? new_leaf : leaf, p_de);
+    buffer_write(cur_part->my_disk, leaf_lba, leaf, 1);
+    buffer_write(cur_part->my_disk, new_lba, new_leaf, 1);
+    buffer_write(cur_part->my_disk, index_lba, index, 1);
+    if (!added) {
+        goto full;
+    }
+
+done:
+    dir_inode->i_size += dir_entry_size;
+    dcache_add(cur_part, dir_inode->i_no, p_de->filename, p_de);
+    sys_free(index);
+    return true;
+
+full:
+    printk("directory is full!\n");
+    sys_free(index);
+    return false;
+}
+
 /**
  * @brief 在part分区内的pdir目录内寻找名为name的文件或目录,
  *        找到后返回true并将其目录项存入dir_e,否则返回false
@@ -45,6 +383,30 @@ struct dir* dir_open(struct partition* part, uint32_t inode_no) {
  * @return false 
  */
 bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name, struct dir_entry* dir_e) {
+    // 先查目录项缓存, 负目录项表示确定没有此名字
+    if (dcache_lookup(part, pdir->inode->i_no, name, dir_e)) {
+        return dir_e->f_type != FT_UNKNOWN;
+    }
+    // 建立了散列索引的目录只需查找一个块
+    uint32_t index_lba = dir_index_lba(part, pdir->inode);
+    if (index_lba != 0) {
+        uint32_t leaf_lba = dir_block_lba(part, pdir->inode, dir_index_leaf(part, index_lba, name));
+        struct buffer_head* bh = buffer_get(part->my_disk, leaf_lba);
+        struct dir_entry* leaf = (struct dir_entry*)bh->data;
+        uint32_t dir_entry_idx;
+        bool found = false;
+        for (dir_entry_idx = 0; dir_entry_idx < SECTOR_SIZE / part->sb->dir_entry_size; dir_entry_idx++) {
+            if (leaf[dir_entry_idx].f_type != FT_UNKNOWN && !strncmp(leaf[dir_entry_idx].filename, name, strlen(name))) {
+                memcpy(dir_e, leaf + dir_entry_idx, part->sb->dir_entry_size);
+                found = true;
+                break;
+            }
+        }
+        buffer_put(bh);
+        dcache_add(part, pdir->inode->i_no, name, found ? dir_e : NULL);
+        return found;
+    }
+
     // 12个直接块+128个一级间接块=140块
     uint32_t block_cnt = 140;
 
@@ -64,13 +426,13 @@ bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name
 
     // 若含有一级间接块表
     if (pdir->inode->i_sectors[12] != 0) {
-        ide_read(part->my_disk, pdir->inode->i_sectors[12], all_blocks + 12, 1);
+        buffer_read(part->my_disk, pdir->inode->i_sectors[12], all_blocks + 12, 1);
     }
     // 至此, all_blocks 存储的是该文件或目录的所有扇区地址
 
     // 写目录项的时候已保证目录项不跨扇区,
     // 这样读目录项时容易处理, 只申请容纳 1 个扇区的内存
-    uint8_t* buf = (uint8_t*)sys_malloc(SECTOR_SIZE);
+    uint8_t* buf = (uint8_t*)sys_malloc_nozero(SECTOR_SIZE);
     // p_de 为指向目录项的指针,值为 buf 起始地址
     struct dir_entry* p_de = (struct dir_entry*)buf;
     uint32_t dir_entry_size = part->sb->dir_entry_size;
@@ -84,7 +446,7 @@ bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name
             block_idx++;
             continue;
         }
-        ide_read(part->my_disk, all_blocks[block_idx], buf, 1);
+        buffer_read(part->my_disk, all_blocks[block_idx], buf, 1);
 
         uint32_t dir_entry_idx = 0;
         // 遍历扇区中所有目录项
@@ -92,6 +454,7 @@ bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name
             // 若找到了,就直接复制整个目录项
             if (!strncmp(p_de->filename, name, strlen(name))) {
                 memcpy(dir_e, p_de, dir_entry_size);
+                dcache_add(part, pdir->inode->i_no, name, dir_e);
                 sys_free(buf);
                 sys_free(all_blocks);
                 return true;
@@ -107,9 +470,34 @@ bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name
     }
     sys_free(buf);
     sys_free(all_blocks);
+    dcache_add(part, pdir->inode->i_no, name, NULL);
     return false;
 }
 
+/**
+ * @brief 在 part 分区内 inode 编号为 dir_ino 的目录中寻找名为 name 的文件或目录,
+ *        找到后返回 true 并将其目录项存入 dir_e, 否则返回 false
+ *        目录项缓存命中时不必打开目录
+ * @param part
+ * @param dir_ino
+ * @param name
+ * @param dir_e
+ * @return true
+ * @return false
+ */
+bool dir_lookup(struct partition* part, uint32_t dir_ino, const char* name, struct dir_entry* dir_e) {
+    if (dcache_lookup(part, dir_ino, name, dir_e)) {
+        return dir_e->f_type != FT_UNKNOWN;
+    }
+    struct dir* pdir = dir_open(part, dir_ino);
+    if (pdir == NULL) {
+        return false;
+    }
+    bool found = search_dir_entry(part, pdir, name, dir_e);
+    dir_close(pdir);
+    return found;
+}
+
 /**
  * @brief 关闭目录
  * 
@@ -124,7 +512,9 @@ void dir_close(struct dir* dir) {
         return;
     }
     inode_close(dir->inode);
-    sys_free(dir);
+    dir->inode = NULL;
+    dir->dir_pos = 0;
+    kmem_cache_free(dir_cache, dir);
 }
 
 /**
@@ -161,6 +551,12 @@ bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf
     // dir_size应该是dir_entry_size的整数倍
     ASSERT(dir_size % dir_entry_size == 0);
 
+    // 建立了散列索引的目录按名字的散列值找到存放目录项的块
+    uint32_t index_lba = dir_index_lba(cur_part, dir_inode);
+    if (index_lba != 0) {
+        return dir_index_insert(parent_dir, p_de, io_buf, index_lba);
+    }
+
     // 每扇区最大的目录项数目
     uint32_t dir_entrys_per_sec = (512 / dir_entry_size);
     int32_t block_lba = -1;
@@ -175,17 +571,35 @@ bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf
         all_blocks[block_idx] = dir_inode->i_sectors[block_idx];
         block_idx++;
     }
+    if (dir_inode->i_sectors[12] != 0) {
+        buffer_read(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+    }
     // dir_e 用来在 io_buf 中遍历目录项
     struct dir_entry* dir_e = (struct dir_entry*)io_buf;
     int32_t block_bitmap_idx = -1;
 
     // 开始遍历所有块以寻找目录项空位,若已有扇区中没有空闲位,
     // 在不超过文件大小的情况下申请新扇区来存储新目录项
-    block_idx = 0;
+    // 之前的块都是满的, 从记录的空位提示处找起
+    block_idx = inode_dir_hint(dir_inode);
     while (block_idx < 140) {  // 文件(包括目录)最大支持12个直接块+128个间接块＝140个块
         block_bitmap_idx = -1;
+        if (all_blocks[block_idx] == 0 && block_idx == 1 && dir_inode->i_sectors[12] == 0) {
+            // 只有第 0 块的目录写满后改为散列索引, 之前就有多个块的目录仍按顺序查找
+            uint32_t pos = 2;
+            while (pos < 12 && all_blocks[pos] == 0) {
+                pos++;
+            }
+            if (pos == 12) {
+                index_lba = dir_index_create(dir_inode, io_buf);
+                if (index_lba == 0) {
+                    return false;
+                }
+                return dir_index_insert(parent_dir, p_de, io_buf, index_lba);
+            }
+        }
         if (all_blocks[block_idx] == 0) {   // 在三种情况下分配块
-            block_lba = block_bitmap_alloc(cur_part);
+            block_lba = block_bitmap_alloc_near(cur_part, dir_inode->i_sectors[0]);
             if (block_lba == -1) {
                 printk("alloc block bitmap for sync_dir_entry failed\n");
                 return false;
@@ -200,10 +614,10 @@ bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf
             // 若是直接块
             if (block_idx < 12) {
                 dir_inode->i_sectors[block_idx] = all_blocks[block_idx] = block_lba;
-            } else if (block_idx == 12) {  // 若是尚未分配一级间接块表(block_idx等于12表示第0个间接块地址为0)
+            } else if (dir_inode->i_sectors[12] == 0) {  // 若是尚未分配一级间接块表(此时 block_idx 等于 12)
                 dir_inode->i_sectors[12] = block_lba;       // 将上面分配的块做为一级间接块表地址
                 block_lba = -1;
-                block_lba = block_bitmap_alloc(cur_part);  // 再分配一个块做为第0个间接块
+                block_lba = block_bitmap_alloc_near(cur_part, dir_inode->i_sectors[0]);  // 再分配一个块做为第0个间接块
                 if (block_lba == -1) {
                     block_bitmap_idx = dir_inode->i_sectors[12] - cur_part->sb->data_start_lba;
                     bitmap_set(&cur_part->block_bitmap, block_bitmap_idx, 0);
@@ -218,29 +632,33 @@ bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf
 
                 all_blocks[12] = block_lba;
                 // 把新分配的第0个间接块地址写入一级间接块表
-                ide_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+                buffer_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
             } else {  // 若是间接块未分配
                 all_blocks[block_idx] = block_lba;
                 // 把新分配的第(block_idx-12)个间接块地址写入一级间接块表
-                ide_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+                buffer_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
             }
             // 再将新目录项 p_de 写入新分配的间接块
             memset(io_buf, 0, 512);
             memcpy(io_buf, p_de, dir_entry_size);
-            ide_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+            buffer_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
             dir_inode->i_size += dir_entry_size;
+            inode_set_dir_hint(dir_inode, block_idx);
+            dcache_add(cur_part, dir_inode->i_no, p_de->filename, p_de);
             return true;
         }
         // 若第 block_idx 块已存在, 将其读进内存, 然后在该块中查找空目录项
-        ide_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+        buffer_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
         // 在扇区内查找空目录项
         uint8_t dir_entry_idx = 0;
         while (dir_entry_idx < dir_entrys_per_sec) {
             // FT_UNKNOWN为0,无论是初始化或是删除文件后,都会将f_type置为FT_UNKNOWN.
             if ((dir_e + dir_entry_idx)->f_type == FT_UNKNOWN) {
                 memcpy(dir_e + dir_entry_idx, p_de, dir_entry_size);
-                ide_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+                buffer_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
                 dir_inode->i_size += dir_entry_size;
+                inode_set_dir_hint(dir_inode, block_idx);
+                dcache_add(cur_part, dir_inode->i_no, p_de->filename, p_de);
                 return true;
             }
             dir_entry_idx++;
@@ -257,11 +675,12 @@ bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf
  * @param part 
  * @param pdir 
  * @param inode_no 
+ * @param name 目录项的名字, 目录建立了散列索引时只需查找一个块
  * @param io_buf 
  * @return true 
  * @return false 
  */
-bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_no, void* io_buf) {
+bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_no, const char* name, void* io_buf) {
     struct inode* dir_inode = pdir->inode;
     uint32_t block_idx = 0, all_blocks[140] = {0};
     // 收集目录全部块地址
@@ -270,7 +689,7 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
         block_idx++;
     }
     if (dir_inode->i_sectors[12]) {
-        ide_read(part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+        buffer_read(part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
     }
     // 目录项在存储时保证不会跨扇区
     uint32_t dir_entry_size = part->sb->dir_entry_size;
@@ -281,9 +700,17 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
     uint8_t dir_entry_idx, dir_entry_cnt;
     bool is_dir_first_block = false;  // 目录的第 1 个块
 
-    // 遍历所有块,寻找目录项
+    // 建立了散列索引的目录只在名字所在的块中找, 叶子块被索引引用, 空了也不回收
+    uint32_t index_lba = dir_index_lba(part, dir_inode);
+    uint32_t block_end = 140;
     block_idx = 0;
-    while (block_idx < 140) {
+    if (index_lba != 0) {
+        block_idx = dir_index_leaf(part, index_lba, name);
+        block_end = block_idx + 1;
+    }
+
+    // 遍历所有块,寻找目录项
+    while (block_idx < block_end) {
         is_dir_first_block = false;
         if (all_blocks[block_idx] == 0) {
             block_idx++;
@@ -292,7 +719,7 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
         dir_entry_idx = dir_entry_cnt = 0;
         memset(io_buf, 0, SECTOR_SIZE);
         // 读取扇区, 获得目录项
-        ide_read(part->my_disk, all_blocks[block_idx], io_buf, 1);
+        buffer_read(part->my_disk, all_blocks[block_idx], io_buf, 1);
         // 遍历所有的目录项,统计该扇区的目录项数量及是否有待删除的目录项
         while (dir_entry_idx < dir_entrys_per_sec) {
             if ((dir_e + dir_entry_idx)->f_type != FT_UNKNOWN) {
@@ -320,8 +747,13 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
         }
         // 在此扇区中找到目录项后, 清除该目录项并判断是否回收扇区, 随后退出循环直接返回
         ASSERT(dir_entry_cnt >= 1);
+        // 缓存中改记为负目录项, 删除的是目录时还要去掉其下的目录项
+        dcache_add(part, dir_inode->i_no, dir_entry_found->filename, NULL);
+        if (dir_entry_found->f_type == FT_DIRECTORY) {
+            dcache_purge_dir(part, inode_no);
+        }
         // 除目录第 1 个扇区外, 若该扇区上只有该目录项自己, 则将整个扇区回收
-        if (dir_entry_cnt == 1 && !is_dir_first_block) {
+        if (dir_entry_cnt == 1 && !is_dir_first_block && index_lba == 0) {
             // a. 在块位图中回收该块
             uint32_t block_bitmap_idx = all_blocks[block_idx] - part->sb->data_start_lba;
             bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
@@ -336,14 +768,15 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
                 uint32_t indirect_block_idx = 12;
                 while (indirect_block_idx < 140) {
                     if (all_blocks[indirect_block_idx] != 0) {
-                    indirect_blocks++;
+                        indirect_blocks++;
                     }
+                    indirect_block_idx++;
                 }
                 ASSERT(indirect_blocks >= 1);  // 包括当前间接块
                 // 间接索引表中还包括其它间接块, 仅在索引表中擦除当前这个间接块地址
                 if (indirect_blocks > 1) {
                     all_blocks[block_idx] = 0;
-                    ide_write(part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+                    buffer_write(part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
                 } else {  // 间接索引表中就当前这 1 个间接块, 直接把间接索引表所在的块回收, 然后擦除间接索引表块地址
                     // 回收间接索引表所在的块
                     block_bitmap_idx = dir_inode->i_sectors[12] - part->sb->data_start_lba;
@@ -355,13 +788,16 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
             }
         } else {  // 仅将该目录项清空
             memset(dir_entry_found, 0, dir_entry_size);
-            ide_write(part->my_disk, all_blocks[block_idx], io_buf, 1);
+            buffer_write(part->my_disk, all_blocks[block_idx], io_buf, 1);
         }
-        // 更新 i 结点信息并同步到硬盘
+        // 此块有了空位或成了空闲的块序号, 插入目录项时从这里找起
+        if (block_idx < inode_dir_hint(dir_inode)) {
+            inode_set_dir_hint(dir_inode, block_idx);
+        }
+        // 更新 i 结点信息, 操作结束时写入
         ASSERT(dir_inode->i_size >= dir_entry_size);
         dir_inode->i_size -= dir_entry_size;
-        memset(io_buf, 0, SECTOR_SIZE * 2);
-        inode_sync(part, dir_inode, io_buf);
+        inode_mark_dirty(dir_inode);
         return true;
     }
     // 所有块中未找到则返回 false, 若出现这种情况应该是 serarch_file 出错了
@@ -384,7 +820,7 @@ struct dir_entry* dir_read(struct dir* dir) {
     }
     // 若含有一级间接块表
     if (dir_inode->i_sectors[12] != 0) {
-        ide_read(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+        buffer_read(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
         block_cnt = 140;
     }
     block_idx = 0;
@@ -404,7 +840,7 @@ struct dir_entry* dir_read(struct dir* dir) {
             continue;
         }
         memset(dir_e, 0, SECTOR_SIZE);
-        ide_read(cur_part->my_disk, all_blocks[block_idx], dir_e, 1);
+        buffer_read(cur_part->my_disk, all_blocks[block_idx], dir_e, 1);
         dir_entry_idx = 0;
         // 遍历扇区内所有目录项
         while (dir_entry_idx < dir_entrys_per_sec) {
@@ -446,23 +882,32 @@ bool dir_is_empty(struct dir* dir) {
  * 
  * @param parent_dir 
  * @param child_dir 
+ * @param name child_dir 在 parent_dir 中的名字
  * @return int32_t 
  */
-int32_t dir_remove(struct dir* parent_dir, struct dir* child_dir) {
+int32_t dir_remove(struct dir* parent_dir, struct dir* child_dir, const char* name) {
     struct inode* child_dir_inode  = child_dir->inode;
-    // 空目录只在 inode->i_sectors[0] 中有扇区, 其它扇区都应该为空
-    int32_t block_idx = 1;
-    while (block_idx < 13) {
-        ASSERT(child_dir_inode->i_sectors[block_idx] == 0);
-        block_idx++;
+    uint32_t index_lba = dir_index_lba(cur_part, child_dir_inode);
+    if (index_lba != 0) {
+        // 建立过索引的目录空了也保留着叶子块, 由 inode_release 回收, 这里回收索引块
+        uint32_t block_bitmap_idx = index_lba - cur_part->sb->data_start_lba;
+        bitmap_set(&cur_part->block_bitmap, block_bitmap_idx, 0);
+        bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
+    } else {
+        // 空目录只在 inode->i_sectors[0] 中有扇区, 其它扇区都应该为空
+        int32_t block_idx = 1;
+        while (block_idx < 13) {
+            ASSERT(child_dir_inode->i_sectors[block_idx] == 0);
+            block_idx++;
+        }
     }
-    void* io_buf = sys_malloc(SECTOR_SIZE * 2);
+    void* io_buf = sys_malloc_nozero(SECTOR_SIZE * 2);
     if (io_buf == NULL) {
         printk("dir_remove: malloc for io_buf failed\n");
         return -1;
     }
     // 在父目录 parent_dir 中删除子目录 child_dir 对应的目录项
-    delete_dir_entry(cur_part, parent_dir, child_dir_inode->i_no, io_buf);
+    delete_dir_entry(cur_part, parent_dir, child_dir_inode->i_no, name, io_buf);
     // 回收 inode 中 i_secotrs 中所占用的扇区, 并同步 inode_bitmap 和 block_bitmap
     inode_release(cur_part, child_dir_inode->i_no);
     sys_free(io_buf);
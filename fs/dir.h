@@ -21,6 +21,16 @@
 // 最大文件名长度
 #define MAX_FILE_NAME_LEN 16
 
+// 目录的第 1 个块写满后为它建立散列索引, 只有 1 个块的小目录仍按顺序查找
+// 索引块的 lba 记在目录项 "." 的 filename 中, "." 只用了前 2 字节
+#define DIR_INDEX_LBA_OFF 4
+#define DIR_INDEX_MAGIC 0x48444958
+// 一个索引块最多记录的叶子块数
+#define DIR_INDEX_MAX 126
+// 索引项的高 24 位是散列值, 低 8 位是叶子块在目录全部块中的序号
+#define DIR_HASH_MASK 0xffffff00
+#define DIR_INDEX_POS_MASK 0xff
+
 /**
  * @brief 目录结构
  * 在内存中创建的结构，不会写入磁盘
@@ -48,18 +58,32 @@ struct dir_entry {
     enum file_types f_type;
 };
 
+/**
+ * @brief 目录的散列索引块, 不在 i_sectors 中, 只由目录项 "." 引用
+ *        每个叶子块存放散列值在 [本项散列值, 下一项散列值) 中的目录项,
+ *        "." 和 ".." 总在第 0 块
+ */
+struct dir_index {
+    uint32_t magic;
+    uint32_t cnt;
+    // 按散列值升序排列, 第 0 项的散列值为 0
+    uint32_t entries[DIR_INDEX_MAX];
+};
+
 // 根目录
 extern struct dir root_dir;
 
+void dir_cache_init(void);
 void open_root_dir(struct partition* part);
 struct dir* dir_open(struct partition* part, uint32_t inode_no);
 void dir_close(struct dir* dir);
 bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name, struct dir_entry* dir_e);
+bool dir_lookup(struct partition* part, uint32_t dir_ino, const char* name, struct dir_entry* dir_e);
 void create_dir_entry(char* filename, uint32_t inode_no, uint8_t file_type, struct dir_entry* p_de);
 bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf);
-bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_no, void* io_buf);
+bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_no, const char* name, void* io_buf);
 struct dir_entry* dir_read(struct dir* dir);
 bool dir_is_empty(struct dir* dir);
-int32_t dir_remove(struct dir* parent_dir, struct dir* child_dir);
+int32_t dir_remove(struct dir* parent_dir, struct dir* child_dir, const char* name);
 
 #endif  // FS_DIR_H_
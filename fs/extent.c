@@ -0,0 +1,343 @@
+#include "fs/extent.h"
+#include "fs/fs.h"
+#include "fs/file.h"
+#include "fs/buffer.h"
+#include "fs/super_block.h"
+#include "kernel/memory.h"
+#include "kernel/debug.h"
+#include "lib/kernel/bitmap.h"
+#include "lib/kernel/stdio_kernel.h"
+#include "lib/string.h"
+
+/**
+ * @brief 把块位图中从 bit_idx 开始的 cnt 位设为 value，并把涉及的位图扇区同步到硬盘
+ *
+ * @param part
+ * @param bit_idx
+ * @param cnt
+ * @param value
+ */
+static void extent_bits_set(struct partition* part, uint32_t bit_idx, uint32_t cnt, int8_t value) {
+    uint32_t idx;
+    for (idx = 0; idx < cnt; idx++) {
+        bitmap_set(&part->block_bitmap, bit_idx + idx, value);
+    }
+    // 位图一个扇区管理 4096 位，每个扇区同步一次即可
+    uint32_t sec_idx;
+    for (sec_idx = bit_idx / 4096; sec_idx <= (bit_idx + cnt - 1) / 4096; sec_idx++) {
+        bitmap_sync(part, sec_idx * 4096, BLOCK_BITMAP);
+    }
+}
+
+/**
+ * @brief 设置块位图中 [bit_idx, bit_idx + cnt) 的预留标记
+ *        预留的块在内存位图中占用, 但 bitmap_flush 不把它们写入硬盘
+ *
+ * @param part
+ * @param bit_idx
+ * @param cnt
+ * @param value 1 为预留, 0 为取消预留
+ */
+static void extent_reserve_set(struct partition* part, uint32_t bit_idx, uint32_t cnt, int8_t value) {
+    uint32_t idx;
+    for (idx = bit_idx; idx < bit_idx + cnt; idx++) {
+        if (value) {
+            part->block_reserved[idx / 8] |= (1 << (idx % 8));
+        } else {
+            part->block_reserved[idx / 8] &= ~(1 << (idx % 8));
+        }
+    }
+}
+
+/**
+ * @brief 把 extents 中落在文件块 [*block_idx, *block_idx + *block_cnt) 内的部分依次存入 runs
+ *        返回时 *block_idx、*block_cnt 指向还没有映射的部分
+ *
+ * @param extents
+ * @param ext_cnt
+ * @param base extents[0] 是文件的第几块，返回时更新为 extents 之后的块
+ * @param block_idx
+ * @param block_cnt
+ * @param runs
+ * @param run_cnt runs 中已有的个数
+ * @param max_runs
+ * @return uint32_t runs 中现有的个数
+ */
+static uint32_t extent_clip(const struct extent* extents, uint32_t ext_cnt, uint32_t* base,
+                            uint32_t* block_idx, uint32_t* block_cnt,
+                            struct extent* runs, uint32_t run_cnt, uint32_t max_runs) {
+    uint32_t idx;
+    for (idx = 0; idx < ext_cnt && extents[idx].len != 0; idx++) {
+        if (*block_cnt == 0 || run_cnt == max_runs) {
+            break;
+        }
+        uint32_t end = *base + extents[idx].len;
+        if (*block_idx < end) {
+            uint32_t off = *block_idx - *base;
+            uint32_t len = extents[idx].len - off;
+            if (len > *block_cnt) {
+                len = *block_cnt;
+            }
+            runs[run_cnt].start = extents[idx].start + off;
+            runs[run_cnt].len = len;
+            run_cnt++;
+            *block_idx += len;
+            *block_cnt -= len;
+        }
+        *base = end;
+    }
+    return run_cnt;
+}
+
+/**
+ * @brief 把文件第 block_idx 块开始的 block_cnt 块映射为硬盘上的连续扇区段
+ *        段数超过 max_runs 时只映射前面的部分，调用者可从下一块起再次映射
+ *
+ * @param part
+ * @param inode
+ * @param block_idx
+ * @param block_cnt
+ * @param runs 存入各段的起始 lba 和扇区数
+ * @param max_runs
+ * @return uint32_t 存入 runs 的段数，超出已分配的块时不映射
+ */
+uint32_t extent_map(struct partition* part, struct inode* inode, uint32_t block_idx, uint32_t block_cnt,
+                    struct extent* runs, uint32_t max_runs) {
+    ASSERT(inode->i_flags & INODE_EXTENTS);
+    uint32_t base = 0;
+    uint32_t run_cnt = extent_clip(inode->i_extents, INODE_EXTENT_CNT, &base, &block_idx, &block_cnt,
+                                   runs, 0, max_runs);
+    if (block_cnt != 0 && run_cnt < max_runs && inode->i_extent_block != 0) {
+        struct buffer_head* bh = buffer_get(part->my_disk, inode->i_extent_block);
+        struct extent_block* eb = (struct extent_block*)bh->data;
+        run_cnt = extent_clip(eb->extents, eb->cnt, &base, &block_idx, &block_cnt, runs, run_cnt, max_runs);
+        buffer_put(bh);
+    }
+    return run_cnt;
+}
+
+/**
+ * @brief 把 inode 的全部区段读到 extents 中
+ *
+ * @param part
+ * @param inode
+ * @param extents 至少 EXTENT_MAX 项
+ * @return uint32_t 区段数
+ */
+static uint32_t extent_load(struct partition* part, struct inode* inode, struct extent* extents) {
+    uint32_t cnt = 0;
+    while (cnt < INODE_EXTENT_CNT && inode->i_extents[cnt].len != 0) {
+        extents[cnt] = inode->i_extents[cnt];
+        cnt++;
+    }
+    if (inode->i_extent_block != 0) {
+        struct buffer_head* bh = buffer_get(part->my_disk, inode->i_extent_block);
+        struct extent_block* eb = (struct extent_block*)bh->data;
+        memcpy(extents + cnt, eb->extents, eb->cnt * sizeof(struct extent));
+        cnt += eb->cnt;
+        buffer_put(bh);
+    }
+    return cnt;
+}
+
+/**
+ * @brief 把 extents 写回 inode，多出 INODE_EXTENT_CNT 的部分写入溢出块
+ *        需要溢出块时调用者应已分配好
+ *
+ * @param part
+ * @param inode
+ * @param extents
+ * @param ext_cnt
+ * @param eb 一个扇区大小的缓冲区
+ */
+static void extent_store(struct partition* part, struct inode* inode, const struct extent* extents,
+                         uint32_t ext_cnt, struct extent_block* eb) {
+    uint32_t inode_cnt = ext_cnt < INODE_EXTENT_CNT ? ext_cnt : INODE_EXTENT_CNT;
+    memset(inode->i_extents, 0, sizeof(inode->i_extents));
+    memcpy(inode->i_extents, extents, inode_cnt * sizeof(struct extent));
+    if (ext_cnt > INODE_EXTENT_CNT) {
+        ASSERT(inode->i_extent_block != 0);
+        memset(eb, 0, sizeof(struct extent_block));
+        eb->cnt = ext_cnt - INODE_EXTENT_CNT;
+        memcpy(eb->extents, extents + INODE_EXTENT_CNT, eb->cnt * sizeof(struct extent));
+        buffer_write(part->my_disk, inode->i_extent_block, eb, 1);
+    }
+}
+
+/**
+ * @brief 要新建第 ext_cnt 个区段且它放不进 inode 时，确保已有溢出块
+ *        溢出块靠近 inode 对应的块组，不挤占数据后面的空闲块
+ *
+ * @param part
+ * @param inode
+ * @param ext_cnt
+ * @return bool 分配失败时返回 false
+ */
+static bool extent_spill_alloc(struct partition* part, struct inode* inode, uint32_t ext_cnt) {
+    if (ext_cnt < INODE_EXTENT_CNT || inode->i_extent_block != 0) {
+        return true;
+    }
+    int32_t block_lba = block_bitmap_alloc_near(part, inode_block_goal(part, inode->i_no));
+    if (block_lba == -1) {
+        return false;
+    }
+    bitmap_sync(part, block_lba - part->sb->data_start_lba, BLOCK_BITMAP);
+    inode->i_extent_block = block_lba;
+    return true;
+}
+
+/**
+ * @brief 为文件分配数据块，使其至少有 block_cnt 块，依次尝试：
+ *        1. 之前为文件预留的块；
+ *        2. 紧接着最后一个区段的空闲块，文件保持连续；
+ *        3. 从最后一个区段之后 (还没有区段时从 inode 对应的块组) 找一段连续的空闲块，找不到时把长度减半再找，
+ *           多找到的 EXTENT_PREALLOC_BLOCKS 块预留给下次写入
+ *        失败时已分配的块仍留在文件中，删除文件时一并回收
+ *
+ * @param part
+ * @param inode 必须是 inode_open 返回的，调用者随后须 inode_mark_dirty
+ * @param block_cnt
+ * @return bool 空闲块不足或区段数超过 EXTENT_MAX 时返回 false
+ */
+bool extent_grow(struct partition* part, struct inode* inode, uint32_t block_cnt) {
+    ASSERT(inode->i_flags & INODE_EXTENTS);
+    // 前半部分存放全部区段，后半部分给 extent_store 做缓冲区
+    struct extent* extents = sys_malloc_nozero(EXTENT_MAX * sizeof(struct extent) + sizeof(struct extent_block));
+    if (extents == NULL) {
+        printk("extent_grow: sys_malloc for extents failed\n");
+        return false;
+    }
+    struct bitmap* bm = &part->block_bitmap;
+    uint32_t bits_len = bm->bmap_bytes_len * 8;
+    uint32_t data_start = part->sb->data_start_lba;
+    uint32_t ext_cnt = extent_load(part, inode, extents);
+    uint32_t have = 0, idx;
+    for (idx = 0; idx < ext_cnt; idx++) {
+        have += extents[idx].len;
+    }
+
+    struct extent* prealloc = inode_prealloc(inode);
+    bool ok = true;
+    while (have < block_cnt) {
+        uint32_t want = block_cnt - have;
+        bool adjacent = ext_cnt != 0 && extents[ext_cnt - 1].start + extents[ext_cnt - 1].len == prealloc->start;
+        // 1. 使用预留的块, 它们已在内存位图中占用, 同步到硬盘即可
+        if (prealloc->len != 0 && (adjacent || ext_cnt < EXTENT_MAX)) {
+            if (!adjacent && !extent_spill_alloc(part, inode, ext_cnt)) {
+                ok = false;
+                break;
+            }
+            uint32_t len = want < prealloc->len ? want : prealloc->len;
+            // 预留的块转为正式占用, 此后写入硬盘
+            extent_reserve_set(part, prealloc->start - data_start, len, 0);
+            extent_bits_set(part, prealloc->start - data_start, len, 1);
+            if (adjacent) {
+                extents[ext_cnt - 1].len += len;
+            } else {
+                extents[ext_cnt].start = prealloc->start;
+                extents[ext_cnt].len = len;
+                ext_cnt++;
+            }
+            prealloc->start += len;
+            prealloc->len -= len;
+            have += len;
+            continue;
+        }
+        // 2. 紧接着最后一个区段的块空闲时直接扩展它
+        if (ext_cnt != 0) {
+            struct extent* last = &extents[ext_cnt - 1];
+            uint32_t bit_idx = last->start + last->len - data_start;
+            uint32_t grown = 0;
+            while (grown < want && bit_idx + grown < bits_len && !bitmap_scan_test(bm, bit_idx + grown)) {
+                grown++;
+            }
+            if (grown != 0) {
+                extent_bits_set(part, bit_idx, grown, 1);
+                last->len += grown;
+                have += grown;
+                continue;
+            }
+        }
+        // 3. 新建一个区段
+        if (ext_cnt == EXTENT_MAX) {
+            printk("extent_grow: too many extents\n");
+            ok = false;
+            break;
+        }
+        if (!extent_spill_alloc(part, inode, ext_cnt)) {
+            ok = false;
+            break;
+        }
+        uint32_t goal = ext_cnt != 0 ? extents[ext_cnt - 1].start + extents[ext_cnt - 1].len - data_start
+                                     : inode_block_goal(part, inode->i_no) - data_start;
+        uint32_t len = want + EXTENT_PREALLOC_BLOCKS;
+        int32_t bit_idx;
+        while ((bit_idx = bitmap_scan_near(bm, goal, len)) == -1 && len > 1) {
+            len /= 2;
+        }
+        if (bit_idx == -1) {
+            ok = false;
+            break;
+        }
+        uint32_t use = want < len ? want : len;
+        extent_bits_set(part, bit_idx, use, 1);
+        extents[ext_cnt].start = data_start + bit_idx;
+        extents[ext_cnt].len = use;
+        ext_cnt++;
+        have += use;
+        // 多出的部分预留给下次写入, 只在内存位图中占用
+        for (idx = use; idx < len; idx++) {
+            bitmap_set(bm, bit_idx + idx, 1);
+        }
+        extent_reserve_set(part, bit_idx + use, len - use, 1);
+        prealloc->start = data_start + bit_idx + use;
+        prealloc->len = len - use;
+    }
+    extent_store(part, inode, extents, ext_cnt, (struct extent_block*)(extents + EXTENT_MAX));
+    sys_free(extents);
+    return ok;
+}
+
+/**
+ * @brief 回收文件的全部数据块和溢出块
+ *
+ * @param part
+ * @param inode 调用者随后须写入 inode
+ */
+void extent_release(struct partition* part, struct inode* inode) {
+    ASSERT(inode->i_flags & INODE_EXTENTS);
+    struct extent* extents = sys_malloc_nozero(EXTENT_MAX * sizeof(struct extent));
+    if (extents == NULL) {
+        printk("extent_release: sys_malloc for extents failed\n");
+        return;
+    }
+    uint32_t ext_cnt = extent_load(part, inode, extents);
+    uint32_t idx;
+    for (idx = 0; idx < ext_cnt; idx++) {
+        ASSERT(extents[idx].start > part->sb->data_start_lba);
+        extent_bits_set(part, extents[idx].start - part->sb->data_start_lba, extents[idx].len, 0);
+    }
+    if (inode->i_extent_block != 0) {
+        extent_bits_set(part, inode->i_extent_block - part->sb->data_start_lba, 1, 0);
+    }
+    memset(inode->i_extents, 0, sizeof(inode->i_extents));
+    inode->i_extent_block = 0;
+    sys_free(extents);
+}
+
+/**
+ * @brief 归还为文件预留而未用的块，文件最后一次关闭时调用
+ *
+ * @param part
+ * @param inode 必须是 inode_open 返回的
+ */
+void extent_prealloc_release(struct partition* part, struct inode* inode) {
+    struct extent* prealloc = inode_prealloc(inode);
+    if (prealloc->len == 0) {
+        return;
+    }
+    extent_reserve_set(part, prealloc->start - part->sb->data_start_lba, prealloc->len, 0);
+    extent_bits_set(part, prealloc->start - part->sb->data_start_lba, prealloc->len, 0);
+    prealloc->start = 0;
+    prealloc->len = 0;
+}
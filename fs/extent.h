@@ -0,0 +1,43 @@
+/**
+ * @file extent.h
+ * @author your name (you@domain.com)
+ * @brief 普通文件的区段映射，文件的数据块由若干段连续的扇区 (起始 lba, 长度) 组成
+ * @version 0.1
+ * @date 2023-07-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef FS_EXTENT_H_
+#define FS_EXTENT_H_
+
+#include "lib/stdint.h"
+#include "device/ide.h"
+#include "fs/inode.h"
+
+// 溢出块中最多存放的区段数
+#define EXTENT_BLOCK_CNT 63
+// 一个文件最多的区段数
+#define EXTENT_MAX (INODE_EXTENT_CNT + EXTENT_BLOCK_CNT)
+// 新建区段时多预留的块数，交替写入的文件各自在预留的块中增长，可按需要调整
+#define EXTENT_PREALLOC_BLOCKS 16
+
+/**
+ * @brief 区段溢出块，存放 inode 中放不下的区段，正好一个扇区
+ *
+ */
+struct extent_block {
+    // 溢出块中的区段数
+    uint32_t cnt;
+    uint32_t reserved;
+    struct extent extents[EXTENT_BLOCK_CNT];
+};
+
+uint32_t extent_map(struct partition* part, struct inode* inode, uint32_t block_idx, uint32_t block_cnt,
+                    struct extent* runs, uint32_t max_runs);
+bool extent_grow(struct partition* part, struct inode* inode, uint32_t block_cnt);
+void extent_release(struct partition* part, struct inode* inode);
+void extent_prealloc_release(struct partition* part, struct inode* inode);
+
+#endif  // FS_EXTENT_H_
@@ -2,6 +2,8 @@
 #include "fs/fs.h"
 #include "fs/super_block.h"
 #include "fs/inode.h"
+#include "fs/buffer.h"
+#include "fs/extent.h"
 #include "lib/kernel/stdio_kernel.h"
 #include "kernel/memory.h"
 #include "kernel/debug.h"
@@ -11,6 +13,10 @@
 #include "kernel/global.h"
 
 #define DEFAULT_SECS 1
+// file_read、file_write 一次映射的扇区段数
+#define FILE_MAP_RUNS 8
+// 直接读写用户缓冲区时一次最多钉住这么多扇区所在的页，以免内存紧张时钉住太多页无法换出
+#define FILE_PIN_SECS (16 * PAGE_SIZE / BLOCK_SIZE)
 
 /**
  * @brief 文件表
@@ -63,12 +69,14 @@ int32_t pcb_fd_install(int32_t globa_fd_idx) {
 
 /**
  * @brief 分配一个 inode 节点，返回 inode 节点号
+ *        从 goal_ino 开始找，新文件的 inode 靠近父目录的 inode，其数据块也就落在相近的块组
  * 
  * @param part 
+ * @param goal_ino 
  * @return int32_t 
  */
-int32_t inode_bitmap_alloc(struct partition* part) {
-    int32_t bit_idx = bitmap_scan(&part->inode_bitmap, 1);
+int32_t inode_bitmap_alloc(struct partition* part, uint32_t goal_ino) {
+    int32_t bit_idx = bitmap_scan_near(&part->inode_bitmap, goal_ino, 1);
     if (bit_idx == -1) {
         return -1;
     }
@@ -93,30 +101,115 @@ int32_t block_bitmap_alloc(struct partition* part) {
 }
 
 /**
- * @brief 将内存中 bitmap 第 bit_idx 位所在的 512 字节同步到硬盘
+ * @brief 分配 1 个扇区, 从 goal_lba 开始找, 返回其扇区地址
+ * 
+ * @param part 
+ * @param goal_lba 
+ * @return int32_t 
+ */
+int32_t block_bitmap_alloc_near(struct partition* part, uint32_t goal_lba) {
+    uint32_t goal = goal_lba > part->sb->data_start_lba ? goal_lba - part->sb->data_start_lba : 0;
+    int32_t bit_idx = bitmap_scan_near(&part->block_bitmap, goal, 1);
+    if (bit_idx == -1) {
+        return -1;
+    }
+    bitmap_set(&part->block_bitmap, bit_idx, 1);
+    return (part->sb->data_start_lba + bit_idx);
+}
+
+/**
+ * @brief inode 的数据块优先所在的块组的起始扇区地址
+ *        按 inode 编号在全部 inode 中的位置, 把数据块均匀地分到各块组, 编号相近的 inode 落在相同或相邻的块组
+ * 
+ * @param part 
+ * @param inode_no 
+ * @return uint32_t 
+ */
+uint32_t inode_block_goal(struct partition* part, uint32_t inode_no) {
+    uint32_t group_cnt = DIV_ROUND_UP(part->block_bitmap.bmap_bytes_len * 8, BLOCK_GROUP_SIZE);
+    uint32_t group = inode_no * group_cnt / MAX_FILES_PER_PART;
+    return part->sb->data_start_lba + group * BLOCK_GROUP_SIZE;
+}
+
+/**
+ * @brief 标记内存中 bitmap 第 bit_idx 位所在的 512 字节已修改
+ *        由 bitmap_flush 在操作结束时统一写入缓存，同一扇区分配多个块也只写一次
  * 
  * @param part 
  * @param bit_idx 
  * @param btmp_type 
  */
 void bitmap_sync(struct partition* part, uint32_t bit_idx, uint8_t btmp_type) {
-    uint32_t off_sec = bit_idx / 4096;  // 本i结点索引相对于位图的扇区偏移量
-    uint32_t off_size = off_sec * BLOCK_SIZE;  // 本i结点索引相对于位图的字节偏移量
-    uint32_t sec_lba;
-    uint8_t* bitmap_off;
+    uint32_t off_sec = bit_idx / BITS_PER_SECTOR;  // 本i结点索引相对于位图的扇区偏移量
 
     // 需要被同步到硬盘的位图只有 inode_bitmap 和 block_bitmap
     switch (btmp_type) {
     case INODE_BITMAP:
-        sec_lba = part->sb->inode_bitmap_lba + off_sec;
-        bitmap_off = part->inode_bitmap.bits + off_size;
+        ASSERT(off_sec < part->sb->inode_bitmap_sects);
+        part->bitmap_dirty[part->sb->block_bitmap_sects + off_sec] = 1;
         break;
     case BLOCK_BITMAP:
-        sec_lba = part->sb->block_bitmap_lba + off_sec;
-        bitmap_off = part->block_bitmap.bits + off_size;
+        ASSERT(off_sec < part->sb->block_bitmap_sects);
+        part->bitmap_dirty[off_sec] = 1;
         break;
     }
-    ide_write(part->my_disk, sec_lba, bitmap_off, 1);
+}
+
+/**
+ * @brief 把块位图的第 off_sec 个扇区写入缓存, 去掉其中为文件预留的块
+ * 
+ * @param part 
+ * @param off_sec 
+ * @return bool 申请内存失败时返回 false
+ */
+static bool block_bitmap_write(struct partition* part, uint32_t off_sec) {
+    const uint8_t* bits = part->block_bitmap.bits + off_sec * BLOCK_SIZE;
+    const uint8_t* reserved = part->block_reserved + off_sec * BLOCK_SIZE;
+    uint32_t idx = 0;
+    while (idx < BLOCK_SIZE && reserved[idx] == 0) {
+        idx++;
+    }
+    // 没有预留的块, 直接写内存中的位图
+    if (idx == BLOCK_SIZE) {
+        buffer_write(part->my_disk, part->sb->block_bitmap_lba + off_sec, bits, 1);
+        return true;
+    }
+    uint8_t* sec_buf = sys_malloc_nozero(BLOCK_SIZE);
+    if (sec_buf == NULL) {
+        return false;
+    }
+    for (idx = 0; idx < BLOCK_SIZE; idx++) {
+        sec_buf[idx] = bits[idx] & ~reserved[idx];
+    }
+    buffer_write(part->my_disk, part->sb->block_bitmap_lba + off_sec, sec_buf, 1);
+    sys_free(sec_buf);
+    return true;
+}
+
+/**
+ * @brief 把 bitmap_sync 标记过的位图扇区写入缓存，由写回线程或 sync 写回硬盘
+ * 
+ * @param part 
+ */
+void bitmap_flush(struct partition* part) {
+    uint32_t block_sects = part->sb->block_bitmap_sects;
+    uint32_t off_sec;
+    for (off_sec = 0; off_sec < block_sects + part->sb->inode_bitmap_sects; off_sec++) {
+        if (!part->bitmap_dirty[off_sec]) {
+            continue;
+        }
+        part->bitmap_dirty[off_sec] = 0;
+        if (off_sec < block_sects) {
+            if (!block_bitmap_write(part, off_sec)) {
+                // 保留脏标记, 下次再写
+                printk("bitmap_flush: sys_malloc for sec_buf failed\n");
+                part->bitmap_dirty[off_sec] = 1;
+            }
+        } else {
+            buffer_write(part->my_disk, part->sb->inode_bitmap_lba + off_sec - block_sects,
+                         part->inode_bitmap.bits + (off_sec - block_sects) * BLOCK_SIZE, 1);
+        }
+    }
 }
 
 /**
@@ -137,7 +230,7 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     // 用于操作失败时回滚各资源状态
     uint8_t rollback_step = 0;
     // 为新文件分配 inode
-    int32_t inode_no = inode_bitmap_alloc(cur_part);
+    int32_t inode_no = inode_bitmap_alloc(cur_part, parent_dir->inode->i_no);
     if (inode_no == -1) {
         printk("in file_creat: allocate inode failed\n");
         return -1;
@@ -145,14 +238,15 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
 
     // 此 inode 要从堆中申请内存, 不可生成局部变量(函数退出时会释放)
     // 因为 file_table 数组中的文件描述符的 inode 指针要指向它
-    struct inode* new_file_inode = (struct inode*)sys_malloc(sizeof(struct inode));
+    struct inode* new_file_inode = (struct inode*)kmem_cache_alloc(inode_cache);
     if (new_file_inode == NULL) {
-        printk("file_create: sys_malloc for inode failded\n");
+        printk("file_create: kmem_cache_alloc for inode failded\n");
         rollback_step = 1;
         goto rollback;
     }
-    // 初始化i结点
+    // 初始化i结点, 普通文件的数据块按区段映射
     inode_init(inode_no, new_file_inode);
+    new_file_inode->i_flags |= INODE_EXTENTS;
     // 返回的是 file_table 数组的下标
     int fd_idx = get_free_slot_in_global();
     if (fd_idx == -1) {
@@ -165,6 +259,7 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     file_table[fd_idx].fd_pos = 0;
     file_table[fd_idx].fd_flag = flag;
     file_table[fd_idx].fd_inode->write_deny = false;
+    file_ra_init(&file_table[fd_idx].fd_ra);
 
     struct dir_entry new_dir_entry;
     memset(&new_dir_entry, 0, sizeof(struct dir_entry));
@@ -179,20 +274,17 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
         goto rollback;
     }
 
-    memset(io_buf, 0, 1024);
-    // b 将父目录i结点的内容同步到硬盘
-    inode_sync(cur_part, parent_dir->inode, io_buf);
+    // b 父目录i结点已修改, 操作结束时写入
+    inode_mark_dirty(parent_dir->inode);
 
-    memset(io_buf, 0, 1024);
     // c 将新创建文件的i结点内容同步到硬盘
-    inode_sync(cur_part, new_file_inode, io_buf);
+    inode_sync(cur_part, new_file_inode);
 
     // d 将inode_bitmap位图同步到硬盘
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
-    // e 将创建的文件i结点添加到open_inodes链表
-    list_push(&cur_part->open_inodes, &new_file_inode->inode_tag);
-    new_file_inode->i_open_cnts = 1;
+    // e 将创建的文件i结点加入 inode 哈希表
+    inode_hash_insert(cur_part, new_file_inode);
 
     sys_free(io_buf);
     return pcb_fd_install(fd_idx);
@@ -203,11 +295,11 @@ rollback:
     case 3:
         // 失败时,将file_table中的相应位清空
         memset(&file_table[fd_idx], 0, sizeof(struct file));
-        sys_free(new_file_inode);
+        kmem_cache_free(inode_cache, new_file_inode);
         bitmap_set(&cur_part->inode_bitmap, inode_no, 0);
         break;
     case 2:
-        sys_free(new_file_inode);
+        kmem_cache_free(inode_cache, new_file_inode);
         bitmap_set(&cur_part->inode_bitmap, inode_no, 0);
         break;
     case 1:
@@ -236,6 +328,7 @@ int32_t file_open(uint32_t inode_no, uint8_t flag) {
     // 每次打开文件，要将 fd_pos 还原为 0，即让文件内的指针指向开头
     file_table[fd_idx].fd_pos = 0;
     file_table[fd_idx].fd_flag = flag;
+    file_ra_init(&file_table[fd_idx].fd_ra);
     bool* write_deny = &file_table[fd_idx].fd_inode->write_deny;
     // 只要是关于写文件，判断是否有其他进程正在写此文件
     // 如果是读文件，不考虑 write_deny
@@ -274,6 +367,55 @@ int32_t file_close(struct file* file) {
     return 0;
 }
 
+/**
+ * @brief 把 src 中的 sec_cnt 个整扇区直接写到 sec_lba 开始的扇区
+ *        ide_write 持有通道锁时缺页的话, 缺页处理可能换页或按需加载, 在同一通道上发起新的命令,
+ *        所以用户缓冲区先分批钉住再交给硬盘
+ *
+ * @param sec_lba
+ * @param src
+ * @param sec_cnt
+ */
+static void file_write_sectors(uint32_t sec_lba, const uint8_t* src, uint32_t sec_cnt) {
+    if ((uint32_t)src >= 0xc0000000) {
+        buffer_write_direct(cur_part->my_disk, sec_lba, src, sec_cnt);
+        return;
+    }
+    while (sec_cnt > 0) {
+        uint32_t cnt = sec_cnt < FILE_PIN_SECS ? sec_cnt : FILE_PIN_SECS;
+        user_pages_pin((void*)src, cnt * BLOCK_SIZE, false);
+        buffer_write_direct(cur_part->my_disk, sec_lba, src, cnt);
+        user_pages_unpin((void*)src, cnt * BLOCK_SIZE);
+        sec_lba += cnt;
+        src += cnt * BLOCK_SIZE;
+        sec_cnt -= cnt;
+    }
+}
+
+/**
+ * @brief 把 sec_lba 开始的 sec_cnt 个整扇区直接读到 dst
+ *        用户缓冲区先分批钉住并解除写时复制，原因同 file_write_sectors
+ *
+ * @param sec_lba
+ * @param dst
+ * @param sec_cnt
+ */
+static void file_read_sectors(uint32_t sec_lba, uint8_t* dst, uint32_t sec_cnt) {
+    if ((uint32_t)dst >= 0xc0000000) {
+        buffer_read_direct(cur_part->my_disk, sec_lba, dst, sec_cnt);
+        return;
+    }
+    while (sec_cnt > 0) {
+        uint32_t cnt = sec_cnt < FILE_PIN_SECS ? sec_cnt : FILE_PIN_SECS;
+        user_pages_pin(dst, cnt * BLOCK_SIZE, true);
+        buffer_read_direct(cur_part->my_disk, sec_lba, dst, cnt);
+        user_pages_unpin(dst, cnt * BLOCK_SIZE);
+        sec_lba += cnt;
+        dst += cnt * BLOCK_SIZE;
+        sec_cnt -= cnt;
+    }
+}
+
 /**
  * @brief 文件的写入操作
  *        把 buf 中的 count 个字节写入 file 中
@@ -284,213 +426,142 @@ int32_t file_close(struct file* file) {
  * @return int32_t 
  */
 int32_t file_write(struct file* file, const void* buf, uint32_t count) {
-    // 文件目前最大只支持512*140=71680字节
-    if ((file->fd_inode->i_size + count) > (BLOCK_SIZE * 140)) {
-        printk("exceed max file_size 71680 bytes, write file failed\n");
+    struct inode* inode = file->fd_inode;
+    // 文件大小用 32 位表示
+    if (inode->i_size + count < inode->i_size) {
+        printk("exceed max file_size, write file failed\n");
         return -1;
     }
-    uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
+    uint8_t* io_buf = sys_malloc_nozero(BLOCK_SIZE);
     if (io_buf == NULL) {
         printk("file_write: sys_malloc for io_buf failed\n");
         return -1;
     }
-    // 用来记录文件所有的块地址
-    uint32_t* all_blocks = (uint32_t*)sys_malloc(BLOCK_SIZE + 48);
-    if (all_blocks == NULL) {
-        printk("file_write: sys_malloc for all_blocks failed\n");
+    // 写入 count 个字节后该文件将占用的块数, 块不够时先分配好
+    uint32_t block_end = DIV_ROUND_UP(inode->i_size + count, BLOCK_SIZE);
+    if (!extent_grow(cur_part, inode, block_end)) {
+        printk("file_write: extent_grow failed\n");
+        // 已分配的块记录在 inode 中, 要同步到硬盘
+        inode_mark_dirty(inode);
+        sys_free(io_buf);
         return -1;
     }
+
     // 用 src 指向 buf 中待写入的数据
     const uint8_t* src = buf;
     // 用来记录已写入数据大小
     uint32_t bytes_written = 0;
-    // 用来记录未写入数据大小
-    uint32_t size_left = count;
-    // 块地址
-    int32_t block_lba = -1;
-    // 用来记录 block 对应于 block_bitmap 中的索引, 做为参数传给 bitmap_sync
-    uint32_t block_bitmap_idx = 0;
-    // 用来索引扇区
-    uint32_t sec_idx;
-    // 扇区地址
-    uint32_t sec_lba;
-    // 扇区内字节偏移量
-    uint32_t sec_off_bytes;
-    // 扇区内剩余字节量
-    uint32_t sec_left_bytes;
-    // 每次写入硬盘的数据块大小
-    uint32_t chunk_size;
-    // 用来获取一级间接表地址
-    int32_t indirect_block_table;
-    // 块索引
-    uint32_t block_idx;
-
-    // 判断文件是否是第一次写, 如果是, 先为其分配一个块
-    if (file->fd_inode->i_sectors[0] == 0) {
-        block_lba = block_bitmap_alloc(cur_part);
-        if (block_lba == -1) {
-        printk("file_write: block_bitmap_alloc failed\n");
-        return -1;
-        }
-        file->fd_inode->i_sectors[0] = block_lba;
-
-        // 每分配一个块就将位图同步到硬盘
-        block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-        ASSERT(block_bitmap_idx != 0);
-        bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-    }
-
-    // 写入 count 个字节前,该文件已经占用的块数
-    uint32_t file_has_used_blocks = file->fd_inode->i_size / BLOCK_SIZE + 1;
-
-    // 存储 count 字节后该文件将占用的块数
-    uint32_t file_will_use_blocks = (file->fd_inode->i_size + count) / BLOCK_SIZE + 1;
-    ASSERT(file_will_use_blocks <= 140);
-
-    // 通过此增量判断是否需要分配扇区,如增量为0,表示原扇区够用 */
-    uint32_t add_blocks = file_will_use_blocks - file_has_used_blocks;
-
-    // 开始将文件所有块地址收集到 all_blocks,(系统中块大小等于扇区大小)
-    // 后面都统一在 all_blocks 中获取写入扇区地址
-    if (add_blocks == 0) {
-        // 在同一扇区内写入数据,不涉及到分配新扇区
-        // 文件数据量将在 12 块之内
-        if (file_has_used_blocks <= 12) {
-            // 指向最后一个已有数据的扇区
-            block_idx = file_has_used_blocks - 1;
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-        } else {
-            // 未写入新数据之前已经占用了间接块,需要将间接块地址读进来
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
-    } else {
-        // 若有增量,便涉及到分配新扇区及是否分配一级间接块表,下面要分三种情况处理
-        // 第一种情况: 12个直接块够用
-        if (file_will_use_blocks <= 12) {
-            // 先将有剩余空间的可继续用的扇区地址写入 all_blocks
-            block_idx = file_has_used_blocks - 1;
-            ASSERT(file->fd_inode->i_sectors[block_idx] != 0);
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-
-            // 再将未来要用的扇区分配好后写入 all_blocks
-            // 指向第一个要分配的新扇区
-            block_idx = file_has_used_blocks;
-            while (block_idx < file_will_use_blocks) {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1) {
-                    printk("file_write: block_bitmap_alloc for situation 1 failed\n");
-                    return -1;
-                }
-
-                // 写文件时, 不应该存在块未使用但已经分配扇区的情况, 当文件删除时, 就会把块地址清 0
-                ASSERT(file->fd_inode->i_sectors[block_idx] == 0);  // 确保尚未分配扇区地址
-                file->fd_inode->i_sectors[block_idx] = all_blocks[block_idx] = block_lba;
-
-                // 每分配一个块就将位图同步到硬盘
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-                block_idx++;   // 下一个分配的新扇区
-            }
-        } else if (file_has_used_blocks <= 12 && file_will_use_blocks > 12) {
-            // 第二种情况: 旧数据在 12 个直接块内,新数据将使用间接块
-            // 先将有剩余空间的可继续用的扇区地址收集到 all_blocks
-            block_idx = file_has_used_blocks - 1;  // 指向旧数据所在的最后一个扇区
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-
-            // 创建一级间接块表
-            block_lba = block_bitmap_alloc(cur_part);
-            if (block_lba == -1) {
-                printk("file_write: block_bitmap_alloc for situation 2 failed\n");
-                return -1;
-            }
-            ASSERT(file->fd_inode->i_sectors[12] == 0);  // 确保一级间接块表未分配
-            // 分配一级间接块索引表
-            indirect_block_table = file->fd_inode->i_sectors[12] = block_lba;
-            // 第一个未使用的块,即本文件最后一个已经使用的直接块的下一块
-            block_idx = file_has_used_blocks;
-            while (block_idx < file_will_use_blocks) {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1) {
-                    printk("file_write: block_bitmap_alloc for situation 2 failed\n");
-                    return -1;
-                }
-                // 新创建的 0~11 块直接存入 all_blocks 数组
-                if (block_idx < 12) {
-                    // 确保尚未分配扇区地址
-                    ASSERT(file->fd_inode->i_sectors[block_idx] == 0);
-                    file->fd_inode->i_sectors[block_idx] = all_blocks[block_idx] = block_lba;
-                } else {  // 间接块只写入到 all_block 数组中, 待全部分配完成后一次性同步到硬盘
-                    all_blocks[block_idx] = block_lba;
-                }
-                // 每分配一个块就将位图同步到硬盘
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-                // 下一个新扇区
-                block_idx++;
-            }
-            // 同步一级间接块表到硬盘
-            ide_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        } else if (file_has_used_blocks > 12) {
-            // 第三种情况: 新数据占据间接块
-            ASSERT(file->fd_inode->i_sectors[12] != 0);  // 已经具备了一级间接块表
-            indirect_block_table = file->fd_inode->i_sectors[12];  // 获取一级间接表地址
-            // 已使用的间接块也将被读入 all_blocks, 无须单独收录
-            // 获取所有间接块地址
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-            // 第一个未使用的间接块, 即已经使用的间接块的下一块
-            block_idx = file_has_used_blocks;
-            while (block_idx < file_will_use_blocks) {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1) {
-                    printk("file_write: block_bitmap_alloc for situation 3 failed\n");
-                    return -1;
+    // 硬盘上连续的扇区段
+    struct extent runs[FILE_MAP_RUNS];
+    uint32_t run_cnt, run_idx, sec_idx, sec_lba, sec_off_bytes, chunk_size;
+    // 置 fd_pos 为文件大小 -1, 下面在写数据时随时更新
+    file->fd_pos = inode->i_size - 1;
+    while (bytes_written < count) {
+        // 把剩下要写的块映射为若干段连续的扇区, 段数较多时分几次映射
+        uint32_t block_idx = inode->i_size / BLOCK_SIZE;
+        run_cnt = extent_map(cur_part, inode, block_idx, block_end - block_idx, runs, FILE_MAP_RUNS);
+        ASSERT(run_cnt != 0);
+        for (run_idx = 0; run_idx < run_cnt && bytes_written < count; run_idx++) {
+            sec_idx = 0;
+            while (sec_idx < runs[run_idx].len && bytes_written < count) {
+                sec_lba = runs[run_idx].start + sec_idx;
+                sec_off_bytes = inode->i_size % BLOCK_SIZE;
+                chunk_size = BLOCK_SIZE - sec_off_bytes;
+                if (sec_off_bytes == 0 && count - bytes_written >= BLOCK_SIZE) {
+                    // 段内连续的整扇区直接从 buf 一次写入硬盘
+                    uint32_t sec_cnt = (count - bytes_written) / BLOCK_SIZE;
+                    if (sec_cnt > runs[run_idx].len - sec_idx) {
+                        sec_cnt = runs[run_idx].len - sec_idx;
+                    }
+                    file_write_sectors(sec_lba, src, sec_cnt);
+                    chunk_size = sec_cnt * BLOCK_SIZE;
+                    sec_idx += sec_cnt;
+                } else {
+                    if (chunk_size > count - bytes_written) {
+                        chunk_size = count - bytes_written;
+                    }
+                    // 只有文件原来的最后一块中有旧数据, 新块的其余部分补 0
+                    if (sec_off_bytes != 0) {
+                        buffer_read(cur_part->my_disk, sec_lba, io_buf, 1);
+                    } else {
+                        memset(io_buf, 0, BLOCK_SIZE);
+                    }
+                    memcpy(io_buf + sec_off_bytes, src, chunk_size);
+                    buffer_write(cur_part->my_disk, sec_lba, io_buf, 1);
+                    sec_idx++;
                 }
-                all_blocks[block_idx++] = block_lba;
-                // 每分配一个块就将位图同步到硬盘
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
+                src += chunk_size;   // 将指针推移到下个新数据
+                inode->i_size += chunk_size;  // 更新文件大小
+                file->fd_pos += chunk_size;
+                bytes_written += chunk_size;
             }
-            // 同步一级间接块表到硬盘
-            ide_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
         }
     }
-    // 含有剩余空间的扇区标识
-    bool first_write_block = true;
-    // 块地址已经收集到 all_blocks 中,下面开始写数据
-    // 置 fd_pos 为文件大小 -1, 下面在写数据时随时更新
-    file->fd_pos = file->fd_inode->i_size - 1;
-    while (bytes_written < count) {
-        // 直到写完所有数据
-        memset(io_buf, 0, BLOCK_SIZE);
-        sec_idx = file->fd_inode->i_size / BLOCK_SIZE;
-        sec_lba = all_blocks[sec_idx];
-        sec_off_bytes = file->fd_inode->i_size % BLOCK_SIZE;
-        sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
-        // 判断此次写入硬盘的数据大小
-        chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
-        if (first_write_block) {
-            ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-            first_write_block = false;
-        }
-        memcpy(io_buf + sec_off_bytes, src, chunk_size);
-        ide_write(cur_part->my_disk, sec_lba, io_buf, 1);
-        printk("file write at lba 0x%x\n", sec_lba);  // 调试,完成后去掉
-
-        src += chunk_size;   // 将指针推移到下个新数据
-        file->fd_inode->i_size += chunk_size;  // 更新文件大小
-        file->fd_pos += chunk_size;
-        bytes_written += chunk_size;
-        size_left -= chunk_size;
-    }
-    inode_sync(cur_part, file->fd_inode, io_buf);
-    sys_free(all_blocks);
+    inode_mark_dirty(inode);
     sys_free(io_buf);
     return bytes_written;
 }
 
+/**
+ * @brief 初始化预读状态，从文件开头读起视为顺序读
+ *
+ * @param ra
+ */
+void file_ra_init(struct file_ra* ra) {
+    ra->ra_pos = 0;
+    ra->ra_win = 0;
+    ra->ra_end = 0;
+}
+
+/**
+ * @brief 读完 file 中从 start_pos 到 fd_pos 的数据后更新预读状态
+ *        顺序读时扩大窗口，已预读的部分不足半个窗口时把其后的块异步读入缓存
+ *
+ * @param file
+ * @param start_pos 本次读取开始时的 fd_pos
+ */
+static void file_readahead(struct file* file, uint32_t start_pos) {
+    struct file_ra* ra = &file->fd_ra;
+    bool sequential = start_pos == ra->ra_pos;
+    ra->ra_pos = file->fd_pos;
+    if (!sequential) {
+        ra->ra_win = 0;
+        ra->ra_end = 0;
+        return;
+    }
+    if (ra->ra_win == 0) {
+        ra->ra_win = FILE_RA_MIN;
+    } else if (ra->ra_win < FILE_RA_MAX) {
+        ra->ra_win = ra->ra_win * 2 < FILE_RA_MAX ? ra->ra_win * 2 : FILE_RA_MAX;
+    }
+    // 下次读取要用到的第一个未缓存的块, 读了一部分的块已在缓存中
+    uint32_t block_next = DIV_ROUND_UP(file->fd_pos, BLOCK_SIZE);
+    if (ra->ra_end > block_next + ra->ra_win / 2) {
+        return;
+    }
+    uint32_t block_idx = ra->ra_end > block_next ? ra->ra_end : block_next;
+    uint32_t block_end = block_next + ra->ra_win;
+    uint32_t file_blocks = DIV_ROUND_UP(file->fd_inode->i_size, BLOCK_SIZE);
+    if (block_end > file_blocks) {
+        block_end = file_blocks;
+    }
+    if (block_idx >= block_end) {
+        return;
+    }
+    struct extent runs[FILE_MAP_RUNS];
+    uint32_t run_cnt = extent_map(cur_part, file->fd_inode, block_idx, block_end - block_idx, runs, FILE_MAP_RUNS);
+    uint32_t run_idx;
+    for (run_idx = 0; run_idx < run_cnt; run_idx++) {
+        uint32_t queued = buffer_readahead(cur_part->my_disk, runs[run_idx].start, runs[run_idx].len);
+        block_idx += queued;
+        // 队列满了, 没放进去的块留到下次读取时再预读
+        if (queued < runs[run_idx].len) {
+            break;
+        }
+    }
+    ra->ra_end = block_idx;
+}
+
 /**
  * @brief 文件读取
  *        从文件 file 中读取 count 个字节写入 buf
@@ -502,99 +573,62 @@ int32_t file_write(struct file* file, const void* buf, uint32_t count) {
  */
 int32_t file_read(struct file* file, void* buf, uint32_t count) {
     uint8_t* buf_dst = (uint8_t*)buf;
-    uint32_t size = count, size_left = size;
+    uint32_t size = count;
 
     // 若要读取的字节数超过了文件可读的剩余量, 就用剩余量做为待读取的字节数
     if ((file->fd_pos + count) > file->fd_inode->i_size) {
         size = file->fd_inode->i_size - file->fd_pos;
-        size_left = size;
         if (size == 0) {  // 若到文件尾则返回 -1
         return -1;
         }
     }
 
-    uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
+    uint8_t* io_buf = sys_malloc_nozero(BLOCK_SIZE);
     if (io_buf == NULL) {
         printk("file_read: sys_malloc for io_buf failed\n");
-    }
-    // 用来记录文件所有的块地址
-    uint32_t* all_blocks = (uint32_t*)sys_malloc(BLOCK_SIZE + 48);
-    if (all_blocks == NULL) {
-        printk("file_read: sys_malloc for all_blocks failed\n");
         return -1;
     }
-    // 数据所在块的起始地址
-    uint32_t block_read_start_idx = file->fd_pos / BLOCK_SIZE;
-    // 数据所在块的终止地址
-    uint32_t block_read_end_idx = (file->fd_pos + size) / BLOCK_SIZE;
-    // 如增量为 0, 表示数据在同一扇区
-    uint32_t read_blocks = block_read_start_idx - block_read_end_idx;
-    ASSERT(block_read_start_idx < 139 && block_read_end_idx < 139);
-    // 用来获取一级间接表地址
-    int32_t indirect_block_table;
-    // 获取待读的块地址
-    uint32_t block_idx;
-
-    // 以下开始构建 all_blocks 块地址数组, 专门存储用到的块地址(本程序中块大小同扇区大小)
-    // 在同一扇区内读数据,不涉及到跨扇区读取
-    if (read_blocks == 0) {
-        ASSERT(block_read_end_idx == block_read_start_idx);
-        // 待读的数据在 12 个直接块之内
-        if (block_read_end_idx < 12) {
-            block_idx = block_read_end_idx;
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-        } else {  // 若用到了一级间接块表,需要将表中间接块读进来
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
-    } else {  // 若要读多个块
-        // 第一种情况: 起始块和终止块属于直接块
-        if (block_read_end_idx < 12) {  // 数据结束所在的块属于直接块
-            for (block_idx = block_read_start_idx; block_idx <= block_read_end_idx; block_idx++) {
-                all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-            }
-        } else if (block_read_start_idx < 12 && block_read_end_idx >= 12) {
-            // 第二种情况: 待读入的数据跨越直接块和间接块两类
-            // 先将直接块地址写入 all_blocks
-            for (block_idx = block_read_start_idx; block_idx < 12; block_idx++) {
-                all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
+    uint32_t start_pos = file->fd_pos;
+    // 数据所在块的终止块(不含)
+    uint32_t block_end = DIV_ROUND_UP(file->fd_pos + size, BLOCK_SIZE);
+    // 硬盘上连续的扇区段
+    struct extent runs[FILE_MAP_RUNS];
+    uint32_t run_cnt, run_idx, sec_idx, sec_lba, sec_off_bytes, chunk_size;
+    uint32_t bytes_read = 0;
+    while (bytes_read < size) {  // 直到读完为止
+        uint32_t block_idx = file->fd_pos / BLOCK_SIZE;
+        run_cnt = extent_map(cur_part, file->fd_inode, block_idx, block_end - block_idx, runs, FILE_MAP_RUNS);
+        ASSERT(run_cnt != 0);
+        for (run_idx = 0; run_idx < run_cnt && bytes_read < size; run_idx++) {
+            sec_idx = 0;
+            while (sec_idx < runs[run_idx].len && bytes_read < size) {
+                sec_lba = runs[run_idx].start + sec_idx;
+                sec_off_bytes = file->fd_pos % BLOCK_SIZE;
+                chunk_size = BLOCK_SIZE - sec_off_bytes;  // 待读入的数据大小
+                if (sec_off_bytes == 0 && size - bytes_read >= BLOCK_SIZE) {
+                    // 段内连续的整扇区从硬盘一次读到 buf
+                    uint32_t sec_cnt = (size - bytes_read) / BLOCK_SIZE;
+                    if (sec_cnt > runs[run_idx].len - sec_idx) {
+                        sec_cnt = runs[run_idx].len - sec_idx;
+                    }
+                    file_read_sectors(sec_lba, buf_dst, sec_cnt);
+                    chunk_size = sec_cnt * BLOCK_SIZE;
+                    sec_idx += sec_cnt;
+                } else {
+                    if (chunk_size > size - bytes_read) {
+                        chunk_size = size - bytes_read;
+                    }
+                    buffer_read(cur_part->my_disk, sec_lba, io_buf, 1);
+                    memcpy(buf_dst, io_buf + sec_off_bytes, chunk_size);
+                    sec_idx++;
+                }
+                buf_dst += chunk_size;
+                file->fd_pos += chunk_size;
+                bytes_read += chunk_size;
             }
-            // 确保已经分配了一级间接块表
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-            // 再将间接块地址写入 all_blocks
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            // 将一级间接块表读进来写入到第13个块的位置之后
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        } else {
-            // 第三种情况: 数据在间接块中
-            // 确保已经分配了一级间接块表
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-            // 获取一级间接表地址
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            // 将一级间接块表读进来写入到第 13 个块的位置之后
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
         }
     }
-    // 用到的块地址已经收集到 all_blocks 中, 下面开始读数据
-    uint32_t sec_idx, sec_lba, sec_off_bytes, sec_left_bytes, chunk_size;
-    uint32_t bytes_read = 0;
-    while (bytes_read < size) {  // 直到读完为止
-        sec_idx = file->fd_pos / BLOCK_SIZE;
-        sec_lba = all_blocks[sec_idx];
-        sec_off_bytes = file->fd_pos % BLOCK_SIZE;
-        sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
-        chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;  // 待读入的数据大小
-
-        memset(io_buf, 0, BLOCK_SIZE);
-        ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-        memcpy(buf_dst, io_buf + sec_off_bytes, chunk_size);
-
-        buf_dst += chunk_size;
-        file->fd_pos += chunk_size;
-        bytes_read += chunk_size;
-        size_left -= chunk_size;
-    }
-    sys_free(all_blocks);
+    file_readahead(file, start_pos);
     sys_free(io_buf);
     return bytes_read;
 }
@@ -16,6 +16,7 @@
 #include "device/ide.h"
 #include "fs/dir.h"
 #include "kernel/global.h"
+#include "fs/readahead.h"
 
 /**
  * 每个进程的 PCB 中有文件描述符数组
@@ -42,6 +43,8 @@ struct file {
     uint32_t fd_pos;
     uint32_t fd_flag;
     struct inode* fd_inode;
+    // 顺序预读的状态
+    struct file_ra fd_ra;
 };
 
 /**
@@ -72,15 +75,19 @@ enum bitmap_type {
 #define MAX_FILE_OPEN 32
 
 extern struct file file_table[MAX_FILE_OPEN];
-int32_t inode_bitmap_alloc(struct partition* part);
+int32_t inode_bitmap_alloc(struct partition* part, uint32_t goal_ino);
 int32_t block_bitmap_alloc(struct partition* part);
+int32_t block_bitmap_alloc_near(struct partition* part, uint32_t goal_lba);
+uint32_t inode_block_goal(struct partition* part, uint32_t inode_no);
 int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag);
 void bitmap_sync(struct partition* part, uint32_t bit_idx, uint8_t btmp);
+void bitmap_flush(struct partition* part);
 int32_t get_free_slot_in_global(void);
 int32_t pcb_fd_install(int32_t globa_fd_idx);
 int32_t file_open(uint32_t inode_no, uint8_t flag);
 int32_t file_close(struct file* file);
 int32_t file_write(struct file* file, const void* buf, uint32_t count);
 int32_t file_read(struct file* file, void* buf, uint32_t count);
+void file_ra_init(struct file_ra* ra);
 
 #endif  // FS_FILE_H_
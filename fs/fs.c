@@ -2,6 +2,9 @@
 #include "fs/super_block.h"
 #include "fs/inode.h"
 #include "fs/dir.h"
+#include "fs/buffer.h"
+#include "fs/dcache.h"
+#include "fs/extent.h"
 #include "lib/kernel/stdio_kernel.h"
 #include "lib/kernel/list.h"
 #include "lib/string.h"
@@ -11,10 +14,25 @@
 #include "fs/file.h"
 #include "device/console.h"
 #include "device/keyboard.h"
+#include "kernel/interrupt.h"
 
 // 默认情况下操作的是哪个分区
 struct partition* cur_part;
 
+/**
+ * @brief 超级块是否属于本文件系统以前的格式, 包括 inode 表的格式与 struct disk_inode 不一致的
+ * 
+ * @param sb 
+ * @return true 
+ * @return false 
+ */
+static bool super_block_is_old(const struct super_block* sb) {
+    if (sb->magic == SUPER_BLOCK_MAGIC) {
+        return sb->inode_version != INODE_VERSION || sb->inode_size != DISK_INODE_SIZE;
+    }
+    return sb->magic == SUPER_BLOCK_MAGIC_V0 || sb->magic == SUPER_BLOCK_MAGIC_V1;
+}
+
 /**
  * @brief 在分区链表中找到名为 part_name 的分区, 并将其指针赋值给 cur_part
  * 
@@ -28,20 +46,29 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
     // 将 pelem 还原成分区 part
     struct partition* part = elem2entry(struct partition, part_tag, pelem);
     if (!strncmp(part->name, part_name, strlen(part_name))) {
-        cur_part = part;
-        struct disk* hd = cur_part->my_disk;
+        struct disk* hd = part->my_disk;
 
         /*************************** 读取分区的超级块，写入内存中 ********************************/
         // sb_buf 用来存储从硬盘上读入的超级块
-        struct super_block* sb_buf = (struct super_block*)sys_malloc(SECTOR_SIZE);
+        struct super_block* sb_buf = (struct super_block*)sys_malloc_nozero(SECTOR_SIZE);
+        if (sb_buf == NULL) {
+            PANIC("alloc memory failed!");
+        }
+        // 读入超级块
+        memset(sb_buf, 0, SECTOR_SIZE);
+        buffer_read(hd, part->start_lba + 1, sb_buf, 1);
+        // 旧格式的分区没有被格式化, 也不能按现在的格式访问, 不挂载
+        if (super_block_is_old(sb_buf)) {
+            printk("mount %s failed: old filesystem format\n", part->name);
+            sys_free(sb_buf);
+            return true;
+        }
+        cur_part = part;
         // 在内存中创建分区 cur_part 的超级块
         cur_part->sb = (struct super_block*)sys_malloc(sizeof(struct super_block));
         if (cur_part->sb == NULL) {
             PANIC("alloc memory failed!");
         }
-        // 读入超级块
-        memset(sb_buf, 0, SECTOR_SIZE);
-        ide_read(hd, cur_part->start_lba + 1, sb_buf, 1);
         // 把 sb_buf 中超级块的信息复制到分区的超级块 sb 中
         memcpy(cur_part->sb, sb_buf, sizeof(struct super_block));
 
@@ -52,7 +79,13 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
         }
         cur_part->block_bitmap.bmap_bytes_len = sb_buf->block_bitmap_sects * SECTOR_SIZE;
         // 从硬盘上读入块位图到分区的 block_bitmap.bits
-        ide_read(hd, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits, sb_buf->block_bitmap_sects);
+        buffer_read(hd, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits, sb_buf->block_bitmap_sects);
+        // 根据读入的块位图建立摘要位图，分配时可以跳过已满的区域
+        uint32_t* summary = (uint32_t*)sys_malloc(BITMAP_SUMMARY_BYTES(cur_part->block_bitmap.bmap_bytes_len));
+        if (summary == NULL) {
+            PANIC("alloc memory failed!");
+        }
+        bitmap_summary_attach(&cur_part->block_bitmap, summary);
 
         /************************** 读取分区上的 inode 位图，写入到内存 **********************************/
         cur_part->inode_bitmap.bits = (uint8_t*)sys_malloc(sb_buf->inode_bitmap_sects * SECTOR_SIZE);
@@ -61,10 +94,22 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
         }
         cur_part->inode_bitmap.bmap_bytes_len = sb_buf->inode_bitmap_sects * SECTOR_SIZE;
         // 从硬盘上读入 inode 位图到分区的 inode_bitmap.bits
-        ide_read(hd, sb_buf->inode_bitmap_lba, cur_part->inode_bitmap.bits, sb_buf->inode_bitmap_sects);
+        buffer_read(hd, sb_buf->inode_bitmap_lba, cur_part->inode_bitmap.bits, sb_buf->inode_bitmap_sects);
+        summary = (uint32_t*)sys_malloc(BITMAP_SUMMARY_BYTES(cur_part->inode_bitmap.bmap_bytes_len));
+        if (summary == NULL) {
+            PANIC("alloc memory failed!");
+        }
+        bitmap_summary_attach(&cur_part->inode_bitmap, summary);
+
+        cur_part->bitmap_dirty = (uint8_t*)sys_malloc(sb_buf->block_bitmap_sects + sb_buf->inode_bitmap_sects);
+        if (cur_part->bitmap_dirty == NULL) {
+            PANIC("alloc memory failed!");
+        }
+        cur_part->block_reserved = (uint8_t*)sys_malloc(sb_buf->block_bitmap_sects * SECTOR_SIZE);
+        if (cur_part->block_reserved == NULL) {
+            PANIC("alloc memory failed!");
+        }
 
-        // 初始化分区的 open_inodes 列表
-        list_init(&cur_part->open_inodes);
         printk("mount %s done!\n", part->name);
 
         // 此处返回 true 是为了迎合主调函数 list_traversal 的实现, 与函数本身功能无关
@@ -100,7 +145,8 @@ static void partition_format(struct partition* part) {
     // BITS_PER_SECTOR 表示每个分区的位数
     uint32_t inode_bitmap_sects = DIV_ROUND_UP(MAX_FILES_PER_PART, BITS_PER_SECTOR);
     // inode 数组占用的扇区数，这是由 inode 的大小和数量决定的
-    uint32_t inode_table_sects = DIV_ROUND_UP(((sizeof(struct inode) * MAX_FILES_PER_PART)), SECTOR_SIZE);
+    // 硬盘上的 inode 是 struct disk_inode, 一个扇区正好存放整数个
+    uint32_t inode_table_sects = DIV_ROUND_UP(((DISK_INODE_SIZE * MAX_FILES_PER_PART)), SECTOR_SIZE);
     // 已使用的块数
     uint32_t used_sects = boot_sector_sects + super_block_sects + inode_bitmap_sects + inode_table_sects;
     // 空闲块的数量
@@ -117,6 +163,8 @@ static void partition_format(struct partition* part) {
     /*************************************** 创建超级块并写入扇区 *****************************************/
     // 超级块初始化
     struct super_block sb;
+    // pad 及以后新增的字段都从 0 开始
+    memset(&sb, 0, sizeof(struct super_block));
     sb.magic = SUPER_BLOCK_MAGIC;
     sb.sec_cnt = part->sec_cnt;
     sb.inode_cnt = MAX_FILES_PER_PART;
@@ -136,6 +184,8 @@ static void partition_format(struct partition* part) {
     // 根目录的 inode 编号为 0
     sb.root_inode_no = 0;
     sb.dir_entry_size = sizeof(struct dir_entry);
+    sb.inode_version = INODE_VERSION;
+    sb.inode_size = DISK_INODE_SIZE;
 
     printk("%s info:\n", part->name);
     printk("magic:0x%x\n part_lba_base:0x%x\n all_sectors:0x%x\n inode_cnt:0x%x\n   \
@@ -148,7 +198,7 @@ static void partition_format(struct partition* part) {
 
     struct disk* hd = part->my_disk;
     // 将超级块写入本分区的 1 扇区
-    ide_write(hd, part->start_lba + 1, &sb, 1);
+    buffer_write(hd, part->start_lba + 1, &sb, 1);
     printk("super_block_lba:0x%x\n", part->start_lba + 1);
     // 超级块本身只有 1 扇区大小，所以使用栈内存还可以，但是像空闲块位图、inode 数组位图等占用的扇区数较大(几百扇区)
     // 所以不便用栈内存的局部变量来保存他们，应该从堆中申请内存获取缓冲区
@@ -184,7 +234,7 @@ static void partition_format(struct partition* part) {
     while (bit_idx <= block_bitmap_last_bit) {
         buf[block_bitmap_last_byte] &= ~(1 << bit_idx++);
     }
-    ide_write(hd, sb.block_bitmap_lba, buf, sb.block_bitmap_sects);
+    buffer_write(hd, sb.block_bitmap_lba, buf, sb.block_bitmap_sects);
 
     /************************** 创建 inode 位图，并写入磁盘 **********************************/
     // 将 inode 位图初始化并写入 sb.inode_bitmap_lba
@@ -196,20 +246,19 @@ static void partition_format(struct partition* part) {
     // 即 inode_bitmap_sects 等于 1, 所以位图中的位全都代表 inode_table 中的 inode,
     // 无须再像 block_bitmap 那样单独处理最后一扇区的剩余部分,
     // inode_bitmap 所在的扇区中没有多余的无效位
-    ide_write(hd, sb.inode_bitmap_lba, buf, sb.inode_bitmap_sects);
+    buffer_write(hd, sb.inode_bitmap_lba, buf, sb.inode_bitmap_sects);
 
     /************************** 创建 inode 数组位图，并写入磁盘 **********************************/
     // 将 inode 数组初始化并写入 sb.inode_table_lba
     // 准备写 inode_table 中的第 0 项,即根目录所在的 inode
     memset(buf, 0, buf_size);  // 先清空缓冲区buf
-    struct inode* i = (struct inode*)buf;
+    // 根目录占 inode 数组中第 0 个 inode
+    struct disk_inode* i = (struct disk_inode*)buf;
     // .和.. 目录
     i->i_size = sb.dir_entry_size * 2;
-    // 根目录占 inode 数组中第 0 个 inode
-    i->i_no = 0;
     // 由于上面的 memset, i_sectors 数组的其它元素都初始化为 0
     i->i_sectors[0] = sb.data_start_lba;
-    ide_write(hd, sb.inode_table_lba, buf, sb.inode_table_sects);
+    buffer_write(hd, sb.inode_table_lba, buf, sb.inode_table_sects);
 
     /************************** 初始化 inode 数组，并写入磁盘 **********************************/
     /* 虽然 inode 数组最终在磁盘上占据的全部扇区中，并不是所有空间都是 inode 数组的内容
@@ -231,7 +280,7 @@ static void partition_format(struct partition* part) {
     p_de->i_no = 0;
     p_de->f_type = FT_DIRECTORY;
     // sb.data_start_lba 已经分配给了根目录, 里面是根目录的目录项
-    ide_write(hd, sb.data_start_lba, buf, 1);
+    buffer_write(hd, sb.data_start_lba, buf, 1);
 
     printk("root_dir_lba:0x%x\n", sb.data_start_lba);
     printk("%s format done\n", part->name);
@@ -289,6 +338,19 @@ int32_t path_depth_cnt(char* pathname) {
     return depth;
 }
 
+/**
+ * @brief 打开 search_file 要返回的父目录, 根目录总是打开着的
+ *
+ * @param inode_no
+ * @return struct dir*
+ */
+static struct dir* search_dir_open(uint32_t inode_no) {
+    if (inode_no == root_dir.inode->i_no) {
+        return &root_dir;
+    }
+    return dir_open(cur_part, inode_no);
+}
+
 /**
  * @brief 搜索文件 pathname, 若找到则返回其 inode 号, 否则返回 -1 
  * 
@@ -310,17 +372,19 @@ static int search_file(const char* pathname, struct path_search_record* searched
     // 保证 pathname 至少是这样的路径/x且小于最大长度
     ASSERT(pathname[0] == '/' && path_len > 1 && path_len < MAX_PATH_LEN);
     char* sub_path = (char*)pathname;
-    struct dir* parent_dir = &root_dir;
     struct dir_entry dir_e;
 
     // 记录路径解析出来的各级名称, 如路径 "/a/b/c",
     // 数组 name 每次的值分别是 "a","b","c" */
     char name[MAX_FILE_NAME_LEN] = {0};
 
-    searched_record->parent_dir = parent_dir;
+    searched_record->parent_dir = NULL;
     searched_record->file_type = FT_UNKNOWN;
+    // 中间各级目录只按 inode 编号逐级查找, 目录项缓存命中时不必打开目录,
+    // 查找结束时才打开要返回的父目录
+    uint32_t dir_inode_no = root_dir.inode->i_no;
     // 父目录的inode号
-    uint32_t parent_inode_no = 0;
+    uint32_t parent_inode_no = dir_inode_no;
 
     sub_path = path_parse(sub_path, name);
     // 若第一个字符就是结束符,结束循环
@@ -333,7 +397,7 @@ static int search_file(const char* pathname, struct path_search_record* searched
         strcat(searched_record->searched_path, name);
 
         // 在所给的目录中查找文件
-        if (search_dir_entry(cur_part, parent_dir, name, &dir_e)) {
+        if (dir_lookup(cur_part, dir_inode_no, name, &dir_e)) {
             memset(name, 0, MAX_FILE_NAME_LEN);
             // 若 sub_path 不等于 NULL, 也就是未结束时继续拆分路径
             if (sub_path) {
@@ -341,27 +405,26 @@ static int search_file(const char* pathname, struct path_search_record* searched
             }
             // 如果被打开的是目录
             if (FT_DIRECTORY == dir_e.f_type) {
-                parent_inode_no = parent_dir->inode->i_no;
-                dir_close(parent_dir);
+                parent_inode_no = dir_inode_no;
                 // 更新父目录
-                parent_dir = dir_open(cur_part, dir_e.i_no);
-                searched_record->parent_dir = parent_dir;
+                dir_inode_no = dir_e.i_no;
                 continue;
             } else if (FT_REGULAR == dir_e.f_type) {  // 若是普通文件
+                searched_record->parent_dir = search_dir_open(dir_inode_no);
                 searched_record->file_type = FT_REGULAR;
                 return dir_e.i_no;
             }
         } else {  //若找不到, 则返回 -1
-            // 找不到目录项时,要留着 parent_dir 不要关闭,
+            // 找不到目录项时,要返回打开的 parent_dir,
             // 若是创建新文件的话需要在 parent_dir 中创建
+            searched_record->parent_dir = search_dir_open(dir_inode_no);
             return -1;
         }
     }
 
     // 执行到此,必然是遍历了完整路径并且查找的文件或目录只有同名目录存在
-    dir_close(searched_record->parent_dir);
     // 保存被查找目录的直接父目录
-    searched_record->parent_dir = dir_open(cur_part, parent_inode_no);
+    searched_record->parent_dir = search_dir_open(parent_inode_no);
     searched_record->file_type = FT_DIRECTORY;
     return dir_e.i_no;
 }
@@ -425,6 +488,7 @@ int32_t sys_open(const char* pathname, uint8_t flags) {
         printk("creating file\n");
         fd = file_create(searched_record.parent_dir, (strrchr(pathname, '/') + 1), flags);
         dir_close(searched_record.parent_dir);
+        fs_commit(cur_part);
         break;
     default:  // 其余为打开文件，包括：O_RDONLY、O_WRONLY、O_RDWR
         fd = file_open(inode_no, flags);
@@ -461,10 +525,108 @@ int32_t sys_close(int32_t fd) {
         res = file_close(&file_table[g_fd]);
         // 使该文件描述符可用
         running_thread()->fd_table[fd] = -1;
+        fs_commit(cur_part);
     }
     return res;
 }
 
+/**
+ * @brief 一次文件系统操作结束时, 把其间修改过的位图扇区和 inode 写入缓存
+ *        每个扇区、每个 inode 只写一次, 再由写回线程或 sync 写回硬盘
+ *
+ * @param part
+ */
+void fs_commit(struct partition* part) {
+    bitmap_flush(part);
+    inode_sync_dirty(part);
+}
+
+/**
+ * @brief 把缓存中的全部脏数据写回硬盘
+ *
+ */
+void sys_sync(void) {
+    fs_commit(cur_part);
+    buffer_sync(NULL);
+}
+
+/**
+ * @brief 把文件描述符 fd 指向的文件的数据和 inode, 以及分区的位图写回硬盘
+ *        成功返回 0，否则返回 -1
+ * @param fd
+ * @return int32_t
+ */
+int32_t sys_fsync(int32_t fd) {
+    if (fd <= stderr_no || fd >= MAX_FILES_OPEN_PER_PROC || running_thread()->fd_table[fd] == -1) {
+        printk("sys_fsync: fd error\n");
+        return -1;
+    }
+    uint32_t g_fd = fd_local_to_global(fd);
+    struct file* file = &file_table[g_fd];
+    fs_commit(cur_part);
+    inode_flush(cur_part, file->fd_inode);
+    // 新分配的块和 inode 在位图中的记录也要落盘, 否则重启后会被再次分配
+    struct super_block* sb = cur_part->sb;
+    buffer_sync_range(cur_part->my_disk, sb->block_bitmap_lba, sb->block_bitmap_sects);
+    buffer_sync_range(cur_part->my_disk, sb->inode_bitmap_lba, sb->inode_bitmap_sects);
+    return 0;
+}
+
+/**
+ * @brief 打印当前分区空闲空间的碎片情况, path 不为 NULL 时再打印该普通文件的区段数
+ *
+ * @param path
+ */
+void sys_frag(const char* path) {
+    // 空闲块被已占用的块分成了多少段, 段越少越不容易产生碎片
+    struct bitmap* bm = &cur_part->block_bitmap;
+    uint32_t bits_len = bm->bmap_bytes_len * 8;
+    uint32_t free_cnt = 0, run_cnt = 0, run_len = 0, max_run = 0;
+    uint32_t bit_idx;
+    for (bit_idx = 0; bit_idx < bits_len; bit_idx++) {
+        if (bitmap_scan_test(bm, bit_idx)) {
+            run_len = 0;
+            continue;
+        }
+        free_cnt++;
+        if (run_len++ == 0) {
+            run_cnt++;
+        }
+        if (run_len > max_run) {
+            max_run = run_len;
+        }
+    }
+    printk("%s: %d/%d blocks free in %d runs, largest run %d blocks\n",
+           cur_part->name, free_cnt, bits_len, run_cnt, max_run);
+    if (path == NULL) {
+        return;
+    }
+
+    struct path_search_record searched_record;
+    memset(&searched_record, 0, sizeof(struct path_search_record));
+    int inode_no = search_file(path, &searched_record);
+    if (inode_no == -1 || searched_record.file_type != FT_REGULAR) {
+        printk("frag: %s is not a regular file\n", path);
+    } else {
+        struct extent* runs = sys_malloc_nozero(EXTENT_MAX * sizeof(struct extent));
+        if (runs == NULL) {
+            printk("sys_frag: sys_malloc for runs failed\n");
+        } else {
+            struct inode* inode = inode_open(cur_part, inode_no);
+            // 映射全部块得到的就是全部区段, 完全连续的文件只有 1 个区段
+            uint32_t ext_cnt = extent_map(cur_part, inode, 0, (uint32_t)-1, runs, EXTENT_MAX);
+            uint32_t block_cnt = 0, idx;
+            for (idx = 0; idx < ext_cnt; idx++) {
+                block_cnt += runs[idx].len;
+            }
+            printk("%s: %d bytes, %d blocks in %d extents\n", path, inode->i_size, block_cnt, ext_cnt);
+            inode_close(inode);
+            sys_free(runs);
+        }
+    }
+    dir_close(searched_record.parent_dir);
+}
+
 /**
  * @brief 读取 buf 中 count 字节数据写入文件描述符 fd 中
  *        成功返回写入的字节数，失败返回 -1
@@ -488,6 +650,7 @@ int32_t sys_write(int32_t fd, const void* buf, uint32_t count) {
     struct file* wr_file = &file_table[_fd];
     if (wr_file->fd_flag & O_WRONLY || wr_file->fd_flag & O_RDWR) {
         uint32_t bytes_written = file_write(wr_file, buf, count);
+        fs_commit(cur_part);
         return bytes_written;
     } else {
         console_put_str("sys_write: not allowed to write file without flag O_RDWR or O_WRONLY\n");
@@ -561,6 +724,19 @@ int32_t sys_lseek(int32_t fd, int32_t offset, uint8_t whence) {
     return pf->fd_pos;
 }
 
+/**
+ * @brief 用于在 list_traversal 函数中的回调函数, 判断任务的可执行文件是否为 inode_no
+ * 
+ * @param pelem 
+ * @param inode_no 
+ * @return true 
+ * @return false 
+ */
+static bool exec_inode_match(struct list_elem* pelem, int inode_no) {
+    struct task_struct* pthread = elem2entry(struct task_struct, all_list_tag, pelem);
+    return pthread->exec_inode != NULL && pthread->exec_inode->i_no == (uint32_t)inode_no;
+}
+
 /**
  * @brief 删除文件（非目录）
  *        成功返回 0，失败返回 -1
@@ -599,6 +775,15 @@ int32_t sys_unlink(const char* pathname) {
         return -1;
     }
     ASSERT(file_idx == MAX_FILE_OPEN);
+    // 正在运行的程序的可执行文件也不能删除, 缺页时还要从中读取
+    enum intr_status old_status = intr_disable();
+    struct list_elem* exec_elem = list_traversal(&thread_all_list, exec_inode_match, inode_no);
+    intr_set_status(old_status);
+    if (exec_elem != NULL) {
+        dir_close(searched_record.parent_dir);
+        printk("file %s is being executed, not allow to delete!\n", pathname);
+        return -1;
+    }
 
     // 为 delete_dir_entry 申请缓冲区
     void* io_buf = sys_malloc(SECTOR_SIZE + SECTOR_SIZE);
@@ -609,10 +794,11 @@ int32_t sys_unlink(const char* pathname) {
     }
 
     struct dir* parent_dir = searched_record.parent_dir;
-    delete_dir_entry(cur_part, parent_dir, inode_no, io_buf);
+    delete_dir_entry(cur_part, parent_dir, inode_no, strrchr(searched_record.searched_path, '/') + 1, io_buf);
     inode_release(cur_part, inode_no);
     sys_free(io_buf);
     dir_close(searched_record.parent_dir);
+    fs_commit(cur_part);
     // 成功删除文件
     return 0;
 }
@@ -652,7 +838,7 @@ int32_t sys_mkdir(const char* pathname) {
     struct dir* parent_dir = searched_record.parent_dir;
     // 目录名称后可能会有字符 '/', 所以最好直接用 searched_record.searched_path, 无 '/'
     char* dirname = strrchr(searched_record.searched_path, '/') + 1;
-    inode_no = inode_bitmap_alloc(cur_part);
+    inode_no = inode_bitmap_alloc(cur_part, parent_dir->inode->i_no);
     if (inode_no == -1) {
         printk("sys_mkdir: allocate inode failed\n");
         rollback_step = 1;
@@ -665,7 +851,7 @@ int32_t sys_mkdir(const char* pathname) {
     uint32_t block_bitmap_idx = 0;
     int32_t block_lba = -1;
     // 为目录分配一个块, 用来写入目录 . 和 ..
-    block_lba = block_bitmap_alloc(cur_part);
+    block_lba = block_bitmap_alloc_near(cur_part, inode_block_goal(cur_part, inode_no));
     if (block_lba == -1) {
         printk("sys_mkdir: block_bitmap_alloc for create directory failed\n");
         rollback_step = 2;
@@ -690,7 +876,7 @@ int32_t sys_mkdir(const char* pathname) {
     memcpy(p_de->filename, "..", 2);
     p_de->i_no = parent_dir->inode->i_no;
     p_de->f_type = FT_DIRECTORY;
-    ide_write(cur_part->my_disk, new_dir_inode.i_sectors[0], io_buf, 1);
+    buffer_write(cur_part->my_disk, new_dir_inode.i_sectors[0], io_buf, 1);
     new_dir_inode.i_size = 2 * cur_part->sb->dir_entry_size;
     // 在父目录中添加自己的目录项
     struct dir_entry new_dir_entry;
@@ -704,17 +890,16 @@ int32_t sys_mkdir(const char* pathname) {
         goto rollback;
     }
 
-    // 父目录的 inode 同步到硬盘
-    memset(io_buf, 0, SECTOR_SIZE * 2);
-    inode_sync(cur_part, parent_dir->inode, io_buf);
+    // 父目录的 inode 已修改, 操作结束时写入
+    inode_mark_dirty(parent_dir->inode);
     // 将新创建目录的 inode 同步到硬盘
-    memset(io_buf, 0, SECTOR_SIZE * 2);
-    inode_sync(cur_part, &new_dir_inode, io_buf);
+    inode_sync(cur_part, &new_dir_inode);
     // 将 inode 位图同步到硬盘
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
     sys_free(io_buf);
     // 关闭所创建目录的父目录
     dir_close(searched_record.parent_dir);
+    fs_commit(cur_part);
     return 0;
 
 // 创建文件或目录需要创建相关的多个资源,若某步失败则会执行到下面的回滚步骤
@@ -731,6 +916,7 @@ rollback:  // 因为某步骤操作失败而回滚
         break;
     }
     sys_free(io_buf);
+    fs_commit(cur_part);
     return -1;
 }
 
@@ -823,7 +1009,7 @@ int32_t sys_rmdir(const char* pathname) {
             if (!dir_is_empty(dir)) {  // 非空目录不可删除
                 printk("dir %s is not empty, it is not allowed to delete a nonempty directory!\n", pathname);
             } else {
-                if (!dir_remove(searched_record.parent_dir, dir)) {
+                if (!dir_remove(searched_record.parent_dir, dir, strrchr(searched_record.searched_path, '/') + 1)) {
                     retval = 0;
                 }
             }
@@ -831,6 +1017,7 @@ int32_t sys_rmdir(const char* pathname) {
         }
     }
     dir_close(searched_record.parent_dir);
+    fs_commit(cur_part);
     return retval;
 }
 
@@ -847,7 +1034,7 @@ static uint32_t get_parent_dir_inode_nr(uint32_t child_inode_nr, void* io_buf) {
     uint32_t block_lba = child_dir_inode->i_sectors[0];
     ASSERT(block_lba >= cur_part->sb->data_start_lba);
     inode_close(child_dir_inode);
-    ide_read(cur_part->my_disk, block_lba, io_buf, 1);
+    buffer_read(cur_part->my_disk, block_lba, io_buf, 1);
     struct dir_entry* dir_e = (struct dir_entry*)io_buf;
     // 第 0 个目录项是 ".", 第 1 个目录项是 ".."
     ASSERT(dir_e[1].i_no < 4096 && dir_e[1].f_type == FT_DIRECTORY);
@@ -875,7 +1062,7 @@ static int get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, char* pa
         block_idx++;
     }
     if (parent_dir_inode->i_sectors[12]) {  // 若包含了一级间接块表, 将共读入 all_blocks
-        ide_read(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks + 12, 1);
+        buffer_read(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks + 12, 1);
         block_cnt = 140;
     }
     inode_close(parent_dir_inode);
@@ -887,11 +1074,12 @@ static int get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, char* pa
     // 遍历所有块
     while (block_idx < block_cnt) {
         if (all_blocks[block_idx]) {  // 如果相应块不为空则读入相应块
-        ide_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+        buffer_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
         uint8_t dir_e_idx = 0;
         // 遍历每个目录项
         while (dir_e_idx < dir_entrys_per_sec) {
             if ((dir_e + dir_e_idx)->i_no == c_inode_nr) {
+                dcache_add(cur_part, p_inode_nr, (dir_e + dir_e_idx)->filename, dir_e + dir_e_idx);
                 strcat(path, "/");
                 strcat(path, (dir_e + dir_e_idx)->filename);
                 return 0;
@@ -938,6 +1126,15 @@ char* sys_getcwd(char* buf, uint32_t size) {
     // 当 child_inode_nr 为根目录的 inode 编号 (0) 时停止,
     // 即已经查看完根目录中的目录项
     while ((child_inode_nr)) {
+        // 目录项缓存中有此目录在父目录中的名字时不必读硬盘
+        uint32_t cached_parent;
+        char cached_name[MAX_FILE_NAME_LEN + 1];
+        if (dcache_lookup_parent(cur_part, child_inode_nr, &cached_parent, cached_name)) {
+            strcat(full_path_reverse, "/");
+            strcat(full_path_reverse, cached_name);
+            child_inode_nr = cached_parent;
+            continue;
+        }
         parent_inode_nr = get_parent_dir_inode_nr(child_inode_nr, io_buf);
          // 或未找到名字, 失败退出
         if (get_child_dir_name(parent_inode_nr, child_inode_nr, full_path_reverse, io_buf) == -1) {
@@ -1037,6 +1234,13 @@ void filesys_init(void) {
     uint8_t dev_no = 0;
     uint8_t part_idx = 0;
 
+    // 扇区缓冲区缓存，之后对硬盘的读写都经过它
+    buffer_cache_init(BUFFER_CNT);
+    // 创建 inode 和目录的对象缓存
+    inode_cache_init();
+    dir_cache_init();
+    dcache_init();
+
     // sb_buf 用来存储从硬盘上读入的超级块
     struct super_block* sb_buf = (struct super_block*)sys_malloc(SECTOR_SIZE);
     if (sb_buf == NULL) {
@@ -1066,13 +1270,18 @@ void filesys_init(void) {
                 // 下面处理存在的分区
                 // 我们在扫描分区表的时候，只要分区不存在，分区 part 中任意成员的值都会是 0
                 // 这里使用扇区个数这个字段来判断
-                if (part->sec_cnt != 0) {  // 如果分区存在
+                // 交换分区由 swap_init 接管，不创建文件系统
+                if (part->sec_cnt != 0 && part->fs_type != PART_TYPE_SWAP) {  // 如果分区存在
                     memset(sb_buf, 0, SECTOR_SIZE);
                     // 读出分区的超级块, 根据魔数是否正确来判断是否存在文件系统
-                    ide_read(hd, part->start_lba + 1, sb_buf, 1);
+                    buffer_read(hd, part->start_lba + 1, sb_buf, 1);
                     // 只支持自己的文件系统. 若磁盘上已经有文件系统就不再格式化了
-                    if (sb_buf->magic == SUPER_BLOCK_MAGIC) {
+                    // inode 表的格式也要与 struct disk_inode 一致
+                    if (sb_buf->magic == SUPER_BLOCK_MAGIC && !super_block_is_old(sb_buf)) {
                         printk("%s has filesystem\n", part->name);
+                    } else if (super_block_is_old(sb_buf)) {
+                        // 重新格式化会丢掉其中的数据, 保持原样
+                        printk("%s has an old filesystem format, leave it unformatted\n", part->name);
                     } else {  // 其它文件系统不支持, 一律按无文件系统处理，重新进行初始化
                         printk("formatting %s`s partition %s......\n", hd->name, part->name);
                         partition_format(part);
@@ -1098,6 +1307,9 @@ void filesys_init(void) {
     // 挂载分区
     // mount_partition(default_part) 返回 true 会结束，或者 partition_list 遍历完后会结束
     list_traversal(&partition_list, mount_partition, (int)default_part);
+    if (cur_part == NULL) {
+        PANIC("filesys_init: default partition is not mounted");
+    }
     // 将当前分区的根目录打开
     open_root_dir(cur_part);
     // 初始化文件表
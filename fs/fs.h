@@ -23,6 +23,8 @@
 #define SECTOR_SIZE 512
 // 块字节大小
 #define BLOCK_SIZE SECTOR_SIZE
+// 块组的块数，即一个块位图扇区管理的块，分配时尽量让同一文件、同一目录的块落在同一组
+#define BLOCK_GROUP_SIZE BITS_PER_SECTOR
 // 路径最大长度
 #define MAX_PATH_LEN 512
 
@@ -91,6 +93,10 @@ char* path_parse(char* pathname, char* name_store);
 int32_t path_depth_cnt(char* pathname);
 int32_t sys_open(const char* pathname, uint8_t flags);
 int32_t sys_close(int32_t fd);
+void fs_commit(struct partition* part);
+void sys_sync(void);
+int32_t sys_fsync(int32_t fd);
+void sys_frag(const char* path);
 int32_t sys_write(int32_t fd, const void* buf, uint32_t count);
 int32_t sys_read(int32_t fd, void* buf, uint32_t count);
 int32_t sys_lseek(int32_t fd, int32_t offset, uint8_t whence);
@@ -2,6 +2,8 @@
 #include "fs/fs.h"
 #include "fs/file.h"
 #include "kernel/global.h"
+#include "fs/buffer.h"
+#include "fs/extent.h"
 #include "kernel/debug.h"
 #include "kernel/memory.h"
 #include "kernel/interrupt.h"
@@ -10,14 +12,116 @@
 #include "lib/string.h"
 #include "fs/super_block.h"
 
+// 内存中 inode 的对象缓存
+struct kmem_cache* inode_cache;
+
+/**
+ * @brief inode_cache 中分配的对象，struct inode 之外记录所属分区和 LRU 链表位置
+ *        硬盘上只保存其中的 struct inode
+ */
+struct cached_inode {
+    // 必须是第一个成员，struct inode* 与 struct cached_inode* 可以互相转换
+    struct inode inode;
+    struct partition* part;
+    // 不再被打开时挂在 inode_lru 上
+    struct list_elem lru_tag;
+    // 目录中可能有空目录项的第一个块的序号, 之前的块都是满的, 插入目录项时从这里找起
+    uint32_t dir_free_hint;
+    // 为普通文件预留的紧接着其数据的空闲块, 在内存位图中占用并记在分区的 block_reserved 中,
+    // bitmap_flush 写位图时去掉它们, 所以硬盘上仍是空闲的; 最后关闭时归还
+    struct extent prealloc;
+    // 内容已修改而尚未写入 inode 表, 此时挂在 inode_dirty_list 上
+    bool dirty;
+    struct list_elem dirty_tag;
+};
+
+// 以 (分区, inode 编号) 为键的哈希桶，挂的是 inode_tag
+static struct list inode_hash[INODE_HASH_SIZE];
+// 不再被打开但仍缓存着的 inode，表头是最久未使用的
+static struct list inode_lru;
+static uint32_t inode_lru_cnt;
+// 已修改的 inode, 由 inode_sync_dirty 统一写入
+static struct list inode_dirty_list;
+
+/**
+ * @brief inode 对象的构造函数
+ * 
+ * @param obj 
+ */
+static void inode_ctor(void* obj) {
+    struct inode* inode = (struct inode*)obj;
+    memset(inode, 0, sizeof(struct inode));
+    inode->write_deny = false;
+}
+
+/**
+ * @brief 创建 inode 对象缓存
+ * 
+ */
+void inode_cache_init(void) {
+    // 硬盘上的 inode 不能跨扇区
+    ASSERT(sizeof(struct disk_inode) == DISK_INODE_SIZE && SECTOR_SIZE % DISK_INODE_SIZE == 0);
+    inode_cache = kmem_cache_create("inode", sizeof(struct cached_inode), sizeof(uint32_t), inode_ctor);
+    uint32_t idx;
+    for (idx = 0; idx < INODE_HASH_SIZE; idx++) {
+        list_init(&inode_hash[idx]);
+    }
+    list_init(&inode_lru);
+    list_init(&inode_dirty_list);
+}
+
+static struct list* inode_bucket(struct partition* part, uint32_t inode_no) {
+    return &inode_hash[(inode_no ^ ((uint32_t)part >> 4)) & (INODE_HASH_SIZE - 1)];
+}
+
+/**
+ * @brief 在哈希表中查找分区 part 上的 inode_no 号 inode，找到时增加打开次数，调用者需关中断
+ *
+ * @param part
+ * @param inode_no
+ * @return struct inode* 没有缓存时返回 NULL
+ */
+static struct inode* inode_lookup(struct partition* part, uint32_t inode_no) {
+    struct list* bucket = inode_bucket(part, inode_no);
+    struct list_elem* elem = bucket->head.next;
+    for (; elem != &bucket->tail; elem = elem->next) {
+        struct cached_inode* ci = (struct cached_inode*)elem2entry(struct inode, inode_tag, elem);
+        if (ci->inode.i_no == inode_no && ci->part == part) {
+            // 从 LRU 链表上取回
+            if (ci->inode.i_open_cnts++ == 0) {
+                list_remove(&ci->lru_tag);
+                inode_lru_cnt--;
+            }
+            return &ci->inode;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 把刚从 inode_cache 分配、已填好内容的 inode 加入哈希表，此时它已被打开一次
+ *
+ * @param part
+ * @param inode
+ */
+void inode_hash_insert(struct partition* part, struct inode* inode) {
+    struct cached_inode* ci = (struct cached_inode*)inode;
+    ci->part = part;
+    ci->dir_free_hint = 0;
+    ci->prealloc.start = 0;
+    ci->prealloc.len = 0;
+    ci->dirty = false;
+    inode->i_open_cnts = 1;
+    enum intr_status old_status = intr_disable();
+    list_push(inode_bucket(part, inode->i_no), &inode->inode_tag);
+    intr_set_status(old_status);
+}
+
 /**
  * @brief 用来存储 inode 位置
  * inode 所在的扇区地址及在扇区内的偏移量
  */
 struct inode_position {
-    // inode 是否跨扇区，即占用两个扇区的情况
-    // 这种情况通常出现在 inode 在扇区末尾创建，且扇区末尾又不足以容纳完整 inode 的时候
-    bool two_sec;
     // inode 所在的扇区地址
     uint32_t sec_lba;
     // inode 在扇区内的偏移量
@@ -36,67 +140,233 @@ static void inode_locate(struct partition* part, uint32_t inode_no, struct inode
     ASSERT(inode_no < 4096);
     // inode 数组起始扇区的地址
     uint32_t inode_table_lba = part->sb->inode_table_lba;
-    uint32_t inode_size = sizeof(struct inode);
+    // 一个扇区正好存放整数个 disk_inode, inode 不会跨越 2 个扇区
+    uint32_t inode_size = DISK_INODE_SIZE;
     // 第 inode_no 号 inode 结点相对于 inode_table_lba 的字节偏移量
     uint32_t off_size = inode_no * inode_size;
     // 相对于 inode_table_lab 的扇区偏移量
     uint32_t off_sec  = off_size / 512;
     // 该 inode 在扇区中的偏移字节
     uint32_t off_size_in_sec = off_size % 512;
-
-    // 判断此 i 结点是否跨越 2 个扇区
-    uint32_t left_in_sec = 512 - off_size_in_sec;
-    // 只要判断该 inode 所在扇区的起始地址到扇区结束之间的 “剩余空间” 是否大于 inode 尺寸即可
-    // 若扇区内剩下的空间不足以容纳一个 inode, 必然是 inode 结点跨越了 2 个扇区
-    if (left_in_sec < inode_size) {
-        inode_pos->two_sec = true;
-    } else {  // 否则, 所查找的 inode 未跨扇区
-        inode_pos->two_sec = false;
-    }
     inode_pos->sec_lba = inode_table_lba + off_sec;
     inode_pos->off_size = off_size_in_sec;
 }
 
 /**
- * @brief 将 inode 写入到分区 part
+ * @brief 把 inode 表中第 inode_no 项读到 d_inode
+ *        直接从缓存中 inode 表的扇区复制
  * 
- * @param part 分区
- * @param inode 待同步的 inode 指针
- * @param io_buf 是用于硬盘 io 的缓冲区
+ * @param part 
+ * @param inode_no 
+ * @param d_inode 
  */
-void inode_sync(struct partition* part, struct inode* inode, void* io_buf) {
-    uint8_t inode_no = inode->i_no;
+static void inode_table_read(struct partition* part, uint32_t inode_no, struct disk_inode* d_inode) {
+    struct inode_position inode_pos;
+    inode_locate(part, inode_no, &inode_pos);
+    ASSERT(inode_pos.sec_lba <= (part->start_lba + part->sec_cnt));
+    struct buffer_head* bh = buffer_get(part->my_disk, inode_pos.sec_lba);
+    memcpy(d_inode, bh->data + inode_pos.off_size, DISK_INODE_SIZE);
+    buffer_put(bh);
+}
+
+/**
+ * @brief 把 d_inode 写到 inode 表中第 inode_no 项
+ *        直接修改缓存中 inode 表的扇区, 不必先把扇区读出再整个写回
+ * 
+ * @param part 
+ * @param inode_no 
+ * @param d_inode 
+ */
+static void inode_table_write(struct partition* part, uint32_t inode_no, const struct disk_inode* d_inode) {
     struct inode_position inode_pos;
     // inode位置信息会存入inode_pos
     inode_locate(part, inode_no, &inode_pos);
     ASSERT(inode_pos.sec_lba <= (part->start_lba + part->sec_cnt));
+    struct buffer_head* bh = buffer_get(part->my_disk, inode_pos.sec_lba);
+    // 与写回互斥
+    lock_acquire(&bh->io_lock);
+    memcpy(bh->data + inode_pos.off_size, d_inode, DISK_INODE_SIZE);
+    lock_release(&bh->io_lock);
+    buffer_mark_dirty(bh);
+    buffer_put(bh);
+}
 
-    // 硬盘中的 inode 中的成员 inode_tag 和 i_open_cnts 是不需要的
-    // 它们只在内存中记录链表位置和被多少进程共享
-    struct inode pure_inode;
-    memcpy(&pure_inode, inode, sizeof(struct inode));
-
-    // 以下 inode 的三个成员只存在于内存中, 现在将 inode 同步到硬盘, 清掉这三项即可
-    pure_inode.i_open_cnts = 0;
-    // 置为 false, 以保证在硬盘中读出时为可写
-    pure_inode.write_deny = false;
-    pure_inode.inode_tag.prev = pure_inode.inode_tag.next = NULL;
-
-    char* inode_buf = (char*)io_buf;
-    // 若是跨了两个扇区, 就要读出两个扇区再写入两个扇区
-    if (inode_pos.two_sec) {
-        // 读写硬盘是以扇区为单位, 若写入的数据小于一扇区, 要将原硬盘上的内容先读出来再和新数据拼成一扇区后再写入
-        // inode 在 format 中写入硬盘时是连续写入的, 所以读入 2 块扇区
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-        // 开始将待写入的 inode 拼入到这 2 个扇区中的相应位置
-        memcpy((inode_buf + inode_pos.off_size), &pure_inode, sizeof(struct inode));
-        // 将拼接好的数据再写入磁盘
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-    } else {  // 若只是一个扇区
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-        memcpy((inode_buf + inode_pos.off_size), &pure_inode, sizeof(struct inode));
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+/**
+ * @brief 将 inode 写入到分区 part
+ * 
+ * @param part 分区
+ * @param inode 待同步的 inode 指针
+ */
+void inode_sync(struct partition* part, struct inode* inode) {
+    // 硬盘中的 inode 只有需要持久化的成员
+    // i_open_cnts、write_deny 和 inode_tag 只在内存中记录被多少进程共享、写状态和链表位置
+    struct disk_inode d_inode;
+    memset(&d_inode, 0, sizeof(struct disk_inode));
+    d_inode.i_size = inode->i_size;
+    d_inode.i_flags = inode->i_flags;
+    // i_sectors 与 i_extents、i_extent_block 共用同一块空间, 一起复制
+    memcpy(d_inode.i_sectors, inode->i_sectors, sizeof(d_inode.i_sectors));
+    inode_table_write(part, inode->i_no, &d_inode);
+}
+
+/**
+ * @brief 标记 inode 已修改, 一次操作中多次修改只在 inode_sync_dirty 时写入一次
+ *
+ * @param inode 必须是 inode_open 返回的
+ */
+void inode_mark_dirty(struct inode* inode) {
+    struct cached_inode* ci = (struct cached_inode*)inode;
+    enum intr_status old_status = intr_disable();
+    if (!ci->dirty) {
+        ci->dirty = true;
+        list_append(&inode_dirty_list, &ci->dirty_tag);
     }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 清除 inode 的修改标记
+ *
+ * @param ci
+ * @return bool 之前是否被标记过
+ */
+static bool inode_clear_dirty(struct cached_inode* ci) {
+    enum intr_status old_status = intr_disable();
+    bool dirty = ci->dirty;
+    if (dirty) {
+        ci->dirty = false;
+        list_remove(&ci->dirty_tag);
+    }
+    intr_set_status(old_status);
+    return dirty;
+}
+
+/**
+ * @brief 把分区 part 上被标记修改过的 inode 写入 inode 表
+ *
+ * @param part
+ */
+void inode_sync_dirty(struct partition* part) {
+    while (true) {
+        // 写入时会睡眠, 每次都从表头重新找
+        struct cached_inode* found = NULL;
+        enum intr_status old_status = intr_disable();
+        struct list_elem* elem = inode_dirty_list.head.next;
+        for (; elem != &inode_dirty_list.tail; elem = elem->next) {
+            struct cached_inode* ci = elem2entry(struct cached_inode, dirty_tag, elem);
+            if (ci->part == part) {
+                found = ci;
+                break;
+            }
+        }
+        intr_set_status(old_status);
+        if (found == NULL) {
+            break;
+        }
+        if (inode_clear_dirty(found)) {
+            inode_sync(part, &found->inode);
+        }
+    }
+}
+
+/**
+ * @brief 将按区段映射的 inode 及其溢出块、数据块在缓存中的脏扇区写回硬盘
+ *
+ * @param part
+ * @param inode
+ */
+static void inode_flush_extents(struct partition* part, struct inode* inode) {
+    struct extent* runs = sys_malloc_nozero(EXTENT_MAX * sizeof(struct extent));
+    if (runs == NULL) {
+        printk("inode_flush: sys_malloc for runs failed\n");
+        return;
+    }
+    struct inode_position inode_pos;
+    inode_locate(part, inode->i_no, &inode_pos);
+    uint32_t lbas[2], cnt = 0;
+    lbas[cnt++] = inode_pos.sec_lba;
+    if (inode->i_extent_block != 0) {
+        lbas[cnt++] = inode->i_extent_block;
+    }
+    buffer_sync_lbas(part->my_disk, lbas, cnt);
+    // 映射全部块得到的就是全部区段
+    uint32_t run_cnt = extent_map(part, inode, 0, (uint32_t)-1, runs, EXTENT_MAX);
+    uint32_t idx;
+    for (idx = 0; idx < run_cnt; idx++) {
+        buffer_sync_range(part->my_disk, runs[idx].start, runs[idx].len);
+    }
+    sys_free(runs);
+}
+
+/**
+ * @brief 将 inode 及其数据块、间接块表在缓存中的脏扇区写回硬盘
+ *
+ * @param part
+ * @param inode
+ */
+void inode_flush(struct partition* part, struct inode* inode) {
+    if (inode->i_flags & INODE_EXTENTS) {
+        inode_flush_extents(part, inode);
+        return;
+    }
+    // inode 所在的 1 个扇区，再加 12 个直接块、1 个间接块表和 128 个间接块
+    uint32_t* lbas = sys_malloc_nozero((1 + 13 + 128) * sizeof(uint32_t));
+    if (lbas == NULL) {
+        printk("inode_flush: sys_malloc for lbas failed\n");
+        return;
+    }
+    struct inode_position inode_pos;
+    inode_locate(part, inode->i_no, &inode_pos);
+    uint32_t cnt = 0;
+    lbas[cnt++] = inode_pos.sec_lba;
+    uint32_t idx;
+    for (idx = 0; idx < 13; idx++) {
+        if (inode->i_sectors[idx] != 0) {
+            lbas[cnt++] = inode->i_sectors[idx];
+        }
+    }
+    if (inode->i_sectors[12] != 0) {
+        // 间接块表读到 lbas 末尾，再去掉其中未使用的项
+        uint32_t* indirect = lbas + cnt;
+        buffer_read(part->my_disk, inode->i_sectors[12], indirect, 1);
+        for (idx = 0; idx < 128; idx++) {
+            if (indirect[idx] != 0) {
+                lbas[cnt++] = indirect[idx];
+            }
+        }
+    }
+    buffer_sync_lbas(part->my_disk, lbas, cnt);
+    sys_free(lbas);
+}
+
+/**
+ * @brief 目录 inode 中可能有空目录项的第一个块的序号
+ *
+ * @param inode 必须是 inode_open 返回的
+ * @return uint32_t
+ */
+uint32_t inode_dir_hint(struct inode* inode) {
+    return ((struct cached_inode*)inode)->dir_free_hint;
+}
+
+/**
+ * @brief 更新目录 inode 中可能有空目录项的第一个块的序号
+ *
+ * @param inode 必须是 inode_open 返回的
+ * @param block_idx
+ */
+void inode_set_dir_hint(struct inode* inode, uint32_t block_idx) {
+    ((struct cached_inode*)inode)->dir_free_hint = block_idx;
+}
+
+/**
+ * @brief 普通文件预留的块
+ *
+ * @param inode 必须是 inode_open 返回的
+ * @return struct extent*
+ */
+struct extent* inode_prealloc(struct inode* inode) {
+    return &((struct cached_inode*)inode)->prealloc;
 }
 
 /**
@@ -108,52 +378,37 @@ void inode_sync(struct partition* part, struct inode* inode, void* io_buf) {
  * @return struct inode* 
  */
 struct inode* inode_open(struct partition* part, uint32_t inode_no) {
-    // 先在已打开 inode 链表中找 inode, 此链表是为提高效率创建的缓冲区
-    // part->open_inodes 这个队列保存已经打开的 inode
-    struct list_elem* elem = part->open_inodes.head.next;
-    struct inode* inode_found;
-    while (elem != &part->open_inodes.tail) {
-        inode_found = elem2entry(struct inode, inode_tag, elem);
-        if (inode_found->i_no == inode_no) {
-            inode_found->i_open_cnts++;
-            return inode_found;
-        }
-        elem = elem->next;
+    // 先在 inode 哈希表中找, 关闭后仍缓存着的 inode 也在其中
+    enum intr_status old_status = intr_disable();
+    struct inode* inode_found = inode_lookup(part, inode_no);
+    intr_set_status(old_status);
+    if (inode_found != NULL) {
+        return inode_found;
     }
 
-    // 由于 open_inodes 链表中找不到, 下面从硬盘上读入此 inode 并加入到此链表
-    struct inode_position inode_pos;
-    // inode 位置信息会存入 inode_pos, 包括 inode 所在扇区地址和扇区内的字节偏移量
-    inode_locate(part, inode_no, &inode_pos);
-    // 为使通过 sys_malloc 创建的新 inode 被所有任务共享,
-    // 需要将 inode 置于内核空间, 故需要临时将 cur_pbc->pg_dir 置为 NULL
-    struct task_struct* cur = running_thread();
-    uint32_t* cur_pagedir_bak = cur->pg_dir;
-    cur->pg_dir = NULL;
-    // 以上三行代码完成后下面分配的内存将位于内核区
-    inode_found = (struct inode*)sys_malloc(sizeof(struct inode));
-    // 恢复 pg_dir
-    cur->pg_dir = cur_pagedir_bak;
-    // 开始读磁盘
-    char* inode_buf;
-    // 考虑跨扇区的情况
-    if (inode_pos.two_sec) {
-        // 如果跨扇区，这里申请了两个扇区大小
-        inode_buf = (char*)sys_malloc(2 * SECTOR_SIZE);
-        // inode 结点表是被 partition_format 函数连续写入扇区的, 所以下面可以连续读出来
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-    } else {
-        // 所查找的 inode 未跨扇区, 一个扇区大小的缓冲区足够
-        inode_buf = (char*)sys_malloc(SECTOR_SIZE);
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-    }
-    memcpy(inode_found, inode_buf + inode_pos.off_size, sizeof(struct inode));
+    // 由于哈希表中找不到, 下面从硬盘上读入此 inode 并加入到哈希表
+    struct disk_inode d_inode;
+    inode_table_read(part, inode_no, &d_inode);
+    // inode 要被所有任务共享, 从 inode_cache 中分配, 它总是位于内核空间
+    inode_found = (struct inode*)kmem_cache_alloc(inode_cache);
+    // 其余只在内存中的成员由 inode_hash_insert 设置, inode_tag 随后挂入哈希表
+    inode_found->write_deny = false;
+    inode_found->i_no = inode_no;
+    inode_found->i_size = d_inode.i_size;
+    inode_found->i_flags = d_inode.i_flags;
+    memcpy(inode_found->i_sectors, d_inode.i_sectors, sizeof(d_inode.i_sectors));
 
-    // 根据程序的局部性原理，一会很可能要用到此 inode, 故将其插入到队首便于提前检索到
-    list_push(&part->open_inodes, &inode_found->inode_tag);
+    // 读硬盘时可能有别的任务也打开了此 inode 并先加入了哈希表
+    old_status = intr_disable();
+    struct inode* inode_cached = inode_lookup(part, inode_no);
+    if (inode_cached != NULL) {
+        intr_set_status(old_status);
+        kmem_cache_free(inode_cache, inode_found);
+        return inode_cached;
+    }
     // 表示目前此 inode 仅被打开一次
-    inode_found->i_open_cnts = 1;
-    sys_free(inode_buf);
+    inode_hash_insert(part, inode_found);
+    intr_set_status(old_status);
     return inode_found;
 }
 
@@ -163,19 +418,50 @@ struct inode* inode_open(struct partition* part, uint32_t inode_no) {
  * @param inode 
  */
 void inode_close(struct inode* inode) {
-    // 若没有进程再打开此文件, 将此 inode 去掉并释放空间
+    // 最后一次关闭时归还预留的块并写入修改过的 inode, 要读写硬盘, 不能在关中断时进行
+    // 此后它可能被回收
+    if (inode->i_open_cnts == 1) {
+        struct cached_inode* ci = (struct cached_inode*)inode;
+        extent_prealloc_release(ci->part, inode);
+        if (inode_clear_dirty(ci)) {
+            inode_sync(ci->part, inode);
+        }
+    }
+    // 若没有进程再打开此文件, 将此 inode 挂到 LRU 链表上, 下次打开时无须再读硬盘
     enum intr_status old_status = intr_disable();
     if (--inode->i_open_cnts == 0) {
-        // 将 inode 结点从 part->open_inodes 中去掉
+        struct cached_inode* ci = (struct cached_inode*)inode;
+        inode->write_deny = false;
+        list_append(&inode_lru, &ci->lru_tag);
+        // 缓存的 inode 超过上限时回收最久未使用的
+        if (++inode_lru_cnt > INODE_CACHE_LIMIT) {
+            ci = elem2entry(struct cached_inode, lru_tag, list_pop(&inode_lru));
+            inode_lru_cnt--;
+            list_remove(&ci->inode.inode_tag);
+            kmem_cache_free(inode_cache, ci);
+        }
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 把不再被打开的 inode 从缓存中去掉，inode 被删除后调用
+ *
+ * @param part
+ * @param inode_no
+ */
+static void inode_evict(struct partition* part, uint32_t inode_no) {
+    enum intr_status old_status = intr_disable();
+    struct inode* inode = inode_lookup(part, inode_no);
+    if (inode != NULL && inode->i_open_cnts > 1) {
+        // 仍被别的任务打开着, 由其最后关闭时挂到 LRU 链表上
+        inode->i_open_cnts--;
+    } else if (inode != NULL) {
         list_remove(&inode->inode_tag);
-        // inode_open 时为实现 inode 被所有进程共享,
-        // 已经在 sys_malloc 为 inode 分配了内核空间,
-        // 释放 inode 时也要确保释放的是内核内存池
-        struct task_struct* cur = running_thread();
-        uint32_t* cur_pagedir_bak = cur->pg_dir;
-        cur->pg_dir = NULL;
-        sys_free(inode);
-        cur->pg_dir = cur_pagedir_bak;
+        // write_deny 要恢复到构造后的状态
+        inode->i_open_cnts = 0;
+        inode->write_deny = false;
+        kmem_cache_free(inode_cache, inode);
     }
     intr_set_status(old_status);
 }
@@ -185,31 +471,13 @@ void inode_close(struct inode* inode) {
  * 
  * @param part 
  * @param inode_no 
- * @param io_buf 
  */
-void inode_delete(struct partition* part, uint32_t inode_no, void* io_buf) {
+void inode_delete(struct partition* part, uint32_t inode_no) {
     ASSERT(inode_no < 4096);
-    struct inode_position inode_pos;
-    // inode 位置信息会存入 inode_pos
-    inode_locate(part, inode_no, &inode_pos);
-    ASSERT(inode_pos.sec_lba <= (part->start_lba + part->sec_cnt));
-
-    char* inode_buf = (char*)io_buf;
-    if (inode_pos.two_sec) {   // inode跨扇区,读入2个扇区
-        // 将原硬盘上的内容先读出来
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-        // 将 inode_buf 清 0
-        memset((inode_buf + inode_pos.off_size), 0, sizeof(struct inode));
-        // 用清 0 的内存数据覆盖磁盘
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-    } else {  // 未跨扇区, 只读入 1 个扇区就好
-        // 将原硬盘上的内容先读出来
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-        // 将 inode_buf 清 0
-        memset((inode_buf + inode_pos.off_size), 0, sizeof(struct inode));
-        // 用清 0 的内存数据覆盖磁盘
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-    }
+    struct disk_inode zero_inode;
+    memset(&zero_inode, 0, sizeof(struct disk_inode));
+    // 用清 0 的内容覆盖 inode 表中的这一项
+    inode_table_write(part, inode_no, &zero_inode);
 }
 
 /**
@@ -223,6 +491,10 @@ void inode_release(struct partition* part, uint32_t inode_no) {
     ASSERT(inode_to_del->i_no == inode_no);
 
     // 1. 回收 inode 占用的所有块
+    if (inode_to_del->i_flags & INODE_EXTENTS) {
+        extent_release(part, inode_to_del);
+        goto release_inode;
+    }
     uint8_t block_idx = 0, block_cnt = 12;
     uint32_t block_bitmap_idx;
     // 12 个直接块 + 128 个间接块
@@ -233,7 +505,7 @@ void inode_release(struct partition* part, uint32_t inode_no) {
     }
     // b. 如果一级间接块表存在,将其 128 个间接块读到 all_blocks[12~], 并释放一级间接块表所占的扇区
     if (inode_to_del->i_sectors[12] != 0) {
-        ide_read(part->my_disk, inode_to_del->i_sectors[12], all_blocks + 12, 1);
+        buffer_read(part->my_disk, inode_to_del->i_sectors[12], all_blocks + 12, 1);
         block_cnt = 140;
         // 回收一级间接块表占用的扇区
         block_bitmap_idx = inode_to_del->i_sectors[12] - part->sb->data_start_lba;
@@ -255,6 +527,7 @@ void inode_release(struct partition* part, uint32_t inode_no) {
     }
 
     // 2. 回收该 inode 所占用的 inode
+release_inode:
     bitmap_set(&part->inode_bitmap, inode_no, 0);
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
@@ -262,12 +535,14 @@ void inode_release(struct partition* part, uint32_t inode_no) {
      * 此函数会在inode_table中将此inode清0,
      * 但实际上是不需要的,inode分配是由inode位图控制的,
      * 硬盘上的数据不需要清0,可以直接覆盖*/
-    void* io_buf = sys_malloc(1024);
-    inode_delete(part, inode_no, io_buf);
-    sys_free(io_buf);
+    // 尚未写入的修改不再需要, 不能在关闭时覆盖清 0 的内容
+    inode_clear_dirty((struct cached_inode*)inode_to_del);
+    inode_delete(part, inode_no);
     /***********************************************/
 
     inode_close(inode_to_del);
+    // inode 编号会被再次分配, 不能留着旧内容
+    inode_evict(part, inode_no);
 }
 
 /**
@@ -281,6 +556,7 @@ void inode_init(uint32_t inode_no, struct inode* new_inode) {
     new_inode->i_size = 0;
     new_inode->i_open_cnts = 0;
     new_inode->write_deny = false;
+    new_inode->i_flags = 0;
 
     // 初始化块索引数组 i_sector
     uint8_t sec_idx = 0;
@@ -17,6 +17,33 @@
 #include "lib/kernel/list.h"
 #include "device/ide.h"
 
+// inode 哈希桶个数，须为 2 的幂
+#define INODE_HASH_SIZE 64
+// 最多缓存多少个不再被打开的 inode，可按内存大小调整
+#define INODE_CACHE_LIMIT 64
+
+// i_flags: 数据块按区段 (extent) 映射，普通文件都是如此，目录仍用 i_sectors
+#define INODE_EXTENTS 0x1
+// inode 中直接存放的区段个数，更多的区段存放在溢出块中
+#define INODE_EXTENT_CNT 6
+
+// inode 表的格式版本，格式化时写入超级块的 inode_version，版本不同的分区不会被挂载，也不会被重新格式化
+// 改变 struct disk_inode 的布局或者开始使用其中的预留字段时加 1
+#define INODE_VERSION 1
+// struct disk_inode 的大小，须能整除 SECTOR_SIZE，这样 inode 不会跨扇区
+#define DISK_INODE_SIZE 128
+// disk_inode 中预留给更多区段或小文件内联数据的字节数
+#define DISK_INODE_SPARE 60
+
+/**
+ * @brief 区段，文件中逻辑上连续的 len 个块存放在从 start 开始的连续扇区中
+ *
+ */
+struct extent {
+    uint32_t start;
+    uint32_t len;
+};
+
 /**
  * @brief inode 结构
  * 
@@ -38,25 +65,68 @@ struct inode {
     // 因此必须保证文件的写操作是串行的
     // 当 write_deny 为 true 时表示已经有任务在写文件里，此文件的其他写操作应该被拒绝
     bool write_deny;
+    // INODE_EXTENTS 等标志
+    uint32_t i_flags;
 
-    // 数据块的指针，因为我们一个数据块是一个扇区，因此使用 sectors 命名
-    // i_sectors[0-11] 是直接块, i_sectors[12] 用来存储一级间接块指针
-    // 我们只支持一级间接块
-    // 扇区大小 512 字节，块地址用 4 字节表示，所以支持的一级间接块是 128 个
-    // 因此一共支持: 12+128=140 个块(扇区)
-    uint32_t i_sectors[13];
-    // 存储已打开的 inode 列表，充当一个磁盘与内存之间的缓冲区
+    union {
+        // 数据块的指针，因为我们一个数据块是一个扇区，因此使用 sectors 命名
+        // i_sectors[0-11] 是直接块, i_sectors[12] 用来存储一级间接块指针
+        // 我们只支持一级间接块
+        // 扇区大小 512 字节，块地址用 4 字节表示，所以支持的一级间接块是 128 个
+        // 因此一共支持: 12+128=140 个块(扇区)
+        uint32_t i_sectors[13];
+        // 设置了 INODE_EXTENTS 时, 按文件中的先后顺序排列的区段, len 为 0 表示未使用
+        // 超过 INODE_EXTENT_CNT 个区段时, 其余的存放在溢出块 i_extent_block 中
+        struct {
+            struct extent i_extents[INODE_EXTENT_CNT];
+            uint32_t i_extent_block;
+        };
+    };
+    // inode 哈希表中的节点，哈希表充当一个磁盘与内存之间的缓冲区
     // 由于 inode 是从硬盘上保存的，文件被打开时，肯定是先要从硬盘上载入其 inode，硬盘较慢
-    // 为了避免下次再打开该文件时还要从硬盘上重复载入 inode，应该在该文件第一次被打开时就将其 inode 加入到内存缓冲中
+    // 为了避免下次再打开该文件时还要从硬盘上重复载入 inode，文件关闭后其 inode 仍留在哈希表中，直到超过 INODE_CACHE_LIMIT 被回收
     // 每次打开一个文件时，先在此缓冲中查找相关的 inode，如果有就直接使用，否则再从硬盘上读取 inode
     struct list_elem inode_tag;
 };
 
+/**
+ * @brief 硬盘上的 inode，共 DISK_INODE_SIZE 字节，一个扇区正好存放 4 个
+ *        只包含需要持久化的成员，与 struct inode 之间逐个成员转换
+ *        inode 编号由它在 inode 表中的位置决定，无须存放
+ */
+struct disk_inode {
+    uint32_t i_size;
+    uint32_t i_flags;
+    // 创建时间和修改时间，暂无实时时钟，现在总是 0
+    uint32_t i_ctime;
+    uint32_t i_mtime;
+    // 与 struct inode 中的同名成员相同
+    union {
+        uint32_t i_sectors[13];
+        struct {
+            struct extent i_extents[INODE_EXTENT_CNT];
+            uint32_t i_extent_block;
+        };
+    };
+    // 预留，可用来存放更多的区段或者小文件的内联数据，现在全为 0
+    uint8_t i_spare[DISK_INODE_SPARE];
+} __attribute__((packed));
+
+extern struct kmem_cache* inode_cache;
+
+void inode_cache_init(void);
+void inode_hash_insert(struct partition* part, struct inode* inode);
+uint32_t inode_dir_hint(struct inode* inode);
+void inode_set_dir_hint(struct inode* inode, uint32_t block_idx);
+struct extent* inode_prealloc(struct inode* inode);
 struct inode* inode_open(struct partition* part, uint32_t inode_no);
-void inode_sync(struct partition* part, struct inode* inode, void* io_buf);
+void inode_sync(struct partition* part, struct inode* inode);
+void inode_mark_dirty(struct inode* inode);
+void inode_sync_dirty(struct partition* part);
+void inode_flush(struct partition* part, struct inode* inode);
 void inode_init(uint32_t inode_no, struct inode* new_inode);
 void inode_close(struct inode* inode);
 void inode_release(struct partition* part, uint32_t inode_no);
-void inode_delete(struct partition* part, uint32_t inode_no, void* io_buf);
+void inode_delete(struct partition* part, uint32_t inode_no);
 
 #endif  // FS_INODE_H_
@@ -0,0 +1,35 @@
+/**
+ * @file readahead.h
+ * @author your name (you@domain.com)
+ * @brief 打开文件的顺序预读状态
+ * @version 0.1
+ * @date 2023-07-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef FS_READAHEAD_H_
+#define FS_READAHEAD_H_
+
+#include "lib/stdint.h"
+
+// 预读窗口初始的扇区数
+#define FILE_RA_MIN 4
+// 预读窗口最大的扇区数，可按需要调整
+#define FILE_RA_MAX 32
+
+/**
+ * @brief 预读状态
+ *        本次读取正好从上次读完的位置开始时视为顺序读，预读窗口翻倍直到 FILE_RA_MAX；否则停止预读
+ */
+struct file_ra {
+    // 上次读完时的 fd_pos
+    uint32_t ra_pos;
+    // 预读窗口的扇区数，为 0 表示没有在预读
+    uint32_t ra_win;
+    // 已发出预读的块的终点(不含)
+    uint32_t ra_end;
+};
+
+#endif  // FS_READAHEAD_H_
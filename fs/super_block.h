@@ -14,7 +14,13 @@
 
 #include "lib/stdint.h"
 
-#define SUPER_BLOCK_MAGIC 0x19970719
+// 超级块的布局改变时修改它，并把旧的魔数记在下面
+// 旧格式的分区既不挂载也不重新格式化，以免其中的数据丢失
+#define SUPER_BLOCK_MAGIC 0x1997071b
+// 最初的格式
+#define SUPER_BLOCK_MAGIC_V0 0x19970719
+// 普通文件改用区段映射之后、超级块中还没有 inode_version 时的格式
+#define SUPER_BLOCK_MAGIC_V1 0x1997071a
 
 /**
  * @brief 超级块
@@ -54,9 +60,14 @@ struct super_block {
     // 目录项大小
     uint32_t dir_entry_size;
 
-    // 以上所有变量加起来有 52 字节
-    // 加上 460 字节,凑够 512 字节 1 扇区大小
-    uint8_t pad[460];
+    // inode 表的格式版本, 即格式化时的 INODE_VERSION
+    uint32_t inode_version;
+    // inode 表中每一项的字节数
+    uint32_t inode_size;
+
+    // 以上所有变量加起来有 60 字节
+    // 加上 452 字节,凑够 512 字节 1 扇区大小
+    uint8_t pad[452];
 } __attribute__((packed));
 
 #endif  // FS_SUPER_BLOCK_H_
@@ -10,6 +10,7 @@
 #include "user_process/syscall-init.h"
 #include "device/ide.h"
 #include "fs/fs.h"
+#include "kernel/swap.h"
 
 /**
  * @brief 初始化所有模块
@@ -30,5 +31,6 @@ void init_all() {
     ide_init();  // 初始化硬盘
 
     filesys_init();  // 初始化文件系统
+    swap_init();  // 初始化交换区
     // asm volatile ("xchg %%bx, %%bx" ::);
 }
@@ -9,6 +9,7 @@
 #include "device/keyboard.h"
 #include "user_process/process.h"
 #include "lib/user/syscall.h"
+#include "lib/user/malloc.h"
 #include "user_process/syscall-init.h"
 #include "lib/stdio.h"
 #include "fs/fs.h"
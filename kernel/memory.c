@@ -7,34 +7,114 @@
 #include "lib/string.h"
 #include "thread/sync.h"
 #include "kernel/interrupt.h"
-
-// 因为 0xc009f000 是内核主线程栈顶，0xc009e000 是内核主线程的 pcb
-// 使用一页 4096 字节来保存一个位图，那么此位图一定有 (4096 * 8 = 32768) 位
-// 又因为位图中一位表示一页，那么此位图有 32768 位，可以表示 32768 个页，也即(32768 * 4096 = 134217728)字节，也即 128M
-// 我们一共有 4 个这样的位图，总共可以表示 512M 虚拟内存
-// 位图地址
-#define MEM_BITMAP_BASE 0xc009a000
+#include "lib/kernel/stdio_kernel.h"
+#include "lib/stdio.h"
+#include "user_process/process.h"
+#include "user_process/exec.h"
+#include "kernel/vma.h"
+#include "kernel/swap.h"
 
 // 0xc0000000 是内核从虚拟地址 3G 起
-// 0x100000 跨过低端 1MB 内存，使虚拟地址在逻辑上连续
-#define K_HEAP_START 0xc0100000
+// 内核堆从第 769 个页目录项覆盖的范围开始，使 0xc0000000 ~ 0xc03fffff 能用一个 4M 大页映射物理内存的前 4M
+#define K_HEAP_START 0xc0400000
+// 内核堆的上限，再往上是页目录的自映射
+#define K_HEAP_END 0xffc00000
+
+// loader 通过 BIOS 0xe820 子功能获取的内存布局
+// ards_buf 位于 0x92a，共 212 字节，最多容纳 10 个描述符；ards_nr 紧随其后，位于 0x9fe
+#define ARDS_BUF_ADDR 0xc000092a
+#define ARDS_NR_ADDR 0xc00009fe
+#define ARDS_MAX 10
+// 可供操作系统使用的内存
+#define ARDS_TYPE_USABLE 1
+// 32 位物理地址空间的页框数
+#define PFN_MAX 0x100000
+// 主页目录的物理地址，由 loader 建立
+#define KERNEL_PAGE_DIR_PHY 0x100000
+
+// 每个内存池最多缓存的预先清零的物理页数
+#define ZEROED_FRAMES_MAX 32
+
+// 伙伴系统的阶数，最大的连续块为 2^(MAX_ORDER-1) 页，也即 4MB
+#define MAX_ORDER 11
+// 页框不是某个空闲块的首页（已分配或位于空闲块中间）
+#define PAGE_ORDER_NONE -1
+
+// 页框所属的内存池
+#define POOL_KERNEL 0
+#define POOL_USER 1
+// 不属于任何内存池的页框，如内存空洞、低端 1M 和启动时划走的页框
+#define POOL_NONE 0xff
+// 内存池耗尽时一次从另一个内存池至少借用 2^POOL_LEND_ORDER 页，也即 1MB
+#define POOL_LEND_ORDER 8
+
+/**
+ * @brief BIOS 0xe820 子功能返回的地址范围描述符
+ * 
+ */
+struct ards {
+    uint32_t base_low;
+    uint32_t base_high;
+    uint32_t length_low;
+    uint32_t length_high;
+    uint32_t type;
+};
+
+/**
+ * @brief 一段可用物理内存的页框号范围 [start_pfn, end_pfn)
+ * 
+ */
+struct mem_range {
+    uint32_t start_pfn;
+    uint32_t end_pfn;
+};
+
+/**
+ * @brief 物理页框描述符，每个物理页框对应一个
+ * 
+ */
+struct page {
+    // 空闲块首页通过此标签挂在 free_area 的链表上
+    struct list_elem free_tag;
+    // 若此页是空闲块的首页，则为该块的阶，否则为 PAGE_ORDER_NONE
+    int8_t order;
+    // 当前拥有此页框的内存池，内存池之间借用页框时随之改变
+    uint8_t pool_idx;
+    // 是否已分配，用于检查重复分配和重复释放
+    uint8_t allocated;
+    // 此页属于 slab 时指向该 slab，否则为 NULL
+    struct kmem_slab* slab;
+    // 写时复制共享此页框的映射数减一，为 0 表示只有一个映射
+    uint32_t share_cnt;
+    // 被 user_pages_pin 钉住的次数，不为 0 时不会被换出
+    uint32_t pin_cnt;
+};
 
-// 页目录项索引
-#define PDE_IDX(addr) ((addr & 0xffc00000) >> 22)
-// 页表项索引
-#define PTE_IDX(addr) ((addr & 0x003ff000) >> 12)
+/**
+ * @brief 伙伴系统中某一阶的空闲块链表
+ * 
+ */
+struct free_area {
+    struct list free_list;
+    // 该阶空闲块的个数
+    uint32_t nr_free;
+};
 
 /**
  * @brief 内存池结构
  *        有两个实例，用于管理内核内存池和用户内存池
+ *        两者共用按物理页框号索引的页框描述符数组，页框可以在两者之间借用
  */
 struct pool {
-    // 本内存池用到的位图结构，用于管理物理内存
-    struct bitmap pool_bitmap;
-    // 本内存池所管理物理内存的起始地址
-    uint32_t phy_addr_start;
-    // 本内存池字节容量
-    uint32_t pool_size;
+    // POOL_KERNEL 或 POOL_USER
+    uint8_t pool_idx;
+    // 本内存池当前拥有的页框数，借出或借入页框时随之改变
+    uint32_t pages_cnt;
+    // 伙伴系统各阶的空闲块
+    struct free_area free_area[MAX_ORDER];
+    // idle 线程预先清零的物理页，这些页已从伙伴系统中分配出来
+    uint32_t zeroed_frames[ZEROED_FRAMES_MAX];
+    uint32_t zeroed_cnt;
     // 申请内存时互斥
     struct lock lock;
 };
@@ -50,14 +130,51 @@ struct arena {
     // 否则 cnt 表示空闲 mem_block 数量
     uint32_t cnt;
     bool large;
+    // 用于挂到 mem_block_desc 的 partial_list/full_list/empty_list 上
+    struct list_elem arena_tag;
+    // arena 内空闲内存块的单链表，只包含被释放回来的块
+    struct mem_block* free_head;
+    // 从未分配过的内存块从此下标开始，避免新建 arena 时逐个拆分
+    uint32_t unused_idx;
 };
 
 // 内核内存块描述符数组
 struct mem_block_desc k_block_descs[DESC_CNT];
+// 按 16 字节粒度把 1~1024 字节的申请大小直接映射到内存块规格的下标
+static uint8_t size_class_table[1024 / 16];
+// 申请大小 size 对应的内存块规格下标，size 的范围为 1~1024
+#define SIZE_TO_DESC_IDX(size) (size_class_table[((size) - 1) / 16])
 // 生成内核内存池和用户内存池
 struct pool kernel_pool, user_pool;
 // 此结构用来给内核分配虚拟地址
 struct virtual_addr kernel_vaddr;
+// 页框描述符数组，以物理页框号为下标，覆盖 [0, page_desc_cnt) 的全部页框，包括其中的空洞
+static struct page* page_descs;
+static uint32_t page_desc_cnt;
+// 两个内存池管理的页框总数
+static uint32_t total_frames;
+// idle 线程清零物理页时临时映射用的内核虚拟页
+static uint32_t zero_scratch_vaddr;
+// 写时复制时临时映射新页框用的内核虚拟地址
+static uint32_t copy_scratch_vaddr;
+// 页面回收时临时映射其它进程的页表用的内核虚拟地址
+static uint32_t pt_scratch_vaddr;
+// 换入换出时临时映射页框用的内核虚拟地址，读写硬盘期间一直占用，由 swap_lock 保护
+static uint32_t swap_scratch_vaddr;
+// 换入换出互斥，换出的页面写完之前其所有者的换入须等待
+static struct lock swap_lock;
+// 页面回收的时钟指针，指向下次从哪个进程的哪个虚拟地址开始扫描
+static pid_t clock_pid;
+static uint32_t clock_vaddr;
+// 全 0 的共享页框，bss 页首次读取时映射到这里，写入时再复制
+static uint32_t zero_page_phyaddr;
+
+// 内核空间页目录项的权威来源
+// 启用 4M 大页后，内核页表按需创建，新建的页目录项先写入主页目录，其它页目录在缺页时再同步
+// 未启用时 loader 已建好全部内核页表，各页目录的内核部分完全相同，直接使用当前页目录即可
+uint32_t* kernel_page_dir = (uint32_t*)0xfffff000;
+// 是否已用 4M 大页映射内核的低端 4M
+static bool kernel_large_page;
 
 /**
  * @brief 在 pf 表示的虚拟内存池中申请 pg_cnt 个虚拟页
@@ -91,17 +208,12 @@ static void* vaddr_get(enum pool_flags pf, uint32_t pg_cnt) {
         vaddr_start = kernel_vaddr.vaddr_start + bit_idx_start * PAGE_SIZE;
     } else { // 用户内存池
         struct task_struct* cur = running_thread();
-        bit_idx_start = bitmap_scan(&cur->user_process_vaddr.vaddr_bitmap, pg_cnt);
-        if (bit_idx_start == -1) {
+        // 在程序段与堆之间首次适配一段空闲地址，作为匿名区域加入进程的地址空间
+        vaddr_start = vma_get_unmapped(&cur->user_vm, pg_cnt * PAGE_SIZE, USER_VADDR_START, USER_HEAP_START);
+        if (vaddr_start == 0 || \
+            !vma_map(&cur->user_vm, vaddr_start, vaddr_start + pg_cnt * PAGE_SIZE, VMA_ANON)) {
             return NULL;
         }
-        for (; cnt < pg_cnt;) {
-            bitmap_set(&cur->user_process_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 1);
-        }
-        vaddr_start = cur->user_process_vaddr.vaddr_start + bit_idx_start * PAGE_SIZE;
-        // (0xc0000000 - PAGE_SIZE) 作为用户 3 级栈已经在 start_process 被分配
-        ASSERT((uint32_t)vaddr_start < (0xc0000000 - PAGE_SIZE));
-
     }
     return (void*)vaddr_start;
 }
@@ -132,14 +244,434 @@ uint32_t* pde_ptr(uint32_t vaddr) {
     return pde;
 }
 
+/**
+ * @brief 返回物理地址 pg_phy_addr 所在页框的描述符
+ * 
+ * @param pg_phy_addr 
+ * @return struct page* 
+ */
+static struct page* phy_to_page(uint32_t pg_phy_addr) {
+    uint32_t pfn = pg_phy_addr / PAGE_SIZE;
+    ASSERT(pfn < page_desc_cnt);
+    return &page_descs[pfn];
+}
+
+/**
+ * @brief 返回当前拥有页框 pg 的内存池
+ * 
+ * @param pg 
+ * @return struct pool* 
+ */
+static struct pool* page_pool(struct page* pg) {
+    ASSERT(pg->pool_idx == POOL_KERNEL || pg->pool_idx == POOL_USER);
+    return pg->pool_idx == POOL_KERNEL ? &kernel_pool : &user_pool;
+}
+
+/**
+ * @brief 返回能容纳 pg_cnt 个页的最小阶
+ * 
+ * @param pg_cnt 
+ * @return uint32_t 
+ */
+static uint32_t pages_to_order(uint32_t pg_cnt) {
+    uint32_t order = 0;
+    while ((1U << order) < pg_cnt) {
+        order++;
+    }
+    return order;
+}
+
+/**
+ * @brief 将从第 page_idx 个页框起的 2^order 页归还给伙伴系统
+ *        若其伙伴块也空闲，则合并成更高阶的块，直到无法合并为止
+ * 
+ * @param m_pool 
+ * @param page_idx 
+ * @param order 
+ */
+static void buddy_free(struct pool* m_pool, uint32_t page_idx, uint32_t order) {
+    enum intr_status old_status = intr_disable();
+    while (order < MAX_ORDER - 1) {
+        uint32_t buddy_idx = page_idx ^ (1U << order);
+        // 伙伴块超出描述符数组，或者伙伴块不是本内存池同阶的空闲块，就不能合并
+        if (buddy_idx >= page_desc_cnt || page_descs[buddy_idx].order != (int8_t)order || \
+            page_descs[buddy_idx].pool_idx != m_pool->pool_idx) {
+            break;
+        }
+        list_remove(&page_descs[buddy_idx].free_tag);
+        m_pool->free_area[order].nr_free--;
+        page_descs[buddy_idx].order = PAGE_ORDER_NONE;
+        // 合并后的块以两者中较低的地址为首页
+        page_idx &= ~(1U << order);
+        order++;
+    }
+    page_descs[page_idx].order = order;
+    list_push(&m_pool->free_area[order].free_list, &page_descs[page_idx].free_tag);
+    m_pool->free_area[order].nr_free++;
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 将页下标区间 [start, end) 拆分成若干对齐的块归还给伙伴系统
+ * 
+ * @param m_pool 
+ * @param start 
+ * @param end 
+ */
+static void buddy_free_range(struct pool* m_pool, uint32_t start, uint32_t end) {
+    while (start < end) {
+        uint32_t order = 0;
+        // 在 start 的对齐范围内取尽可能大的块
+        while (order < MAX_ORDER - 1 && (start & ((1U << (order + 1)) - 1)) == 0 && \
+            start + (1U << (order + 1)) <= end) {
+            order++;
+        }
+        buddy_free(m_pool, start, order);
+        start += 1U << order;
+    }
+}
+
+/**
+ * @brief 从伙伴系统中申请一个 2^order 页的块
+ *        若该阶没有空闲块，则从更高阶拆分，多余的一半挂到低一阶的链表上
+ * 
+ * @param m_pool 
+ * @param order 
+ * @return int32_t 成功返回块首页的下标，失败返回 -1
+ */
+static int32_t buddy_alloc(struct pool* m_pool, uint32_t order) {
+    enum intr_status old_status = intr_disable();
+    uint32_t cur_order = order;
+    while (cur_order < MAX_ORDER && list_empty(&m_pool->free_area[cur_order].free_list)) {
+        cur_order++;
+    }
+    if (cur_order == MAX_ORDER) {
+        intr_set_status(old_status);
+        return -1;
+    }
+    struct page* pg = elem2entry(struct page, free_tag, list_pop(&m_pool->free_area[cur_order].free_list));
+    m_pool->free_area[cur_order].nr_free--;
+    pg->order = PAGE_ORDER_NONE;
+    uint32_t page_idx = pg - page_descs;
+    // 逐阶拆分，把高地址的一半留在伙伴系统中
+    while (cur_order > order) {
+        cur_order--;
+        struct page* buddy = &page_descs[page_idx + (1U << cur_order)];
+        buddy->order = cur_order;
+        list_push(&m_pool->free_area[cur_order].free_list, &buddy->free_tag);
+        m_pool->free_area[cur_order].nr_free++;
+    }
+    intr_set_status(old_status);
+    return page_idx;
+}
+
+/**
+ * @brief 取出一个预先清零的物理页
+ * 
+ * @param m_pool 
+ * @return uint32_t 物理页地址，没有时返回 0
+ */
+static uint32_t zeroed_frame_pop(struct pool* m_pool) {
+    uint32_t page_phyaddr = 0;
+    enum intr_status old_status = intr_disable();
+    if (m_pool->zeroed_cnt > 0) {
+        page_phyaddr = m_pool->zeroed_frames[--m_pool->zeroed_cnt];
+    }
+    intr_set_status(old_status);
+    return page_phyaddr;
+}
+
+/**
+ * @brief m_pool 中没有 2^order 页的空闲块时，从另一个内存池借一块过来
+ *        先尽量借大块以减少借用次数，借不到时逐阶降低，直到所需的阶
+ *        调用者需关中断
+ * 
+ * @param m_pool 
+ * @param order 
+ * @return bool 
+ */
+static bool pool_borrow(struct pool* m_pool, uint32_t order) {
+    struct pool* lender = m_pool == &kernel_pool ? &user_pool : &kernel_pool;
+    uint32_t lend_order = order > POOL_LEND_ORDER ? order : POOL_LEND_ORDER;
+    int32_t page_idx = buddy_alloc(lender, lend_order);
+    while (page_idx == -1 && lend_order > order) {
+        page_idx = buddy_alloc(lender, --lend_order);
+    }
+    if (page_idx == -1) {
+        return false;
+    }
+    uint32_t lend_cnt = 1U << lend_order;
+    uint32_t idx;
+    for (idx = page_idx; idx < page_idx + lend_cnt; idx++) {
+        page_descs[idx].pool_idx = m_pool->pool_idx;
+    }
+    lender->pages_cnt -= lend_cnt;
+    m_pool->pages_cnt += lend_cnt;
+    buddy_free_range(m_pool, page_idx, page_idx + lend_cnt);
+    return true;
+}
+
+/**
+ * @brief m_pool 的伙伴系统中是否还有空闲块
+ * 
+ * @param m_pool 
+ * @return bool 
+ */
+static bool pool_has_free(struct pool* m_pool) {
+    uint32_t order;
+    for (order = 0; order < MAX_ORDER; order++) {
+        if (!list_empty(&m_pool->free_area[order].free_list)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 在 m_pool 指向的物理内存池中申请物理上连续的 pg_cnt 个物理页
+ *        成功则返回起始物理地址，失败则返回 NULL
+ *        申请到的块中超出 pg_cnt 的尾部会立即归还，因此每一页都可以单独 pfree
+ * 
+ * @param m_pool 
+ * @param pg_cnt 
+ * @return void* 
+ */
+static void* palloc_pages(struct pool* m_pool, uint32_t pg_cnt) {
+    uint32_t order = pages_to_order(pg_cnt);
+    if (order >= MAX_ORDER) {
+        return NULL;
+    }
+    // idle 线程不持有内存池的锁也会申请物理页，所以这里关中断
+    enum intr_status old_status = intr_disable();
+    int32_t page_idx = buddy_alloc(m_pool, order);
+    if (page_idx == -1) {
+        // 伙伴系统已耗尽时，预先清零的物理页也可以拿来用
+        uint32_t page_phyaddr = pg_cnt == 1 ? zeroed_frame_pop(m_pool) : 0;
+        if (page_phyaddr != 0) {
+            intr_set_status(old_status);
+            return (void*)page_phyaddr;
+        }
+        // 再向另一个内存池借用
+        if (pool_borrow(m_pool, order)) {
+            page_idx = buddy_alloc(m_pool, order);
+        }
+        if (page_idx == -1) {
+            intr_set_status(old_status);
+            return NULL;
+        }
+    }
+    buddy_free_range(m_pool, page_idx + pg_cnt, page_idx + (1U << order));
+    // 交叉校验伙伴系统没有重复分配
+    uint32_t idx;
+    for (idx = page_idx; idx < page_idx + pg_cnt; idx++) {
+        ASSERT(!page_descs[idx].allocated);
+        page_descs[idx].allocated = 1;
+    }
+    intr_set_status(old_status);
+    return (void*)(page_idx * PAGE_SIZE);
+}
+
+/**
+ * @brief 在 m_pool 指向的物理内存池中申请 1 个物理页
+ * 
+ * @param m_pool 
+ * @return void* 
+ */
 static void* palloc(struct pool* m_pool) {
-    int bit_idx = bitmap_scan(&m_pool->pool_bitmap, 1);
-    if (bit_idx == -1) {
+    return palloc_pages(m_pool, 1);
+}
+
+/**
+ * @brief 在进程 task 的 [from, to) 中按时钟算法寻找可换出的页面
+ *        访问位为 1 的页面清除访问位、给第二次机会，遇到第一个访问位为 0 的页面即选中
+ *        只换出独占且可写的页面，写时复制共享的页面、全 0 页框和被钉住的页面不换出
+ *        调用者需关中断
+ * 
+ * @param task 
+ * @param from 
+ * @param to 
+ * @param victim_vaddr 选中页面的虚拟地址
+ * @return uint32_t* 选中页面的页表项，经 pt_scratch_vaddr 访问；没有时返回 NULL
+ */
+static uint32_t* clock_scan(struct task_struct* task, uint32_t from, uint32_t to, uint32_t* victim_vaddr) {
+    struct vm_area* area = vma_first(&task->user_vm);
+    uint32_t* pt = (uint32_t*)pt_scratch_vaddr;
+    uint32_t mapped_pde = 0;
+    for (; area != NULL && area->start < to; area = vma_next(&task->user_vm, area)) {
+        uint32_t vaddr = area->start > from ? area->start : from;
+        uint32_t end = area->end < to ? area->end : to;
+        for (; vaddr < end; vaddr += PAGE_SIZE) {
+            uint32_t pde = task->pg_dir[PDE_IDX(vaddr)];
+            // 整个页表都不存在时跳到下一个 4M 区域
+            if (!(pde & PG_P_1)) {
+                vaddr = (vaddr | 0x003fffff) + 1 - PAGE_SIZE;
+                continue;
+            }
+            // 页表所在的页框可能不属于当前进程，临时映射后访问
+            if ((pde & 0xfffff000) != mapped_pde) {
+                mapped_pde = pde & 0xfffff000;
+                *pte_ptr(pt_scratch_vaddr) = mapped_pde | PG_US_S | PG_RW_W | PG_P_1;
+                asm volatile("invlpg %0" :: "m" (*(char*)pt_scratch_vaddr) : "memory");
+            }
+            uint32_t* pte = &pt[PTE_IDX(vaddr)];
+            if ((*pte & (PG_P_1 | PG_RW_W | PG_COW)) != (PG_P_1 | PG_RW_W) || \
+                phy_to_page(*pte & 0xfffff000)->share_cnt != 0 || \
+                phy_to_page(*pte & 0xfffff000)->pin_cnt != 0) {
+                continue;
+            }
+            if (*pte & PG_A) {
+                *pte &= ~PG_A;
+                // task 的页表可能正是当前页目录所用的，TLB 中的表项要失效，下次访问才会重新置位访问位
+                asm volatile("invlpg %0" :: "m" (*(char*)vaddr) : "memory");
+                continue;
+            }
+            *victim_vaddr = vaddr;
+            return pte;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 从时钟指针处开始依次扫描全部用户进程，选出一个要换出的页面
+ *        第一圈清除访问位，第二圈必能选中扫描过的页面，除非没有可换出的页面
+ *        调用者需关中断
+ * 
+ * @param victim 选中页面所属的进程
+ * @param victim_vaddr 
+ * @return uint32_t* 选中页面的页表项，没有时返回 NULL
+ */
+static uint32_t* clock_select(struct task_struct** victim, uint32_t* victim_vaddr) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (list_empty(&thread_all_list)) {
         return NULL;
     }
-    bitmap_set(&m_pool->pool_bitmap, bit_idx, 1);
-    uint32_t page_phyaddr = ((bit_idx * PAGE_SIZE) + m_pool->phy_addr_start);
-    return (void*)page_phyaddr;
+    // 找到时钟指针所在的进程，该进程已不存在时从头开始
+    struct task_struct* hand = NULL;
+    struct list_elem* elem = thread_all_list.head.next;
+    for (; elem != &thread_all_list.tail; elem = elem->next) {
+        struct task_struct* task = elem2entry(struct task_struct, all_list_tag, elem);
+        if (task->pid == clock_pid) {
+            hand = task;
+            break;
+        }
+    }
+    if (hand == NULL) {
+        hand = elem2entry(struct task_struct, all_list_tag, thread_all_list.head.next);
+        clock_vaddr = 0;
+    }
+    uint32_t round;
+    uint32_t* pte = NULL;
+    for (round = 0; round < 2 && pte == NULL; round++) {
+        struct task_struct* task = hand;
+        uint32_t from = clock_vaddr;
+        do {
+            if (task->pg_dir != NULL) {
+                pte = clock_scan(task, from, 0xc0000000, victim_vaddr);
+                if (pte != NULL) {
+                    *victim = task;
+                    break;
+                }
+            }
+            from = 0;
+            elem = task->all_list_tag.next == &thread_all_list.tail ? \
+                thread_all_list.head.next : task->all_list_tag.next;
+            task = elem2entry(struct task_struct, all_list_tag, elem);
+        } while (task != hand);
+        // 最后扫描时钟指针所在进程中指针之前的部分
+        if (pte == NULL && hand->pg_dir != NULL && clock_vaddr != 0) {
+            pte = clock_scan(hand, 0, clock_vaddr, victim_vaddr);
+            if (pte != NULL) {
+                *victim = hand;
+            }
+        }
+    }
+    if (pte != NULL) {
+        clock_pid = (*victim)->pid;
+        clock_vaddr = *victim_vaddr + PAGE_SIZE;
+    }
+    return pte;
+}
+
+/**
+ * @brief 换出一个用户页面，其页框归还给用户内存池
+ *        会读写硬盘而睡眠，不能在 idle 线程中调用
+ * 
+ * @return bool 没有交换区、交换区已满或没有可换出的页面时返回 false
+ */
+static bool swap_out_page(void) {
+    lock_acquire(&swap_lock);
+    int32_t slot = swap_slot_alloc();
+    if (slot == -1) {
+        lock_release(&swap_lock);
+        return false;
+    }
+    enum intr_status old_status = intr_disable();
+    struct task_struct* victim;
+    uint32_t victim_vaddr;
+    uint32_t* pte = clock_select(&victim, &victim_vaddr);
+    if (pte == NULL) {
+        intr_set_status(old_status);
+        swap_slot_free(slot);
+        lock_release(&swap_lock);
+        return false;
+    }
+    // 先把页表项改为交换槽号，写盘期间所有者访问此页会在换入时等待 swap_lock
+    uint32_t page_phyaddr = *pte & 0xfffff000;
+    *pte = ((uint32_t)slot << 12) | PG_SWAP;
+    asm volatile("invlpg %0" :: "m" (*(char*)victim_vaddr) : "memory");
+    *pte_ptr(pt_scratch_vaddr) = 0;
+    asm volatile("invlpg %0" :: "m" (*(char*)pt_scratch_vaddr) : "memory");
+    *pte_ptr(swap_scratch_vaddr) = page_phyaddr | PG_US_S | PG_RW_W | PG_P_1;
+    asm volatile("invlpg %0" :: "m" (*(char*)swap_scratch_vaddr) : "memory");
+    intr_set_status(old_status);
+
+    swap_write(slot, (void*)swap_scratch_vaddr);
+    *pte_ptr(swap_scratch_vaddr) = 0;
+    asm volatile("invlpg %0" :: "m" (*(char*)swap_scratch_vaddr) : "memory");
+    pfree(page_phyaddr);
+    lock_release(&swap_lock);
+    return true;
+}
+
+/**
+ * @brief 为用户页申请一个页框，用户内存池和内核内存池都没有空闲页框时换出页面腾出页框
+ *        可能睡眠，不能在 idle 线程中调用
+ * 
+ * @return uint32_t 页框的物理地址，失败返回 0
+ */
+static uint32_t user_frame_alloc(void) {
+    uint32_t page_phyaddr = (uint32_t)palloc(&user_pool);
+    while (page_phyaddr == 0 && swap_out_page()) {
+        page_phyaddr = (uint32_t)palloc(&user_pool);
+    }
+    return page_phyaddr;
+}
+
+/* 为虚拟地址vaddr所在的4M区域创建页表,要求其页目录项尚不存在 */
+static void page_table_create(uint32_t vaddr) {
+   uint32_t* pde = pde_ptr(vaddr);
+   uint32_t* pte = pte_ptr(vaddr);
+   /* 页表中用到的页框一律从内核空间分配,优先用预先清零的页 */
+   uint32_t pde_phyaddr = zeroed_frame_pop(&kernel_pool);
+   bool need_zero = (pde_phyaddr == 0);
+   if (need_zero) {
+      pde_phyaddr = (uint32_t)palloc(&kernel_pool);
+   }
+   ASSERT(pde_phyaddr != 0);
+
+   /* 内核堆的页表都在启动时建好,这里只会为用户空间创建页表 */
+   ASSERT(vaddr < 0xc0000000);
+   *pde = (pde_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+
+   /* 分配到的物理页地址pde_phyaddr对应的物理内存清0,
+    * 避免里面的陈旧数据变成了页表项,从而让页表混乱.
+    * 访问到pde对应的物理地址,用pte取高20位便可.
+    * 因为pte是基于该pde对应的物理地址内再寻址,
+    * 把低12位置0便是该pde对应的物理页的起始*/
+   if (need_zero) {
+      memset((void*)((int)pte & 0xfffff000), 0, PAGE_SIZE);
+   }
 }
 
 /* 页表中添加虚拟地址_vaddr与物理地址_page_phyaddr的映射 */
@@ -147,6 +679,11 @@ static void page_table_add(void* _vaddr, void* _page_phyaddr) {
    uint32_t vaddr = (uint32_t)_vaddr, page_phyaddr = (uint32_t)_page_phyaddr;
    uint32_t* pde = pde_ptr(vaddr);
    uint32_t* pte = pte_ptr(vaddr);
+   /* 内核空间的映射在所有进程中都相同,标记为全局页,切换进程时保留在 TLB 中 */
+   uint32_t pte_attr = PG_US_U | PG_RW_W | PG_P_1;
+   if (vaddr >= 0xc0000000) {
+      pte_attr |= PG_G;
+   }
 
 /************************   注意   *************************
  * 执行*pte,会访问到空的pde。所以确保pde创建完成后才能执行*pte,
@@ -157,26 +694,15 @@ static void page_table_add(void* _vaddr, void* _page_phyaddr) {
       ASSERT(!(*pte & 0x00000001));
 
       if (!(*pte & 0x00000001)) {   // 只要是创建页表,pte就应该不存在,多判断一下放心
-	 *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);    // US=1,RW=1,P=1
+	 *pte = (page_phyaddr | pte_attr);    // US=1,RW=1,P=1
       } else {			    //应该不会执行到这，因为上面的ASSERT会先执行。
 	 PANIC("pte repeat");
-	 *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);      // US=1,RW=1,P=1
+	 *pte = (page_phyaddr | pte_attr);      // US=1,RW=1,P=1
       }
    } else {			    // 页目录项不存在,所以要先创建页目录再创建页表项.
-      /* 页表中用到的页框一律从内核空间分配 */
-      uint32_t pde_phyaddr = (uint32_t)palloc(&kernel_pool);
-
-      *pde = (pde_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
-
-      /* 分配到的物理页地址pde_phyaddr对应的物理内存清0,
-       * 避免里面的陈旧数据变成了页表项,从而让页表混乱.
-       * 访问到pde对应的物理地址,用pte取高20位便可.
-       * 因为pte是基于该pde对应的物理地址内再寻址,
-       * 把低12位置0便是该pde对应的物理页的起始*/
-      memset((void*)((int)pte & 0xfffff000), 0, PAGE_SIZE);
-         
+      page_table_create(vaddr);
       ASSERT(!(*pte & 0x00000001));
-      *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);      // US=1,RW=1,P=1
+      *pte = (page_phyaddr | pte_attr);      // US=1,RW=1,P=1
    }
 }
 
@@ -196,6 +722,17 @@ void* malloc_page(enum pool_flags pf, uint32_t pg_cnt) {
    uint32_t vaddr = (uint32_t)vaddr_start, cnt = pg_cnt;
    struct pool* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
 
+   /* 优先申请物理上连续的pg_cnt页,伙伴系统中没有足够大的块时再逐页申请 */
+   uint32_t page_phyaddr = (uint32_t)palloc_pages(mem_pool, pg_cnt);
+   if (page_phyaddr != 0) {
+      while (cnt-- > 0) {
+	 page_table_add((void*)vaddr, (void*)page_phyaddr);
+	 vaddr += PAGE_SIZE;
+	 page_phyaddr += PAGE_SIZE;
+      }
+      return vaddr_start;
+   }
+
    /* 因为虚拟地址是连续的,但物理地址可以是不连续的,所以逐个做映射*/
    while (cnt-- > 0) {
       void* page_phyaddr = palloc(mem_pool);
@@ -208,13 +745,37 @@ void* malloc_page(enum pool_flags pf, uint32_t pg_cnt) {
    return vaddr_start;
 }
 
+/**
+ * @brief 申请 pg_cnt 页已清零的内存，调用者需持有内存池的锁
+ *        单页申请优先使用 idle 线程预先清零的物理页，省去临界路径上的 memset
+ * 
+ * @param pf 
+ * @param pg_cnt 
+ * @return void* 
+ */
+static void* malloc_zeroed_page(enum pool_flags pf, uint32_t pg_cnt) {
+    struct pool* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+    uint32_t page_phyaddr = pg_cnt == 1 ? zeroed_frame_pop(mem_pool) : 0;
+    if (page_phyaddr == 0) {
+        void* vaddr = malloc_page(pf, pg_cnt);
+        if (vaddr != NULL) {	   // 若分配的地址不为空,将页框清0后返回
+            memset(vaddr, 0, pg_cnt * PAGE_SIZE);
+        }
+        return vaddr;
+    }
+    void* vaddr = vaddr_get(pf, 1);
+    if (vaddr == NULL) {
+        pfree(page_phyaddr);
+        return NULL;
+    }
+    page_table_add(vaddr, (void*)page_phyaddr);
+    return vaddr;
+}
+
 /* 从内核物理内存池中申请pg_cnt页内存,成功则返回其虚拟地址,失败则返回NULL */
 void* get_kernel_pages(uint32_t pg_cnt) {
     lock_acquire(&kernel_pool.lock);
-    void* vaddr =  malloc_page(PF_KERNEL, pg_cnt);
-    if (vaddr != NULL) {	   // 若分配的地址不为空,将页框清0后返回
-        memset(vaddr, 0, pg_cnt * PAGE_SIZE);
-    }
+    void* vaddr = malloc_zeroed_page(PF_KERNEL, pg_cnt);
     lock_release(&kernel_pool.lock);
     return vaddr;
 }
@@ -227,16 +788,52 @@ void* get_kernel_pages(uint32_t pg_cnt) {
  */
 void* get_user_pages(uint32_t pg_cnt) {
     lock_acquire(&user_pool.lock);
-    void* vaddr = malloc_page(PF_USER, pg_cnt);
-    if (vaddr != NULL) {
-        memset(vaddr, 0, pg_cnt * PAGE_SIZE);
-    }
+    void* vaddr = malloc_zeroed_page(PF_USER, pg_cnt);
     lock_release(&user_pool.lock);
     return vaddr;
 }
 
 /**
- * @brief 将地址 vaddr 与 pf 池中的物理地址关联
+ * @brief 从 mem_pool 中分配一页物理内存映射到 vaddr，并保证页面内容全为 0
+ * 
+ * @param mem_pool 
+ * @param vaddr 
+ * @return bool 
+ */
+static bool page_alloc_map(struct pool* mem_pool, uint32_t vaddr) {
+    uint32_t page_phyaddr = zeroed_frame_pop(mem_pool);
+    bool need_zero = (page_phyaddr == 0);
+    if (need_zero) {
+        page_phyaddr = mem_pool == &user_pool ? user_frame_alloc() : (uint32_t)palloc(mem_pool);
+        if (page_phyaddr == 0) {
+            return false;
+        }
+    }
+    page_table_add((void*)vaddr, (void*)page_phyaddr);
+    if (need_zero) {
+        memset((void*)vaddr, 0, PAGE_SIZE);
+    }
+    return true;
+}
+
+/**
+ * @brief 按地址范围推断用户虚拟地址 vaddr 所属区域的用途
+ * 
+ * @param vaddr 
+ * @return uint32_t 
+ */
+static uint32_t user_vaddr_flags(uint32_t vaddr) {
+    if (vaddr >= USER_STACK_LIMIT) {
+        return VMA_STACK;
+    }
+    if (vaddr >= USER_HEAP_START && vaddr < USER_HEAP_END) {
+        return VMA_HEAP;
+    }
+    return VMA_ANON;
+}
+
+/**
+ * @brief 将地址 vaddr 与 pf 池中的物理地址关联，页面内容已清零
  *        仅支持一页空间分配
  * 
  * @param pf 
@@ -245,16 +842,21 @@ void* get_user_pages(uint32_t pg_cnt) {
  */
 void* get_a_page(enum pool_flags pf, uint32_t vaddr) {
     struct pool* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
-    lock_acquire(&mem_pool->lock);
-    // 先将虚拟地址对应的位图置 1
     struct task_struct* cur = running_thread();
     int32_t bit_idx = -1;
-    // 若当前是用户进程申请用户内存，就修改用户进程自己的虚拟地址位图
+    bool vma_added = false;
+    // 若当前是用户进程申请用户内存，vaddr 不在已有区域中时为其新建区域
+    // 区域的分配可能用到内核内存池，所以在持有用户内存池的锁之前完成
     if (cur->pg_dir != NULL && pf == PF_USER) {
-        bit_idx = (vaddr - cur->user_process_vaddr.vaddr_start) / PAGE_SIZE;
-        ASSERT(bit_idx > 0);
-        bitmap_set(&cur->user_process_vaddr.vaddr_bitmap, bit_idx, 1);
+        if (vma_find(&cur->user_vm, vaddr) == NULL) {
+            if (!vma_map(&cur->user_vm, vaddr, vaddr + PAGE_SIZE, user_vaddr_flags(vaddr))) {
+                return NULL;
+            }
+            vma_added = true;
+        }
+        lock_acquire(&mem_pool->lock);
     } else if (cur->pg_dir == NULL && pf == PF_KERNEL) {
+        lock_acquire(&mem_pool->lock);
         // 如果是内核线程申请内核内存,就修改kernel_vaddr.
         bit_idx = (vaddr - kernel_vaddr.vaddr_start) / PAGE_SIZE;
         ASSERT(bit_idx > 0);
@@ -262,18 +864,25 @@ void* get_a_page(enum pool_flags pf, uint32_t vaddr) {
     } else {
         PANIC("get_a_page:not allow kernel alloc userspace or user alloc kernel space by get_a_page");
     }
-    void* page_phyaddr = palloc(mem_pool);
-    if (page_phyaddr == NULL) {
+    if (!page_alloc_map(mem_pool, vaddr)) {
+        // 撤销虚拟地址的占用
+        if (pf == PF_KERNEL) {
+            bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx, 0);
+        }
+        lock_release(&mem_pool->lock);
+        // 撤销不了时这一页只是仍被预留, 没有映射页框
+        if (vma_added && !vma_unmap(&cur->user_vm, vaddr, vaddr + PAGE_SIZE)) {
+            printk("get_a_page: no memory to split vm_area\n");
+        }
         return NULL;
     }
-    page_table_add((void*)vaddr, page_phyaddr);
     lock_release(&mem_pool->lock);
     return (void*)vaddr;
 }
 
 /**
- * @brief 安装一页大小的 vaddr
- *        专门针对 fork 时虚拟地址位图无须操作的情况
+ * @brief 安装一页大小的 vaddr，页面内容已清零
+ *        专门针对虚拟地址位图无须操作的情况，如按需加载已在位图中预留的页
  * @param pf 
  * @param vaddr 
  * @return void* 
@@ -281,12 +890,10 @@ void* get_a_page(enum pool_flags pf, uint32_t vaddr) {
 void* get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr) {
     struct pool* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
     lock_acquire(&mem_pool->lock);
-    void* page_phyaddr = palloc(mem_pool);
-    if (page_phyaddr == NULL) {
+    if (!page_alloc_map(mem_pool, vaddr)) {
         lock_release(&mem_pool->lock);
         return NULL;
     }
-    page_table_add((void*)vaddr, page_phyaddr);
     lock_release(&mem_pool->lock);
     return (void*)vaddr;
 }
@@ -298,6 +905,11 @@ void* get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr) {
  * @return uint32_t 
  */
 uint32_t addr_v2p(uint32_t vaddr) {
+    // 4M 大页没有页表，物理地址直接由页目录项的高 10 位与虚拟地址的低 22 位组成
+    uint32_t pde = *pde_ptr(vaddr);
+    if (pde & PG_PS) {
+        return (pde & 0xffc00000) + (vaddr & 0x003fffff);
+    }
     uint32_t* pte = pte_ptr(vaddr);
     // (*pte)的值是页表所在的物理页框地址,
     // 去掉其低12位的页表项属性+虚拟地址vaddr的低12位 */
@@ -305,111 +917,285 @@ uint32_t addr_v2p(uint32_t vaddr) {
 }
 
 /**
- * @brief 初始化内存池
+ * @brief 从 loader 保存的 e820 内存布局中收集可用的物理内存
+ *        超出 32 位物理地址空间的部分被截掉，BIOS 不支持 e820 时把 [0, all_mem) 视为一整段
  * 
- * @param all_mem 
+ * @param ranges 
+ * @param all_mem loader 计算出的内存容量
+ * @return uint32_t 可用内存的段数
  */
-static void mem_pool_init(uint32_t all_mem) {
-    put_str("mem_pool_init start\n");
-    // 页表大小 = 1页的页目录表 + 第 0 和第 768 个页目录项指向同一个页表 + 第 769 - 1022 个页目录项共指向 254 个页表
-    // 一共 256 个页面
-    uint32_t page_table_size = PAGE_SIZE * 256;
-    // 0x100000 为低端 1MB 内存
-    uint32_t used_mem = page_table_size + 0x100000;
-    uint32_t free_mem = all_mem - used_mem;
-    // 1 页为 4KB，不管总内存是不是 4K 的倍数
-    // 对于以页为单位的内存分配策略，不足 1 页的内存不用考虑
-    uint16_t all_free_pages = free_mem / PAGE_SIZE;
-    uint16_t kernel_free_pages = all_free_pages / 2;
-    uint16_t user_free_pages = all_free_pages - kernel_free_pages;
-
-    // 为了简化位图操作，余数不做处理，可能会导致丢内存。但是不用做内存的越界检查，因为位图表示的内存少于实际物理内存
-    // kernel bitmap 的长度，位图中一位表示一页，以字节为单位
-    uint32_t kbm_length = kernel_free_pages / 8;
-    // user bitmap 的长度
-    uint32_t ubm_length = user_free_pages / 8;
-
-    // kernel pool start, 内核内存池的起始地址
-    uint32_t kp_start = used_mem;
-    // user pool start, 用户内存池的起始地址
-    uint32_t up_start = kp_start + kernel_free_pages * PAGE_SIZE;
-
-    kernel_pool.phy_addr_start = kp_start;
-    user_pool.phy_addr_start = up_start;
-    kernel_pool.pool_size = kernel_free_pages * PAGE_SIZE;
-    user_pool.pool_size = user_free_pages * PAGE_SIZE;
-    kernel_pool.pool_bitmap.bmap_bytes_len = kbm_length;
-    user_pool.pool_bitmap.bmap_bytes_len = ubm_length;
-
-    kernel_pool.pool_bitmap.bits = (void*)MEM_BITMAP_BASE;
-    user_pool.pool_bitmap.bits = (void*)(MEM_BITMAP_BASE + kbm_length);
-
-    // put_str("kernel_pool_bitmap_start:");
-    // put_int((int)kernel_pool.pool_bitmap.bits);
-    // put_str("  kernel_pool_phy_addr_start:");
-    // put_int(kernel_pool.phy_addr_start);
-    // put_str("\n");
-    // put_str("user_pool_bitmap_start:");
-    // put_int((int)user_pool.pool_bitmap.bits);
-    // put_str("  user_pool_phy_addr_start:");
-    // put_int(user_pool.phy_addr_start);
-    // put_str("\n");
-
-    // 将位图置 0
-    bitmap_init(&kernel_pool.pool_bitmap);
-    bitmap_init(&user_pool.pool_bitmap);
-
-    lock_init(&kernel_pool.lock);
-    lock_init(&user_pool.lock);
-
-    kernel_vaddr.vaddr_bitmap.bmap_bytes_len = kbm_length;
-    kernel_vaddr.vaddr_bitmap.bits = (void*)(MEM_BITMAP_BASE + kbm_length + ubm_length);
-    kernel_vaddr.vaddr_start = K_HEAP_START;
-
-    put_str("kernel_vaddr.vaddr_bitmap.bits: ");
-    put_int((int)kernel_vaddr.vaddr_bitmap.bits);
-    put_str("\n");
-
-    put_str("kernel_vaddr.vaddr_bitmap.bmap_bytes_len :");
-    put_int(kernel_vaddr.vaddr_bitmap.bmap_bytes_len);
-    put_str("\n");
-
-    put_str("kernel_vaddr.vaddr_start:");
-    put_int(kernel_vaddr.vaddr_start);
-    put_str("\n");
+static uint32_t e820_collect(struct mem_range* ranges, uint32_t all_mem) {
+    uint32_t ards_nr = *(uint16_t*)ARDS_NR_ADDR;
+    struct ards* ards = (struct ards*)ARDS_BUF_ADDR;
+    uint32_t range_cnt = 0, ards_idx;
+    if (ards_nr > ARDS_MAX) {
+        ards_nr = ARDS_MAX;
+    }
+    for (ards_idx = 0; ards_idx < ards_nr; ards_idx++, ards++) {
+        if (ards->type != ARDS_TYPE_USABLE || ards->base_high != 0) {
+            continue;
+        }
+        uint64_t end = (uint64_t)ards->base_low + ((uint64_t)ards->length_high << 32) + ards->length_low;
+        // 起始地址向上、结束地址向下对齐到页，不足一页的部分不用
+        uint32_t start_pfn = DIV_ROUND_UP(ards->base_low, PAGE_SIZE);
+        uint32_t end_pfn = end >= ((uint64_t)PFN_MAX << 12) ? PFN_MAX : (uint32_t)(end >> 12);
+        if (start_pfn < end_pfn) {
+            ranges[range_cnt].start_pfn = start_pfn;
+            ranges[range_cnt].end_pfn = end_pfn;
+            range_cnt++;
+        }
+    }
+    if (range_cnt == 0) {
+        ranges[0].start_pfn = 0;
+        ranges[0].end_pfn = all_mem / PAGE_SIZE;
+        range_cnt = 1;
+    }
+    return range_cnt;
+}
 
-    bitmap_init(&kernel_vaddr.vaddr_bitmap);
-    put_str("mem_pool_init done\n");
+// 启动时从可用内存中按顺序划走页框，用于页框描述符数组、内核虚拟地址位图及其页表
+// 这些页框不归入任何内存池
+static uint32_t early_pfn_next;
+static uint32_t early_pfn_end;
 
-    // asm volatile("xchg %%bx, %%bx"::);
+static uint32_t early_frame_alloc(void) {
+    if (early_pfn_next >= early_pfn_end) {
+        PANIC("early_frame_alloc: not enough memory");
+    }
+    return early_pfn_next++ * PAGE_SIZE;
 }
 
 /**
- * @brief 初始化内存块元数据
- *        因此我们的内存块规格：16，32，64，128，256，512，1024
- * @param desc_array 
+ * @brief 启动时确保内核地址 vaddr 所在的页表存在，页表所用的页框也从启动内存中划走
+ * 
+ * @param vaddr 
  */
-void block_desc_init(struct mem_block_desc* desc_array) {
-    uint16_t desc_idx, block_size = 16;
-    // 初始化每个 mem_block_desc 描述符
-    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
-        desc_array[desc_idx].block_size = block_size;
-        // 初始化 arena 中的内存块数量
-        desc_array[desc_idx].blocks_per_arena = (PAGE_SIZE - sizeof(struct arena)) / block_size;
-        list_init(&desc_array[desc_idx].free_list);
-        // 更新为下一个规格内存块
-        block_size *= 2;
+static void early_page_table(uint32_t vaddr) {
+    uint32_t* pde = pde_ptr(vaddr);
+    if (*pde & PG_P_1) {
+        return;
     }
+    *pde = early_frame_alloc() | PG_US_U | PG_RW_W | PG_P_1;
+    kernel_page_dir[PDE_IDX(vaddr)] = *pde;
+    memset((void*)((uint32_t)pte_ptr(vaddr) & 0xfffff000), 0, PAGE_SIZE);
 }
 
 /**
- * @brief 返回 arena 中第 idx 个内存块的地址
+ * @brief 启动时把从 vaddr 起的 pg_cnt 个内核虚拟页映射到启动内存中划走的页框，并清零
  * 
- * @param a 
- * @param idx 
- * @return struct mem_block* 
+ * @param vaddr 
+ * @param pg_cnt 
  */
-static struct mem_block* arena2block(struct arena* a, uint32_t idx) {
+static void early_map(uint32_t vaddr, uint32_t pg_cnt) {
+    uint32_t pg_idx;
+    for (pg_idx = 0; pg_idx < pg_cnt; pg_idx++, vaddr += PAGE_SIZE) {
+        early_page_table(vaddr);
+        *pte_ptr(vaddr) = early_frame_alloc() | PG_US_U | PG_RW_W | PG_P_1;
+        memset((void*)vaddr, 0, PAGE_SIZE);
+    }
+}
+
+/**
+ * @brief 初始化内存池
+ *        按 e820 内存布局管理全部可用物理内存，两个内存池初始各得一半，之后按需相互借用
+ * 
+ * @param all_mem 
+ */
+static void mem_pool_init(uint32_t all_mem) {
+    put_str("mem_pool_init start\n");
+    // 低端 1MB 内存 + 1页的页目录表；未启用 4M 大页时还有 loader 预建的 255 个页表
+    // 第 0 和第 768 个页目录项指向同一个页表 + 第 769 - 1022 个页目录项共指向 254 个页表
+    uint32_t page_table_size = kernel_large_page ? PAGE_SIZE : PAGE_SIZE * 256;
+    uint32_t reserved_pfn = (0x100000 + page_table_size) / PAGE_SIZE;
+
+    struct mem_range ranges[ARDS_MAX];
+    uint32_t range_cnt = e820_collect(ranges, all_mem);
+    uint32_t range_idx;
+    page_desc_cnt = 0;
+    for (range_idx = 0; range_idx < range_cnt; range_idx++) {
+        if (ranges[range_idx].end_pfn > page_desc_cnt) {
+            page_desc_cnt = ranges[range_idx].end_pfn;
+        }
+    }
+
+    // 内核堆的页表在启动时一次建好，之后内核页目录项不再变化，各进程的页目录复制它们即可共享内核页表
+    // 内核能用的页框不超过全部页框，堆的范围取其两倍，为虚拟地址的碎片留出余地
+    uint32_t avail_frames = 0;
+    for (range_idx = 0; range_idx < range_cnt; range_idx++) {
+        uint32_t start_pfn = ranges[range_idx].start_pfn < reserved_pfn ? reserved_pfn : ranges[range_idx].start_pfn;
+        if (start_pfn < ranges[range_idx].end_pfn) {
+            avail_frames += ranges[range_idx].end_pfn - start_pfn;
+        }
+    }
+    uint32_t k_heap_tables = DIV_ROUND_UP(avail_frames * 2, 1024) + 1;
+    if (k_heap_tables > (K_HEAP_END - K_HEAP_START) / 0x400000) {
+        k_heap_tables = (K_HEAP_END - K_HEAP_START) / 0x400000;
+    }
+    uint32_t k_vaddr_bytes = k_heap_tables * 1024 / 8;
+
+    // 页框描述符数组与内核虚拟地址位图（连同摘要位图）依次映射到内核堆的起始处
+    uint32_t page_desc_pages = DIV_ROUND_UP(page_desc_cnt * sizeof(struct page), PAGE_SIZE);
+    uint32_t vbm_bytes = DIV_ROUND_UP(k_vaddr_bytes, 4) * 4;
+    uint32_t vbm_pages = DIV_ROUND_UP(vbm_bytes + BITMAP_SUMMARY_BYTES(k_vaddr_bytes), PAGE_SIZE);
+    // 再之后的四页分别留给 idle 线程清零物理页、写时复制复制页框、页面回收访问页表和换入换出时临时映射
+    uint32_t early_vpages = page_desc_pages + vbm_pages + 4;
+    // 启动内存还要容纳内核堆的全部页表；未启用大页时 loader 预建的页表已覆盖整个内核堆
+    uint32_t early_pages = page_desc_pages + vbm_pages + (kernel_large_page ? k_heap_tables : 0);
+    for (range_idx = 0; range_idx < range_cnt; range_idx++) {
+        uint32_t start_pfn = ranges[range_idx].start_pfn;
+        if (start_pfn < reserved_pfn) {
+            start_pfn = reserved_pfn;
+        }
+        if (start_pfn < ranges[range_idx].end_pfn && ranges[range_idx].end_pfn - start_pfn >= early_pages) {
+            early_pfn_next = start_pfn;
+            early_pfn_end = start_pfn + early_pages;
+            break;
+        }
+    }
+    if (range_idx == range_cnt) {
+        PANIC("mem_pool_init: no room for page descriptors");
+    }
+    uint32_t early_pfn_start = early_pfn_next;
+
+    uint32_t table_idx;
+    for (table_idx = 0; table_idx < k_heap_tables; table_idx++) {
+        early_page_table(K_HEAP_START + table_idx * 0x400000);
+    }
+
+    page_descs = (struct page*)K_HEAP_START;
+    early_map(K_HEAP_START, page_desc_pages);
+    uint32_t pfn;
+    for (pfn = 0; pfn < page_desc_cnt; pfn++) {
+        page_descs[pfn].order = PAGE_ORDER_NONE;
+        page_descs[pfn].pool_idx = POOL_NONE;
+    }
+
+    kernel_vaddr.vaddr_start = K_HEAP_START;
+    kernel_vaddr.vaddr_bitmap.bmap_bytes_len = k_vaddr_bytes;
+    kernel_vaddr.vaddr_bitmap.bits = (void*)(K_HEAP_START + page_desc_pages * PAGE_SIZE);
+    // 内核虚拟地址位图的摘要位图紧跟在位图之后
+    kernel_vaddr.vaddr_bitmap.summary = (uint32_t*)(K_HEAP_START + page_desc_pages * PAGE_SIZE + vbm_bytes);
+    early_map((uint32_t)kernel_vaddr.vaddr_bitmap.bits, vbm_pages);
+    bitmap_init(&kernel_vaddr.vaddr_bitmap);
+    uint32_t pg_idx;
+    for (pg_idx = 0; pg_idx < early_vpages; pg_idx++) {
+        bitmap_set(&kernel_vaddr.vaddr_bitmap, pg_idx, 1);
+    }
+    zero_scratch_vaddr = K_HEAP_START + (page_desc_pages + vbm_pages) * PAGE_SIZE;
+    copy_scratch_vaddr = zero_scratch_vaddr + PAGE_SIZE;
+    pt_scratch_vaddr = copy_scratch_vaddr + PAGE_SIZE;
+    swap_scratch_vaddr = pt_scratch_vaddr + PAGE_SIZE;
+
+    // 统计内存池可用的页框，启动时划走的页框不算在内
+    total_frames = 0;
+    for (range_idx = 0; range_idx < range_cnt; range_idx++) {
+        for (pfn = ranges[range_idx].start_pfn; pfn < ranges[range_idx].end_pfn; pfn++) {
+            if (pfn >= reserved_pfn && (pfn < early_pfn_start || pfn >= early_pfn_next)) {
+                total_frames++;
+            }
+        }
+    }
+
+    uint32_t order;
+    for (order = 0; order < MAX_ORDER; order++) {
+        list_init(&kernel_pool.free_area[order].free_list);
+        kernel_pool.free_area[order].nr_free = 0;
+        list_init(&user_pool.free_area[order].free_list);
+        user_pool.free_area[order].nr_free = 0;
+    }
+    kernel_pool.pool_idx = POOL_KERNEL;
+    user_pool.pool_idx = POOL_USER;
+    kernel_pool.pages_cnt = 0;
+    user_pool.pages_cnt = 0;
+    // 低地址的一半给内核内存池，其余给用户内存池
+    // 内核能用的页框还受内核堆虚拟地址范围的限制，多出来的部分也留给用户内存池
+    uint32_t kernel_quota = total_frames / 2;
+    if (kernel_quota > k_vaddr_bytes * 8 - early_vpages) {
+        kernel_quota = k_vaddr_bytes * 8 - early_vpages;
+    }
+    for (range_idx = 0; range_idx < range_cnt; range_idx++) {
+        uint32_t run_start = 0, run_len = 0;
+        struct pool* run_pool = NULL;
+        for (pfn = ranges[range_idx].start_pfn; pfn <= ranges[range_idx].end_pfn; pfn++) {
+            struct pool* m_pool = NULL;
+            if (pfn < ranges[range_idx].end_pfn && pfn >= reserved_pfn && \
+                (pfn < early_pfn_start || pfn >= early_pfn_next)) {
+                m_pool = kernel_pool.pages_cnt + (run_pool == &kernel_pool ? run_len : 0) < kernel_quota ? \
+                    &kernel_pool : &user_pool;
+            }
+            // 把属于同一内存池的连续页框一次性交给伙伴系统
+            if (m_pool != run_pool && run_len > 0) {
+                buddy_free_range(run_pool, run_start, run_start + run_len);
+                run_pool->pages_cnt += run_len;
+                run_len = 0;
+            }
+            run_pool = m_pool;
+            if (m_pool != NULL) {
+                if (run_len == 0) {
+                    run_start = pfn;
+                }
+                page_descs[pfn].pool_idx = m_pool->pool_idx;
+                run_len++;
+            }
+        }
+    }
+
+    lock_init(&kernel_pool.lock);
+    lock_init(&user_pool.lock);
+
+    put_str("  kernel pool pages: ");
+    put_int(kernel_pool.pages_cnt);
+    put_str("\n  user pool pages: ");
+    put_int(user_pool.pages_cnt);
+    put_str("\n");
+    put_str("mem_pool_init done\n");
+}
+
+/**
+ * @brief 初始化内存块元数据
+ *        因此我们的内存块规格：16，32，64，128，256，512，1024
+ * @param desc_array 
+ */
+void block_desc_init(struct mem_block_desc* desc_array) {
+    uint16_t desc_idx, block_size = 16;
+    // 初始化每个 mem_block_desc 描述符
+    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
+        desc_array[desc_idx].block_size = block_size;
+        // 初始化 arena 中的内存块数量
+        desc_array[desc_idx].blocks_per_arena = (PAGE_SIZE - sizeof(struct arena)) / block_size;
+        list_init(&desc_array[desc_idx].partial_list);
+        list_init(&desc_array[desc_idx].full_list);
+        list_init(&desc_array[desc_idx].empty_list);
+        // 更新为下一个规格内存块
+        block_size *= 2;
+    }
+}
+
+/**
+ * @brief 初始化申请大小到内存块规格的查找表
+ * 
+ */
+static void size_class_table_init(void) {
+    uint32_t idx, block_size = 16;
+    uint8_t desc_idx = 0;
+    for (idx = 0; idx < sizeof(size_class_table); idx++) {
+        // 表项 idx 覆盖的最大申请大小为 (idx + 1) * 16
+        while ((idx + 1) * 16 > block_size) {
+            block_size *= 2;
+            desc_idx++;
+        }
+        size_class_table[idx] = desc_idx;
+    }
+}
+
+/**
+ * @brief 返回 arena 中第 idx 个内存块的地址
+ * 
+ * @param a 
+ * @param idx 
+ * @return struct mem_block* 
+ */
+static struct mem_block* arena2block(struct arena* a, uint32_t idx) {
     return (struct mem_block*)((uint32_t)a + sizeof(struct arena) + idx * a->desc->block_size);
 }
 
@@ -423,46 +1209,177 @@ static struct arena* block2arena(struct mem_block* b) {
     return (struct arena*)((uint32_t)b & 0xfffff000);
 }
 
+/**
+ * @brief 从内存块描述符 desc 中取出一个内存块
+ *        优先使用部分空闲的 arena，其次是缓存的空 arena，都没有时才创建新的 arena
+ *        调用者需持有对应内存池的锁
+ * 
+ * @param desc 
+ * @param PF 
+ * @return struct mem_block* 
+ */
+static struct mem_block* desc_block_get(struct mem_block_desc* desc, enum pool_flags PF) {
+    struct arena* a;
+    struct mem_block* b;
+    if (!list_empty(&desc->partial_list)) {
+        a = elem2entry(struct arena, arena_tag, desc->partial_list.head.next);
+    } else {
+        if (!list_empty(&desc->empty_list)) {
+            a = elem2entry(struct arena, arena_tag, list_pop(&desc->empty_list));
+        } else {
+            // 分配一页作为 arena
+            a = malloc_page(PF, 1);
+            if (a == NULL) {
+                return NULL;
+            }
+            // 不必清零整页，内存块在分配时按需清零
+            // 对于分配的小块内存，将 desc 置为相应内存块描述符
+            // cnt 置为此 arena 可用的内存块数，large 置为 false
+            a->desc = desc;
+            a->large = false;
+            a->cnt = desc->blocks_per_arena;
+            a->free_head = NULL;
+            a->unused_idx = 0;
+        }
+        list_push(&desc->partial_list, &a->arena_tag);
+    }
+    // 先取被释放回来的块，没有时再取从未分配过的块
+    if (a->free_head != NULL) {
+        b = a->free_head;
+        a->free_head = b->next;
+    } else {
+        ASSERT(a->unused_idx < desc->blocks_per_arena);
+        b = arena2block(a, a->unused_idx++);
+    }
+    // arena 分配完后移到 full_list
+    if (--a->cnt == 0) {
+        list_remove(&a->arena_tag);
+        list_append(&desc->full_list, &a->arena_tag);
+    }
+    return b;
+}
+
+/**
+ * @brief 将内存块 b 归还到所在的 arena，arena 全部空闲时缓存或释放 arena
+ *        调用者需持有对应内存池的锁
+ * 
+ * @param desc 
+ * @param b 
+ * @param PF 
+ */
+static void desc_block_put(struct mem_block_desc* desc, struct mem_block* b, enum pool_flags PF) {
+    struct arena* a = block2arena(b);
+    ASSERT(a->desc == desc);
+    ASSERT(a->cnt < desc->blocks_per_arena);
+    b->next = a->free_head;
+    a->free_head = b;
+    // 原先已分配完的 arena 重新回到 partial_list
+    if (a->cnt++ == 0) {
+        list_remove(&a->arena_tag);
+        list_push(&desc->partial_list, &a->arena_tag);
+    }
+    if (a->cnt == desc->blocks_per_arena) {
+        list_remove(&a->arena_tag);
+        if (list_empty(&desc->empty_list)) {
+            // 全部空闲，重置成新建时的状态缓存起来
+            a->free_head = NULL;
+            a->unused_idx = 0;
+            list_push(&desc->empty_list, &a->arena_tag);
+        } else {
+            mfree_page(PF, a, 1);
+        }
+    }
+}
+
+/**
+ * @brief 返回内存块描述符 desc 所属的内存池
+ * 
+ * @param desc 
+ * @return enum pool_flags 
+ */
+static enum pool_flags desc_pool_flags(struct mem_block_desc* desc) {
+    if (desc >= k_block_descs && desc < k_block_descs + DESC_CNT) {
+        return PF_KERNEL;
+    }
+    return PF_USER;
+}
+
+/**
+ * @brief 从仓库中批量取出内存块装填弹匣
+ * 
+ * @param mag 
+ */
+static void magazine_refill(struct mem_magazine* mag) {
+    enum pool_flags PF = desc_pool_flags(mag->desc);
+    struct pool* mem_pool = PF == PF_KERNEL ? &kernel_pool : &user_pool;
+    lock_acquire(&mem_pool->lock);
+    while (mag->rounds < MAGAZINE_BATCH) {
+        struct mem_block* b = desc_block_get(mag->desc, PF);
+        if (b == NULL) {
+            break;
+        }
+        mag->blocks[mag->rounds++] = b;
+    }
+    lock_release(&mem_pool->lock);
+}
+
+/**
+ * @brief 将弹匣中的 cnt 个内存块批量归还到仓库
+ * 
+ * @param mag 
+ * @param cnt 
+ */
+static void magazine_drain(struct mem_magazine* mag, uint32_t cnt) {
+    ASSERT(cnt <= mag->rounds);
+    enum pool_flags PF = desc_pool_flags(mag->desc);
+    struct pool* mem_pool = PF == PF_KERNEL ? &kernel_pool : &user_pool;
+    lock_acquire(&mem_pool->lock);
+    while (cnt-- > 0) {
+        desc_block_put(mag->desc, mag->blocks[--mag->rounds], PF);
+    }
+    lock_release(&mem_pool->lock);
+}
+
 /**
  * @brief 在堆中申请 size 字节内存
  * 
  * @param size 
+ * @param zero 为 true 时将申请到的内存清零
  * @return void* 
  */
-void* sys_malloc(uint32_t size) {
+static void* heap_malloc(uint32_t size, bool zero) {
     enum pool_flags PF;
     struct pool* mem_pool;
-    uint32_t pool_size;
     struct mem_block_desc* descs;
     struct task_struct* cur_thread = running_thread();
     // 判断用那个内存池
     // 如果是内核线程
     if (cur_thread->pg_dir == NULL) {
         PF = PF_KERNEL;
-        pool_size = kernel_pool.pool_size;
         mem_pool = &kernel_pool;
         descs = k_block_descs;
     } else {  // 用户进程 PCB 中的 pgdir 会在为其分配页表时创建
         PF = PF_USER;
-        pool_size = user_pool.pool_size;
         mem_pool = &user_pool;
         descs = cur_thread->u_block_desc;
     }
     // 校验参数
-    // 如果申请的内存不在内存池容量范围内则直接返回 NULL
-    if (!(size > 0 && size < pool_size)) {
+    // 内存池之间可以借用页框，申请的内存超过全部物理内存时直接返回 NULL
+    if (!(size > 0 && size / PAGE_SIZE < total_frames)) {
         return NULL;
     }
     struct arena* a;
     struct mem_block* b;
-    lock_acquire(&mem_pool->lock);
     if (size > 1024) {
+        lock_acquire(&mem_pool->lock);
         // 向上取整需要的页面数
         uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PAGE_SIZE);
         a = malloc_page(PF, page_cnt);
         if (a != NULL) {
-            // 将分配的内存清零
-            memset(a, 0, page_cnt * PAGE_SIZE);
+            // 将 arena 之后返回给调用者的内存清零
+            if (zero) {
+                memset(a + 1, 0, page_cnt * PAGE_SIZE - sizeof(struct arena));
+            }
             // 对于分配的大块页，将 desc 置为 NULL，cnt 置为页数，large 置为 true
             a->desc = NULL;
             a->cnt = page_cnt;
@@ -475,79 +1392,184 @@ void* sys_malloc(uint32_t size) {
             return NULL;
         }
     } else {  // 如果申请的内存小于 1024，可在各种规格的 mem_block_desc 中去适配
-        uint8_t desc_idx;
-        // 从内存块描述符中匹配合适的内存块规格
-        for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
-            // 从小往大找，找到后退出
-            if (size <= descs[desc_idx].block_size) {
-                break;
+        // 查表得到合适的内存块规格
+        uint8_t desc_idx = SIZE_TO_DESC_IDX(size);
+        struct mem_block_desc* desc = &descs[desc_idx];
+        struct mem_magazine* mag = &cur_thread->mags[desc_idx];
+        // 弹匣为空时从仓库批量装填，同时把弹匣绑定到本次的描述符上
+        if (mag->rounds == 0) {
+            mag->desc = desc;
+            magazine_refill(mag);
+            if (mag->rounds == 0) {
+                return NULL;
             }
         }
-        // 如果 mem_block_desc 的 free_list 中已经没有可用的 mem_block
-        // 就创建新的 arena 提供 mem_block
-        if (list_empty(&descs[desc_idx].free_list)) {
-            // 分配一页作为 arena
-            a = malloc_page(PF, 1);
-            if (a == NULL) {
-                lock_release(&mem_pool->lock);
+        if (mag->desc == desc) {
+            // 快速路径：直接从弹匣中取，无须加锁
+            b = mag->blocks[--mag->rounds];
+        } else {
+            // 弹匣中缓存的是另一个内存池的块（如用户进程临时申请内核内存），直接从仓库申请
+            lock_acquire(&mem_pool->lock);
+            b = desc_block_get(desc, PF);
+            lock_release(&mem_pool->lock);
+            if (b == NULL) {
                 return NULL;
             }
-            memset(a, 0, PAGE_SIZE);
-            // asm volatile ("xchg %%bx, %%bx" ::);
-            // 对于分配的小块内存，将 desc 置为相应内存块描述符
-            // cnt 置为此 arena 可用的内存块数，large 置为 false
-            a->desc = &descs[desc_idx];
-            a->large = false;
-            a->cnt = descs[desc_idx].blocks_per_arena;
-            uint32_t block_idx;
-            // 开始将 arena 拆分成内存块，并添加到内存块描述符的 free_list 中
-            // 在做这个操作前记得暂停中断
-            enum intr_status old_status = intr_disable();
-            for (block_idx = 0; block_idx < descs[desc_idx].blocks_per_arena; block_idx++) {
-                b = arena2block(a, block_idx);
-                ASSERT(!elem_find(&a->desc->free_list, &b->free_elem));
-                list_append(&a->desc->free_list, &b->free_elem);
-            }
-            intr_set_status(old_status);
         }
-        // 开始分配内存块
-        b = elem2entry(struct mem_block, free_elem, list_pop(&(descs[desc_idx].free_list)));
-        memset(b, 0, descs[desc_idx].block_size);
-        // 获取内存块所在的 arena
-        a = block2arena(b);
-        // 将此 arena 中的空闲内存块数减一
-        a->cnt--;
-        lock_release(&mem_pool->lock);
+        if (zero) {
+            memset(b, 0, desc->block_size);
+        }
         return (void*)b;
     }
 }
 
+/**
+ * @brief 在堆中申请 size 字节内存，返回的内存已清零
+ * 
+ * @param size 
+ * @return void* 
+ */
+void* sys_malloc(uint32_t size) {
+    return heap_malloc(size, true);
+}
+
+/**
+ * @brief 在堆中申请 size 字节内存，不清零
+ *        适用于申请后马上就会被完整覆盖的缓冲区
+ * 
+ * @param size 
+ * @return void* 
+ */
+void* sys_malloc_nozero(uint32_t size) {
+    return heap_malloc(size, false);
+}
+
+/**
+ * @brief 在堆中申请 cnt 个 size 字节的元素，返回的内存已清零
+ * 
+ * @param cnt 
+ * @param size 
+ * @return void* 
+ */
+void* sys_calloc(uint32_t cnt, uint32_t size) {
+    // 防止乘法溢出
+    if (size != 0 && cnt > 0xffffffff / size) {
+        return NULL;
+    }
+    return heap_malloc(cnt * size, true);
+}
+
+/**
+ * @brief 将当前进程堆的末尾调整为 brk，新增的页已清零
+ *        用户态分配器借此批量获取内存，大部分 malloc 不必进入内核
+ * 
+ * @param brk 为 0 时只查询当前的堆末尾
+ * @return uint32_t 成功返回新的堆末尾，失败返回原来的堆末尾
+ */
+uint32_t sys_brk(uint32_t brk) {
+    struct task_struct* cur = running_thread();
+    ASSERT(cur->pg_dir != NULL);
+    uint32_t old_brk = cur->heap_brk;
+    // 堆的第一页在创建进程时映射，不允许释放
+    if (brk < USER_HEAP_START + PAGE_SIZE || brk > USER_HEAP_END) {
+        return old_brk;
+    }
+    uint32_t old_end = DIV_ROUND_UP(old_brk, PAGE_SIZE) * PAGE_SIZE;
+    uint32_t new_end = DIV_ROUND_UP(brk, PAGE_SIZE) * PAGE_SIZE;
+    uint32_t vaddr;
+    for (vaddr = old_end; vaddr < new_end; vaddr += PAGE_SIZE) {
+        // 该页已被其它区域占用，或者物理内存不足时回滚
+        if (vma_find(&cur->user_vm, vaddr) != NULL || \
+            get_a_page(PF_USER, vaddr) == NULL) {
+            if (vaddr > old_end) {
+                lock_acquire(&user_pool.lock);
+                mfree_page(PF_USER, (void*)old_end, (vaddr - old_end) / PAGE_SIZE);
+                lock_release(&user_pool.lock);
+            }
+            return old_brk;
+        }
+    }
+    if (new_end < old_end) {
+        lock_acquire(&user_pool.lock);
+        mfree_page(PF_USER, (void*)new_end, (old_end - new_end) / PAGE_SIZE);
+        lock_release(&user_pool.lock);
+    }
+    cur->heap_brk = brk;
+    return brk;
+}
+
 /**
  * @brief 将物理地址 pg_phy_addr 回收到物理内存池
  * 
  * @param pg_phy_addr 
  */
 void pfree(uint32_t pg_phy_addr) {
-    struct pool* mem_pool;
-    uint32_t bit_idx = 0;
-    // 用户物理内存池
-    if (pg_phy_addr >= user_pool.phy_addr_start) {
-        mem_pool = &user_pool;
-        bit_idx = (pg_phy_addr - user_pool.phy_addr_start) / PAGE_SIZE;
-    } else {  // 内核物理内存池
-        mem_pool = &kernel_pool;
-        bit_idx = (pg_phy_addr - kernel_pool.phy_addr_start) / PAGE_SIZE;
+    struct page* pg = phy_to_page(pg_phy_addr);
+    // 页框归还给当前拥有它的内存池
+    struct pool* mem_pool = page_pool(pg);
+    // idle 线程不持有内存池的锁也会操作伙伴系统，所以这里关中断
+    enum intr_status old_status = intr_disable();
+    // 页框仍被写时复制共享时只减少共享数
+    if (pg->share_cnt > 0) {
+        pg->share_cnt--;
+        intr_set_status(old_status);
+        return;
+    }
+    // 该页应处于已分配状态，否则就是重复释放
+    ASSERT(pg->allocated);
+    pg->allocated = 0;
+    // 归还给伙伴系统，并与空闲的伙伴块合并
+    buddy_free(mem_pool, pg - page_descs, 0);
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 通过临时映射将物理页框清零
+ *        只在 idle 线程和初始化时调用，两者不会同时使用 zero_scratch_vaddr
+ * 
+ * @param page_phyaddr 
+ */
+static void frame_clear(uint32_t page_phyaddr) {
+    uint32_t* pte = pte_ptr(zero_scratch_vaddr);
+    *pte = page_phyaddr | PG_US_S | PG_RW_W | PG_P_1;
+    asm volatile("invlpg %0" :: "m" (*(char*)zero_scratch_vaddr) : "memory");
+    memset((void*)zero_scratch_vaddr, 0, PAGE_SIZE);
+    *pte = 0;
+    asm volatile("invlpg %0" :: "m" (*(char*)zero_scratch_vaddr) : "memory");
+}
+
+/**
+ * @brief 利用空闲时间为各内存池预先清零物理页，就绪队列中一旦有任务就停下
+ *        只在 idle 线程中调用，不使用会睡眠的锁
+ * 
+ */
+void zeroed_frames_refill(void) {
+    struct pool* pools[2] = {&kernel_pool, &user_pool};
+    uint32_t pool_idx;
+    for (pool_idx = 0; pool_idx < 2; pool_idx++) {
+        struct pool* mem_pool = pools[pool_idx];
+        // 只用本内存池空闲的页框，不为预先清零而向另一个内存池借用
+        while (mem_pool->zeroed_cnt < ZEROED_FRAMES_MAX && list_empty(&thread_ready_list) && \
+            pool_has_free(mem_pool)) {
+            uint32_t page_phyaddr = (uint32_t)palloc(mem_pool);
+            if (page_phyaddr == 0) {
+                break;
+            }
+            frame_clear(page_phyaddr);
+
+            enum intr_status old_status = intr_disable();
+            mem_pool->zeroed_frames[mem_pool->zeroed_cnt++] = page_phyaddr;
+            intr_set_status(old_status);
+        }
     }
-    // 将位图中该位清 0
-    bitmap_set(&mem_pool->pool_bitmap, bit_idx, 0);
 }
 
 static void page_table_pte_remove(uint32_t vaddr) {
     uint32_t* pte = pte_ptr(vaddr);
     // 将页表项 pte 的 P 位置 0
     *pte &= ~PG_P_1;
-    // 更新 tlb
-    asm volatile("invlpg %0" :: "m" (vaddr):"memory");
+    // 更新 tlb，操作数是 vaddr 指向的内存而不是局部变量 vaddr 本身
+    asm volatile("invlpg %0" :: "m" (*(char*)vaddr) : "memory");
 }
 
 static void vaddr_remove(enum pool_flags pf, void* p_vaddr, uint32_t pg_cnt) {
@@ -562,9 +1584,9 @@ static void vaddr_remove(enum pool_flags pf, void* p_vaddr, uint32_t pg_cnt) {
         }
     } else {  // 用户虚拟内存池
         struct task_struct* cur_thread = running_thread();
-        bit_idx_start = (i_vaddr - cur_thread->user_process_vaddr.vaddr_start) / PAGE_SIZE;
-        for (; cnt < pg_cnt;) {
-            bitmap_set(&cur_thread->user_process_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 0);
+        // 页框已经释放, 拆分区域失败时这段地址只是仍被预留, 以后不会再分配出去
+        if (!vma_unmap(&cur_thread->user_vm, i_vaddr, i_vaddr + pg_cnt * PAGE_SIZE)) {
+            printk("vaddr_remove: no memory to split vm_area\n");
         }
     }
 }
@@ -574,45 +1596,29 @@ void mfree_page(enum pool_flags pf, void* p_vaddr, uint32_t pg_cnt) {
     uint32_t i_vaddr = (uint32_t)p_vaddr;
     uint32_t page_cnt = 0;
     ASSERT((pg_cnt >= 1) && ((i_vaddr % PAGE_SIZE) == 0));
-    // 获取虚拟地址 p_vaddr 对应的物理地址
-    pg_phy_addr = addr_v2p(i_vaddr);
-    // 确保待释放的物理内存在低端 1M+1K 大小的页目录+1k大小的页表地址范围外
-    ASSERT((pg_phy_addr % PAGE_SIZE) == 0 && pg_phy_addr >= 0x102000);
-    // 判断 pg_phy_addr 属于用户物理内存池还是内核物理内存池
-    if (pg_phy_addr >= user_pool.phy_addr_start) {   // 位于user_pool内存池
-        i_vaddr -= PAGE_SIZE;
-        for (; page_cnt < pg_cnt;) {
-            i_vaddr += PAGE_SIZE;
-            pg_phy_addr = addr_v2p(i_vaddr);
-            // 确保物理地址属于用户物理内存池
-            ASSERT((pg_phy_addr % PAGE_SIZE) == 0 && pg_phy_addr >= user_pool.phy_addr_start);
-            // 先将对应的物理页框归还到内存池
-            pfree(pg_phy_addr);
-            // 再从页表中清除此虚拟地址所在的页表项 pte
-            page_table_pte_remove(i_vaddr);
-
-            page_cnt++;
-        }
-        // 清空虚拟地址的位图中的相应位 */
-        vaddr_remove(pf, p_vaddr, pg_cnt);
-    } else {  // 位于kernel_pool内存池
-        i_vaddr -= PAGE_SIZE;
-        for (; page_cnt < pg_cnt;) {
-            i_vaddr += PAGE_SIZE;
-            pg_phy_addr = addr_v2p(i_vaddr);
-            // 确保待释放的物理内存只属于内核物理内存池
-            ASSERT((pg_phy_addr % PAGE_SIZE) == 0 && \
-                pg_phy_addr >= kernel_pool.phy_addr_start && \
-                pg_phy_addr < user_pool.phy_addr_start);
-            // 先将对应的物理页框归还到内存池
-            pfree(pg_phy_addr);
-            // 再从页表中清除此虚拟地址所在的页表项 pte
-            page_table_pte_remove(i_vaddr);
+    struct pool* mem_pool = pf == PF_KERNEL ? &kernel_pool : &user_pool;
+    i_vaddr -= PAGE_SIZE;
+    for (; page_cnt < pg_cnt;) {
+        i_vaddr += PAGE_SIZE;
+        // 已换出的用户页只需释放交换槽
+        if (pf == PF_USER && (*pte_ptr(i_vaddr) & PG_SWAP)) {
+            swap_slot_free(*pte_ptr(i_vaddr) >> 12);
+            *pte_ptr(i_vaddr) = 0;
             page_cnt++;
+            continue;
         }
-        // 清空虚拟地址的位图中的相应位
-        vaddr_remove(pf, p_vaddr, pg_cnt);
+        // 获取虚拟地址对应的物理地址
+        pg_phy_addr = addr_v2p(i_vaddr);
+        // 确保物理页框属于 pf 对应的内存池，而不是低端 1M、页目录或启动时划走的页框
+        ASSERT((pg_phy_addr % PAGE_SIZE) == 0 && page_pool(phy_to_page(pg_phy_addr)) == mem_pool);
+        // 先将对应的物理页框归还到内存池
+        pfree(pg_phy_addr);
+        // 再从页表中清除此虚拟地址所在的页表项 pte
+        page_table_pte_remove(i_vaddr);
+        page_cnt++;
     }
+    // 清空虚拟地址的位图中的相应位
+    vaddr_remove(pf, p_vaddr, pg_cnt);
 }
 
 /**
@@ -628,9 +1634,10 @@ void sys_free(void* ptr) {
     // 如下是 ptr 不为 NULL 的情况
     enum pool_flags PF;
     struct pool* mem_pool;
+    struct task_struct* cur_thread = running_thread();
 
     // 判断是线程还是进程
-    if (running_thread()->pg_dir == NULL) {
+    if (cur_thread->pg_dir == NULL) {
         ASSERT((uint32_t)ptr >= K_HEAP_START);
         PF = PF_KERNEL;
         mem_pool = &kernel_pool;
@@ -639,36 +1646,681 @@ void sys_free(void* ptr) {
         mem_pool = &user_pool;
     }
 
-    lock_acquire(&mem_pool->lock);
     struct mem_block* b = ptr;
     struct arena* a = block2arena(b);  // 把mem_block转换成arena,获取元信息
     ASSERT(a->large == 0 || a->large == 1);
     if (a->desc == NULL && a->large == true) {  // 大于1024的内存
+        lock_acquire(&mem_pool->lock);
         mfree_page(PF, a, a->cnt);
-    } else {  // 小于等于1024的内存块
-        // 先将内存块回收到free_list
-        list_append(&a->desc->free_list, &b->free_elem);
-        // 再判断此arena中的内存块是否都是空闲,如果是就释放 arena
-        if (++a->cnt == a->desc->blocks_per_arena) {
-            uint32_t block_idx;
-            for (block_idx = 0; block_idx < a->desc->blocks_per_arena; block_idx++) {
-                struct mem_block*  b = arena2block(a, block_idx);
-                ASSERT(elem_find(&a->desc->free_list, &b->free_elem));
-                list_remove(&b->free_elem);
-            }
-            mfree_page(PF, a, 1);
+        lock_release(&mem_pool->lock);
+        return;
+    }
+    // 小于等于1024的内存块，优先放回当前线程的弹匣
+    struct mem_block_desc* desc = a->desc;
+    struct mem_magazine* mag = &cur_thread->mags[SIZE_TO_DESC_IDX(desc->block_size)];
+    if (mag->rounds == 0) {
+        mag->desc = desc;
+    }
+    if (mag->desc == desc) {
+        // 弹匣已满时先把一批块归还到仓库
+        if (mag->rounds == MAGAZINE_SIZE) {
+            magazine_drain(mag, MAGAZINE_BATCH);
         }
+        mag->blocks[mag->rounds++] = b;
+        return;
     }
+    // 弹匣中缓存的是另一个内存池的块，直接归还到仓库
+    PF = desc_pool_flags(desc);
+    mem_pool = PF == PF_KERNEL ? &kernel_pool : &user_pool;
+    lock_acquire(&mem_pool->lock);
+    desc_block_put(desc, b, PF);
     lock_release(&mem_pool->lock);
 }
 
+// 最多能创建的 kmem_cache 个数
+#define KMEM_CACHE_MAX 16
+// 一个 slab 最多占用的页数
+#define KMEM_SLAB_MAX_PAGES 8
+// 一个 slab 最多容纳的对象数，保证 slab 描述符不超过 1024 字节
+#define KMEM_SLAB_MAX_OBJS 500
+// cache 的 slab 描述符大小
+#define KMEM_SLAB_HDR_SIZE(cache) (sizeof(struct kmem_slab) + (cache)->objs_per_slab * sizeof(uint16_t))
+
+/**
+ * @brief slab 描述符，一个 slab 是一段连续的内核页，被切分成若干同类对象
+ *        描述符本身放在 slab 之外，以便整页大小且需页对齐的对象（如 PCB）也能使用
+ */
+struct kmem_slab {
+    // 挂在所属 cache 的 slabs_partial/slabs_full/slabs_free 链表上
+    struct list_elem slab_tag;
+    struct kmem_cache* cache;
+    // slab 中第一个对象的地址
+    void* s_mem;
+    // 已分配出去的对象数
+    uint32_t inuse;
+    // 空闲对象下标栈，free_stack[0 ~ free_top-1] 为空闲对象
+    uint32_t free_top;
+    uint16_t free_stack[];
+};
+
+/**
+ * @brief 同类对象的缓存
+ *        空闲对象始终保持构造后的状态，再次分配时无须重新初始化
+ */
+struct kmem_cache {
+    char name[16];
+    // 对象占用的大小（已按对齐要求向上取整）
+    uint32_t obj_size;
+    uint32_t objs_per_slab;
+    uint32_t slab_pages;
+    kmem_ctor* ctor;
+    // 部分分配、全部分配、全部空闲的 slab
+    struct list slabs_partial;
+    struct list slabs_full;
+    struct list slabs_free;
+    // 统计信息
+    uint32_t slab_cnt;
+    uint32_t active_objs;
+    uint32_t alloc_cnt;
+    uint32_t ctor_cnt;
+    struct lock lock;
+};
+
+static struct kmem_cache kmem_caches[KMEM_CACHE_MAX];
+static uint32_t kmem_cache_cnt = 0;
+
+/**
+ * @brief 创建对象缓存
+ * 
+ * @param name 缓存名，用于统计输出
+ * @param obj_size 对象大小
+ * @param align 对象对齐要求，须为 2 的幂，不超过 PAGE_SIZE
+ * @param ctor 对象构造函数，在对象所在的 slab 创建时调用，可以为 NULL
+ * @return struct kmem_cache* 
+ */
+struct kmem_cache* kmem_cache_create(const char* name, uint32_t obj_size, uint32_t align, kmem_ctor* ctor) {
+    ASSERT(kmem_cache_cnt < KMEM_CACHE_MAX);
+    ASSERT(align > 0 && align <= PAGE_SIZE && (align & (align - 1)) == 0);
+    struct kmem_cache* cache = &kmem_caches[kmem_cache_cnt++];
+    memset(cache, 0, sizeof(struct kmem_cache));
+    strncpy(cache->name, name, sizeof(cache->name) - 1);
+    if (align < sizeof(uint32_t)) {
+        align = sizeof(uint32_t);
+    }
+    cache->obj_size = (obj_size + align - 1) & ~(align - 1);
+    ASSERT(cache->obj_size <= PAGE_SIZE * KMEM_SLAB_MAX_PAGES);
+    // slab 的页数取浪费不超过 1/8 的最小值
+    cache->slab_pages = 1;
+    while (cache->slab_pages < KMEM_SLAB_MAX_PAGES && \
+        (cache->slab_pages * PAGE_SIZE) % cache->obj_size > cache->slab_pages * PAGE_SIZE / 8) {
+        cache->slab_pages++;
+    }
+    cache->objs_per_slab = cache->slab_pages * PAGE_SIZE / cache->obj_size;
+    if (cache->objs_per_slab > KMEM_SLAB_MAX_OBJS) {
+        cache->objs_per_slab = KMEM_SLAB_MAX_OBJS;
+    }
+    cache->ctor = ctor;
+    list_init(&cache->slabs_partial);
+    list_init(&cache->slabs_full);
+    list_init(&cache->slabs_free);
+    lock_init(&cache->lock);
+    return cache;
+}
+
+/**
+ * @brief 为 cache 新建一个 slab，并构造其中的全部对象
+ * 
+ * @param cache 
+ * @return struct kmem_slab* 
+ */
+static struct kmem_slab* kmem_slab_create(struct kmem_cache* cache) {
+    // slab 描述符直接从内核的内存块描述符中取，不经过当前任务的弹匣，
+    // 因此在用户进程中或主线程初始化之前调用也能得到内核内存
+    struct mem_block_desc* desc = &k_block_descs[SIZE_TO_DESC_IDX(KMEM_SLAB_HDR_SIZE(cache))];
+    lock_acquire(&kernel_pool.lock);
+    struct kmem_slab* slab = (struct kmem_slab*)desc_block_get(desc, PF_KERNEL);
+    if (slab == NULL) {
+        lock_release(&kernel_pool.lock);
+        return NULL;
+    }
+    slab->s_mem = malloc_page(PF_KERNEL, cache->slab_pages);
+    if (slab->s_mem == NULL) {
+        desc_block_put(desc, (struct mem_block*)slab, PF_KERNEL);
+        lock_release(&kernel_pool.lock);
+        return NULL;
+    }
+    lock_release(&kernel_pool.lock);
+    // 让 slab 中的每一页都能找到此 slab
+    uint32_t pg_idx;
+    for (pg_idx = 0; pg_idx < cache->slab_pages; pg_idx++) {
+        phy_to_page(addr_v2p((uint32_t)slab->s_mem + pg_idx * PAGE_SIZE))->slab = slab;
+    }
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free_top = cache->objs_per_slab;
+    uint32_t obj_idx;
+    for (obj_idx = 0; obj_idx < cache->objs_per_slab; obj_idx++) {
+        // 倒序入栈，使对象按地址从低到高分配
+        slab->free_stack[obj_idx] = cache->objs_per_slab - 1 - obj_idx;
+        if (cache->ctor != NULL) {
+            cache->ctor((uint8_t*)slab->s_mem + obj_idx * cache->obj_size);
+            cache->ctor_cnt++;
+        }
+    }
+    cache->slab_cnt++;
+    return slab;
+}
+
+/**
+ * @brief 释放一个全部空闲的 slab
+ * 
+ * @param slab 
+ */
+static void kmem_slab_destroy(struct kmem_slab* slab) {
+    struct kmem_cache* cache = slab->cache;
+    ASSERT(slab->inuse == 0);
+    uint32_t pg_idx;
+    for (pg_idx = 0; pg_idx < cache->slab_pages; pg_idx++) {
+        phy_to_page(addr_v2p((uint32_t)slab->s_mem + pg_idx * PAGE_SIZE))->slab = NULL;
+    }
+    lock_acquire(&kernel_pool.lock);
+    mfree_page(PF_KERNEL, slab->s_mem, cache->slab_pages);
+    desc_block_put(&k_block_descs[SIZE_TO_DESC_IDX(KMEM_SLAB_HDR_SIZE(cache))], (struct mem_block*)slab, PF_KERNEL);
+    lock_release(&kernel_pool.lock);
+    cache->slab_cnt--;
+}
+
+/**
+ * @brief 从 cache 中分配一个已构造好的对象
+ *        对象总是位于内核空间，与当前任务是线程还是进程无关
+ * 
+ * @param cache 
+ * @return void* 
+ */
+void* kmem_cache_alloc(struct kmem_cache* cache) {
+    struct kmem_slab* slab;
+    lock_acquire(&cache->lock);
+    // 优先从部分分配的 slab 中取，其次是全部空闲的 slab，都没有时再新建
+    if (!list_empty(&cache->slabs_partial)) {
+        slab = elem2entry(struct kmem_slab, slab_tag, cache->slabs_partial.head.next);
+    } else if (!list_empty(&cache->slabs_free)) {
+        slab = elem2entry(struct kmem_slab, slab_tag, list_pop(&cache->slabs_free));
+        list_push(&cache->slabs_partial, &slab->slab_tag);
+    } else {
+        slab = kmem_slab_create(cache);
+        if (slab == NULL) {
+            lock_release(&cache->lock);
+            return NULL;
+        }
+        list_push(&cache->slabs_partial, &slab->slab_tag);
+    }
+    ASSERT(slab->free_top > 0);
+    uint16_t obj_idx = slab->free_stack[--slab->free_top];
+    slab->inuse++;
+    if (slab->free_top == 0) {
+        list_remove(&slab->slab_tag);
+        list_push(&cache->slabs_full, &slab->slab_tag);
+    }
+    cache->active_objs++;
+    cache->alloc_cnt++;
+    lock_release(&cache->lock);
+    return (uint8_t*)slab->s_mem + obj_idx * cache->obj_size;
+}
+
+/**
+ * @brief 将对象 obj 归还给 cache
+ *        调用者须保证归还的对象已恢复到构造后的状态
+ * 
+ * @param cache 
+ * @param obj 
+ */
+void kmem_cache_free(struct kmem_cache* cache, void* obj) {
+    ASSERT(obj != NULL);
+    struct kmem_slab* slab = phy_to_page(addr_v2p((uint32_t)obj))->slab;
+    ASSERT(slab != NULL && slab->cache == cache);
+    uint32_t offset = (uint32_t)obj - (uint32_t)slab->s_mem;
+    ASSERT(offset % cache->obj_size == 0);
+    lock_acquire(&cache->lock);
+    if (slab->free_top == 0) {
+        // 从 full 变为 partial
+        list_remove(&slab->slab_tag);
+        list_push(&cache->slabs_partial, &slab->slab_tag);
+    }
+    slab->free_stack[slab->free_top++] = offset / cache->obj_size;
+    slab->inuse--;
+    cache->active_objs--;
+    if (slab->inuse == 0) {
+        list_remove(&slab->slab_tag);
+        // 只保留一个全部空闲的 slab 以应对反复的分配与释放，多余的还给内存池
+        if (list_empty(&cache->slabs_free)) {
+            list_push(&cache->slabs_free, &slab->slab_tag);
+        } else {
+            kmem_slab_destroy(slab);
+        }
+    }
+    lock_release(&cache->lock);
+}
+
+/**
+ * @brief 打印字符串 str，不足 width 的部分以空格填充
+ * 
+ * @param str 
+ * @param width 
+ */
+static void print_padded(const char* str, uint32_t width) {
+    uint32_t len = strlen(str);
+    printk("%s", str);
+    while (len++ < width) {
+        printk(" ");
+    }
+}
+
+/**
+ * @brief 打印数字 val，不足 width 的部分以空格填充
+ * 
+ * @param val 
+ * @param width 
+ */
+static void print_padded_num(uint32_t val, uint32_t width) {
+    char num[12] = {0};
+    snprintf(num, sizeof(num), "%d", val);
+    print_padded(num, width);
+}
+
+/**
+ * @brief 打印各对象缓存的使用情况
+ * 
+ */
+void sys_slabinfo(void) {
+    printk("NAME            OBJSIZE   ACTIVE    TOTAL     SLABS     ALLOCS    CTORS\n");
+    uint32_t cache_idx;
+    for (cache_idx = 0; cache_idx < kmem_cache_cnt; cache_idx++) {
+        struct kmem_cache* cache = &kmem_caches[cache_idx];
+        print_padded(cache->name, 16);
+        print_padded_num(cache->obj_size, 10);
+        print_padded_num(cache->active_objs, 10);
+        print_padded_num(cache->slab_cnt * cache->objs_per_slab, 10);
+        print_padded_num(cache->slab_cnt, 10);
+        print_padded_num(cache->alloc_cnt, 10);
+        print_padded_num(cache->ctor_cnt, 0);
+        printk("\n");
+    }
+}
+
+/**
+ * @brief exec 时释放当前进程除用户栈和堆第一页之外的全部用户页，并把堆恢复为初始状态
+ * 
+ */
+void user_space_reset(void) {
+    struct task_struct* cur = running_thread();
+    struct vm_area* area = vma_first(&cur->user_vm);
+    ASSERT(cur->pg_dir != NULL);
+    while (area != NULL) {
+        struct vm_area* next = vma_next(&cur->user_vm, area);
+        uint32_t start = area->start, end = area->end, vaddr;
+        // 堆的第一页保留
+        if (start == USER_HEAP_START) {
+            start += PAGE_SIZE;
+        }
+        if ((area->flags & VMA_STACK) || start >= end) {
+            area = next;
+            continue;
+        }
+        lock_acquire(&user_pool.lock);
+        for (vaddr = start; vaddr < end; vaddr += PAGE_SIZE) {
+            // 整个页表都不存在时跳到下一个 4M 区域
+            if (!(*pde_ptr(vaddr) & PG_P_1)) {
+                vaddr = (vaddr | 0x003fffff) + 1 - PAGE_SIZE;
+                continue;
+            }
+            // 按需加载的页可能只预留了区域而没有映射
+            if (*pte_ptr(vaddr) & PG_P_1) {
+                pfree(*pte_ptr(vaddr) & 0xfffff000);
+                page_table_pte_remove(vaddr);
+            } else if (*pte_ptr(vaddr) & PG_SWAP) {
+                swap_slot_free(*pte_ptr(vaddr) >> 12);
+                *pte_ptr(vaddr) = 0;
+            }
+        }
+        lock_release(&user_pool.lock);
+        // 去掉的是区域的尾部或整个区域, 不会拆分
+        bool unmapped = vma_unmap(&cur->user_vm, start, end);
+        ASSERT(unmapped);
+        (void)unmapped;
+        area = next;
+    }
+    cur->heap_brk = USER_HEAP_START + PAGE_SIZE;
+    memset((void*)USER_HEAP_START, 0, PAGE_SIZE);
+    // 原来的 arena 已随用户页一起释放，弹匣中缓存的用户内存块也一并丢弃
+    block_desc_init(cur->u_block_desc);
+    uint32_t desc_idx;
+    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
+        if (cur->mags[desc_idx].rounds != 0 && desc_pool_flags(cur->mags[desc_idx].desc) == PF_USER) {
+            cur->mags[desc_idx].rounds = 0;
+        }
+    }
+}
+
+/**
+ * @brief 把用户虚拟地址 vaddr 所在的页改为写时复制共享，fork 时对父进程的每个用户页调用
+ *        调用者需关中断，并在全部修改完成后刷新 TLB
+ * 
+ * @param vaddr 
+ */
+void page_share_cow(uint32_t vaddr) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    uint32_t* pte = pte_ptr(vaddr);
+    ASSERT(*pte & PG_P_1);
+    // 可写的页改为只读并打上写时复制标记，只读的页本来就可以直接共享
+    if (*pte & PG_RW_W) {
+        *pte = (*pte & ~PG_RW_W) | PG_COW;
+    }
+    phy_to_page(*pte & 0xfffff000)->share_cnt++;
+}
+
+/**
+ * @brief 解除 vaddr 所在页的写时复制
+ *        页框仍被共享时复制出一个新页框，否则直接恢复为可写
+ * 
+ * @param vaddr 
+ * @return bool 物理内存不足时返回 false
+ */
+static bool page_cow_break(uint32_t vaddr) {
+    uint32_t page_vaddr = vaddr & 0xfffff000;
+    uint32_t* pte = pte_ptr(page_vaddr);
+    struct page* pg = phy_to_page(*pte & 0xfffff000);
+    if (pg->share_cnt > 0) {
+        // 缺页处理期间一直关中断，palloc 本身也是关中断完成的，这里不必持有内存池的锁
+        uint32_t new_phyaddr = user_frame_alloc();
+        if (new_phyaddr == 0) {
+            return false;
+        }
+        // 换出页面腾出页框时会睡眠，期间其它映射可能已经解除了共享
+        if (pg->share_cnt == 0) {
+            pfree(new_phyaddr);
+            return page_cow_break(vaddr);
+        }
+        // 临时映射新页框，把原页框的内容复制过去
+        uint32_t* scratch_pte = pte_ptr(copy_scratch_vaddr);
+        *scratch_pte = new_phyaddr | PG_US_S | PG_RW_W | PG_P_1;
+        asm volatile("invlpg %0" :: "m" (*(char*)copy_scratch_vaddr) : "memory");
+        memcpy((void*)copy_scratch_vaddr, (void*)page_vaddr, PAGE_SIZE);
+        *scratch_pte = 0;
+        asm volatile("invlpg %0" :: "m" (*(char*)copy_scratch_vaddr) : "memory");
+        pg->share_cnt--;
+        *pte = new_phyaddr | (*pte & 0x00000fff & ~PG_COW) | PG_RW_W;
+    } else {
+        // 其它映射都已经释放，独占此页框
+        *pte = (*pte & ~PG_COW) | PG_RW_W;
+    }
+    asm volatile("invlpg %0" :: "m" (*(char*)page_vaddr) : "memory");
+    return true;
+}
+
+/**
+ * @brief 把全 0 的共享页框以写时复制的方式映射到用户虚拟地址 vaddr
+ *        vaddr 须已在虚拟地址位图中预留
+ * 
+ * @param vaddr 
+ */
+void page_map_zero(uint32_t vaddr) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    page_table_add((void*)vaddr, (void*)zero_page_phyaddr);
+    uint32_t* pte = pte_ptr(vaddr);
+    *pte = (*pte & ~PG_RW_W) | PG_COW;
+    phy_to_page(zero_page_phyaddr)->share_cnt++;
+}
+
+/**
+ * @brief 使当前进程 [buf, buf + len) 所在的用户页都映射到页框上并钉住，直到 user_pages_unpin
+ *        先访问每一页，由缺页异常换入、按需加载，write 为 true 时还解除写时复制
+ *        直接读写硬盘时持有通道锁，钉住后访问这些页不会再缺页
+ * 
+ * @param buf 
+ * @param len 
+ * @param write 为 true 时之后要写入这些页
+ */
+void user_pages_pin(void* buf, uint32_t len, bool write) {
+    ASSERT((uint32_t)buf < 0xc0000000 && len != 0);
+    uint32_t vaddr = (uint32_t)buf & 0xfffff000;
+    uint32_t end = (uint32_t)buf + len;
+    uint32_t page_mask = write ? (PG_P_1 | PG_RW_W) : PG_P_1;
+    for (; vaddr < end; vaddr += PAGE_SIZE) {
+        volatile uint8_t* p = (uint8_t*)(vaddr > (uint32_t)buf ? vaddr : (uint32_t)buf);
+        while (true) {
+            if (write) {
+                *p = *p;
+            } else {
+                (void)*p;
+            }
+            // 访问之后到钉住之前可能被换出，关中断检查页表项，不在内存中就再访问一次
+            enum intr_status old_status = intr_disable();
+            if ((*pde_ptr(vaddr) & PG_P_1) && (*pte_ptr(vaddr) & page_mask) == page_mask) {
+                phy_to_page(*pte_ptr(vaddr) & 0xfffff000)->pin_cnt++;
+                intr_set_status(old_status);
+                break;
+            }
+            intr_set_status(old_status);
+        }
+    }
+}
+
+/**
+ * @brief 解除 user_pages_pin 对 [buf, buf + len) 所在用户页的钉住
+ * 
+ * @param buf 
+ * @param len 
+ */
+void user_pages_unpin(void* buf, uint32_t len) {
+    uint32_t vaddr = (uint32_t)buf & 0xfffff000;
+    uint32_t end = (uint32_t)buf + len;
+    enum intr_status old_status = intr_disable();
+    for (; vaddr < end; vaddr += PAGE_SIZE) {
+        struct page* pg = phy_to_page(*pte_ptr(vaddr) & 0xfffff000);
+        ASSERT(pg->pin_cnt != 0);
+        pg->pin_cnt--;
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 用户栈按需增长，只允许访问 USER_STACK_LIMIT 以上、用户态 esp 附近的地址
+ * 
+ * @param vaddr 
+ * @return bool 
+ */
+static bool stack_grow(uint32_t vaddr) {
+    struct task_struct* cur = running_thread();
+    if (cur->pg_dir == NULL || vaddr >= USER_STACK3_VADDR) {
+        return false;
+    }
+    // 只能增长到创建进程时预留的栈区域之内
+    struct vm_area* area = vma_find(&cur->user_vm, vaddr);
+    if (area == NULL || !(area->flags & VMA_STACK)) {
+        return false;
+    }
+    // 无论缺页发生在用户态还是系统调用中，0 级栈顶的中断栈里都保存着用户态的 esp
+    struct intr_stack* intr_0_stack = (struct intr_stack*)((uint32_t)cur + PAGE_SIZE - sizeof(struct intr_stack));
+    // pushad 一次会压入 32 字节，允许访问 esp 之下 32 字节以内的地址
+    if (vaddr + 32 < (uint32_t)intr_0_stack->esp) {
+        return false;
+    }
+    return get_a_page(PF_USER, vaddr & 0xfffff000) != NULL;
+}
+
+/**
+ * @brief 把换出到交换区的页面读回来，重新映射到 vaddr
+ * 
+ * @param vaddr 
+ * @return bool 物理内存不足时返回 false
+ */
+static bool page_swap_in(uint32_t vaddr) {
+    uint32_t page_vaddr = vaddr & 0xfffff000;
+    uint32_t* pte = pte_ptr(page_vaddr);
+    // 页面可能正在被换出，等写盘完成后才能读回
+    lock_acquire(&swap_lock);
+    uint32_t slot = *pte >> 12;
+    uint32_t page_phyaddr = user_frame_alloc();
+    if (page_phyaddr == 0) {
+        lock_release(&swap_lock);
+        return false;
+    }
+    *pte_ptr(swap_scratch_vaddr) = page_phyaddr | PG_US_S | PG_RW_W | PG_P_1;
+    asm volatile("invlpg %0" :: "m" (*(char*)swap_scratch_vaddr) : "memory");
+    swap_read(slot, (void*)swap_scratch_vaddr);
+    *pte_ptr(swap_scratch_vaddr) = 0;
+    asm volatile("invlpg %0" :: "m" (*(char*)swap_scratch_vaddr) : "memory");
+    // 只换出过独占且可写的页面，换入后恢复为可写
+    *pte = page_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+    asm volatile("invlpg %0" :: "m" (*(char*)page_vaddr) : "memory");
+    swap_slot_free(slot);
+    lock_release(&swap_lock);
+    return true;
+}
+
+/**
+ * @brief 缺页异常处理程序
+ *        处理写时复制页的写入、换出页面的换入、可执行文件段的按需加载和用户栈的增长，其余情况打印出错地址后悬停
+ * 
+ */
+static void page_fault_handler(void) {
+    uint32_t vaddr;
+    asm volatile("movl %%cr2, %0" : "=r" (vaddr));
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (vaddr < 0xc0000000) {
+        if ((*pde_ptr(vaddr) & PG_P_1) && (*pte_ptr(vaddr) & PG_P_1)) {
+            if ((*pte_ptr(vaddr) & PG_COW) && page_cow_break(vaddr)) {
+                return;
+            }
+        } else if ((*pde_ptr(vaddr) & PG_P_1) && (*pte_ptr(vaddr) & PG_SWAP)) {
+            if (page_swap_in(vaddr)) {
+                return;
+            }
+        } else if (exec_segment_fault(vaddr) || stack_grow(vaddr)) {
+            return;
+        }
+    }
+    put_str("\n!!!   page fault addr is ");
+    put_int(vaddr);
+    put_str("   !!!\n");
+    PANIC("page_fault_handler: unhandled page fault");
+}
+
+/**
+ * @brief 注册缺页异常处理程序
+ * 
+ */
+static void page_fault_init(void) {
+    register_handler(0x0e, page_fault_handler);
+    // 置位 CR0 的 WP 位，使内核写用户页时也遵守只读属性，否则内核代替用户进程写入写时复制页时不会触发缺页
+    uint32_t cr0;
+    asm volatile("movl %%cr0, %0" : "=r" (cr0));
+    cr0 |= 0x00010000;
+    asm volatile("movl %0, %%cr0" : : "r" (cr0) : "memory");
+}
+
+/**
+ * @brief 重新加载 cr3，清除 TLB 中用户空间的映射，内核的全局页不受影响
+ * 
+ */
+void tlb_flush_user(void) {
+    uint32_t cr3;
+    asm volatile("movl %%cr3, %0" : "=r" (cr3));
+    asm volatile("movl %0, %%cr3" : : "r" (cr3) : "memory");
+}
+
+/**
+ * @brief 用 4M 大页映射内核的低端 4M，并丢弃 loader 预建的内核页表
+ *        须在内存池初始化之前调用，这样那些页表所在的页框就能归入内核内存池
+ * 
+ */
+static void kernel_large_page_init(void) {
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    // CPUID.01H:EDX 的第 3 位表示是否支持 4M 大页
+    if (!(edx & (1 << 3))) {
+        put_str("  large pages not supported\n");
+        return;
+    }
+    uint32_t cr4;
+    asm volatile("movl %%cr4, %0" : "=r" (cr4));
+    cr4 |= 0x00000010;
+    asm volatile("movl %0, %%cr4" : : "r" (cr4) : "memory");
+    // 低端 1M 的恒等映射与第 768 个目录项共用页表，一并去掉，之后只能经 0xc0000000 以上的地址访问
+    *pde_ptr(0) = 0;
+    *pde_ptr(0xc0000000) = 0 | PG_PS | PG_US_U | PG_RW_W | PG_P_1;
+    // 第 769 ~ 1022 个目录项原先指向的页表都是空的，mem_pool_init 按内存大小重新建立内核堆的页表
+    uint32_t vaddr;
+    for (vaddr = 0xc0400000; vaddr < 0xffc00000; vaddr += 0x00400000) {
+        *pde_ptr(vaddr) = 0;
+    }
+    tlb_flush_user();
+    // 主页目录位于大页映射的范围内，此后无论当前是哪个页目录都能访问到它
+    kernel_page_dir = (uint32_t*)(0xc0000000 + KERNEL_PAGE_DIR_PHY);
+    kernel_large_page = true;
+}
+
+/**
+ * @brief 把内核空间已有的页表项标记为全局页并开启 CR4.PGE
+ *        之后的进程切换只清除用户空间的 TLB 项
+ * 
+ */
+static void kernel_page_global_init(void) {
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    // CPUID.01H:EDX 的第 13 位表示是否支持全局页
+    if (!(edx & (1 << 13))) {
+        put_str("  global pages not supported\n");
+        return;
+    }
+    // loader 为进入内核建立的低端 1M 恒等映射已不再使用，把它从内核页目录中去掉
+    // 否则它与内核空间共用同一个页表，经低端地址访问也会留下全局的 TLB 项，在用户进程中仍然有效
+    uint32_t* pde = pde_ptr(0);
+    *pde = 0;
+    uint32_t vaddr;
+    for (vaddr = 0xc0000000; vaddr < 0xffc00000; vaddr += PAGE_SIZE) {
+        if (!(*pde_ptr(vaddr) & PG_P_1)) {
+            vaddr += 0x003ff000;
+            continue;
+        }
+        // 4M 大页的全局标记在页目录项中
+        if (*pde_ptr(vaddr) & PG_PS) {
+            *pde_ptr(vaddr) |= PG_G;
+            vaddr += 0x003ff000;
+            continue;
+        }
+        uint32_t* pte = pte_ptr(vaddr);
+        if (*pte & PG_P_1) {
+            *pte |= PG_G;
+        }
+    }
+    uint32_t cr4;
+    asm volatile("movl %%cr4, %0" : "=r" (cr4));
+    cr4 |= 0x00000080;
+    asm volatile("movl %0, %%cr4" : : "r" (cr4) : "memory");
+    // 打开 PGE 前的 TLB 项没有全局属性，重新加载 cr3 把低端映射一并清除
+    tlb_flush_user();
+}
+
 void mem_init(void) {
     put_str("mem_init start\n");
     // 这里的 0x920 来自于 boot/loader.s 中计算出来的系统总内存的存放地址
-    uint32_t mem_bytes_total = (*(uint32_t*)(0x920));
+    // 低端 1M 的恒等映射随后会被去掉，与 e820 布局一样经 0xc0000000 以上的地址读取
+    uint32_t mem_bytes_total = (*(uint32_t*)(0xc0000920));
+    kernel_large_page_init();
     mem_pool_init(mem_bytes_total);
+    lock_init(&swap_lock);
     // 初始化 k_block_descs 数组
     block_desc_init(k_block_descs);
+    size_class_table_init();
+    // 共享的全 0 页框永远保留一个引用，不会被释放
+    zero_page_phyaddr = (uint32_t)palloc(&user_pool);
+    ASSERT(zero_page_phyaddr != 0);
+    frame_clear(zero_page_phyaddr);
+    phy_to_page(zero_page_phyaddr)->share_cnt = 1;
+    vma_init();
+    page_fault_init();
+    kernel_page_global_init();
     put_str("mem_init done\n");
 }
 
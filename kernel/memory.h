@@ -42,6 +42,29 @@ enum pool_flags {
 // 表示 US 位的值为 U，即 US=1，表示允许所有特权级别的程序访问此页内存
 #define PG_US_U 4
 
+// 全局页标记，CR4.PGE 置位后，带此标记的页表项在重新加载 cr3 时不会被清出 TLB
+// 只用于各进程共享的内核空间
+#define PG_G (1 << 8)
+
+// 页目录项的 PS 位，CR4.PSE 置位后表示该目录项直接映射 4M 大页
+#define PG_PS (1 << 7)
+
+// 页目录项索引
+#define PDE_IDX(addr) ((addr & 0xffc00000) >> 22)
+// 页表项索引
+#define PTE_IDX(addr) ((addr & 0x003ff000) >> 12)
+
+// 写时复制标记，使用页表项中留给软件的第 9 位
+// 带此标记的页表项只读，写入时触发缺页异常再复制页框
+#define PG_COW (1 << 9)
+
+// 换出标记，使用页表项中留给软件的第 10 位
+// 带此标记的页表项 P 位为 0，高 20 位是页面内容所在的交换槽号
+#define PG_SWAP (1 << 10)
+
+// 访问位，处理器访问页面时置位，页面回收时据此给页面第二次机会
+#define PG_A (1 << 5)
+
 /**
  * @brief 虚拟地址池，用于虚拟地址管理
  * 
@@ -58,7 +81,8 @@ struct virtual_addr {
  * 
  */
 struct mem_block {
-    struct list_elem free_elem;
+    // 同一 arena 中的下一个空闲内存块
+    struct mem_block* next;
 };
 
 /**
@@ -70,14 +94,39 @@ struct mem_block_desc {
     uint32_t block_size;
     // 本 arena 中可容纳此 mem_block 的数量
     uint32_t blocks_per_arena;
-    // 目前可用的 mem_block 链表
-    struct list free_list;
+    // 部分空闲的 arena 链表，分配时优先使用
+    struct list partial_list;
+    // 已经分配完的 arena 链表
+    struct list full_list;
+    // 全部空闲的 arena 链表，最多缓存一个，避免反复申请释放页
+    struct list empty_list;
 };
 
 // 内存块描述符个数
 #define DESC_CNT 7
 
+// 每个线程为每种规格的内存块最多缓存的空闲块数
+#define MAGAZINE_SIZE 8
+// 弹匣与仓库（内存块描述符的 arena 链表）之间每次批量交换的块数
+#define MAGAZINE_BATCH (MAGAZINE_SIZE / 2)
+
+/**
+ * @brief 线程私有的空闲内存块缓存（弹匣）
+ *        申请和释放优先在弹匣中完成，不需要加锁
+ */
+struct mem_magazine {
+    // 弹匣中的块所属的内存块描述符
+    struct mem_block_desc* desc;
+    // 弹匣中的块数
+    uint32_t rounds;
+    struct mem_block* blocks[MAGAZINE_SIZE];
+};
+
+// 对象缓存中对象的构造函数
+typedef void kmem_ctor(void* obj);
+
 extern struct pool kernel_pool, user_pool;
+extern uint32_t* kernel_page_dir;
 
 void mem_init(void);
 void* get_kernel_pages(uint32_t pg_cnt);
@@ -89,9 +138,23 @@ void* get_a_page(enum pool_flags pf, uint32_t vaddr);
 void* get_user_pages(uint32_t pg_cnt);
 void block_desc_init(struct mem_block_desc* desc_array);
 void* sys_malloc(uint32_t size);
+void* sys_malloc_nozero(uint32_t size);
+void* sys_calloc(uint32_t cnt, uint32_t size);
+uint32_t sys_brk(uint32_t brk);
+void page_share_cow(uint32_t vaddr);
+void page_map_zero(uint32_t vaddr);
+void user_space_reset(void);
+void user_pages_pin(void* buf, uint32_t len, bool write);
+void user_pages_unpin(void* buf, uint32_t len);
+void tlb_flush_user(void);
+void zeroed_frames_refill(void);
 void mfree_page(enum pool_flags pf, void* p_vaddr, uint32_t pg_cnt);
 void pfree(uint32_t pg_phy_addr);
 void sys_free(void* ptr);
 void* get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr);
+struct kmem_cache* kmem_cache_create(const char* name, uint32_t obj_size, uint32_t align, kmem_ctor* ctor);
+void* kmem_cache_alloc(struct kmem_cache* cache);
+void kmem_cache_free(struct kmem_cache* cache, void* obj);
+void sys_slabinfo(void);
 
 #endif  // KERNEL_MEMORY_H_
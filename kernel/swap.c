@@ -0,0 +1,152 @@
+#include "kernel/swap.h"
+#include "device/ide.h"
+#include "kernel/memory.h"
+#include "kernel/interrupt.h"
+#include "kernel/global.h"
+#include "kernel/debug.h"
+#include "lib/kernel/bitmap.h"
+#include "lib/kernel/stdio_kernel.h"
+
+// 每个交换槽存放一页，占 8 个扇区
+#define SWAP_SLOT_SECS (PAGE_SIZE / 512)
+
+// 交换区所在的分区，没有交换分区时为 NULL
+static struct partition* swap_part;
+// 交换槽的占用位图
+static struct bitmap slot_bitmap;
+// 每个交换槽被多少个页表项引用，fork 时父子进程共享同一交换槽
+static uint16_t* slot_map_cnt;
+static uint32_t slot_cnt;
+static uint32_t slot_used;
+// 换入、换出的页数
+static uint32_t swap_in_cnt;
+static uint32_t swap_out_cnt;
+
+/**
+ * @brief 在分区队列中查找交换分区，供 list_traversal 回调
+ *
+ * @param pelem
+ * @param arg
+ * @return bool 找到时返回 true 结束遍历
+ */
+static bool swap_part_find(struct list_elem* pelem, int arg) {
+    (void)arg;
+    struct partition* part = elem2entry(struct partition, part_tag, pelem);
+    if (part->fs_type == PART_TYPE_SWAP && part->sec_cnt >= SWAP_SLOT_SECS * 8) {
+        swap_part = part;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief 初始化交换区，使用找到的第一个交换分区
+ *        没有交换分区时用户内存池耗尽后申请失败，与不支持换页时一样
+ *
+ */
+void swap_init(void) {
+    printk("swap_init start\n");
+    list_traversal(&partition_list, swap_part_find, 0);
+    if (swap_part == NULL) {
+        printk("    no swap partition\n");
+        return;
+    }
+    // 位图按字节管理，零头的交换槽不用
+    slot_cnt = swap_part->sec_cnt / SWAP_SLOT_SECS / 8 * 8;
+    uint32_t bits_bytes = DIV_ROUND_UP(slot_cnt / 8, 4) * 4;
+    uint8_t* buf = sys_malloc(bits_bytes + BITMAP_SUMMARY_BYTES(slot_cnt / 8) + slot_cnt * sizeof(uint16_t));
+    if (buf == NULL) {
+        PANIC("swap_init: alloc memory failed!");
+    }
+    slot_bitmap.bmap_bytes_len = slot_cnt / 8;
+    slot_bitmap.bits = buf;
+    slot_bitmap.summary = (uint32_t*)(buf + bits_bytes);
+    bitmap_init(&slot_bitmap);
+    slot_map_cnt = (uint16_t*)(buf + bits_bytes + BITMAP_SUMMARY_BYTES(slot_cnt / 8));
+    printk("    swap on %s, %d slots\n", swap_part->name, slot_cnt);
+    printk("swap_init done\n");
+}
+
+/**
+ * @brief 申请一个交换槽
+ *
+ * @return int32_t 没有交换区或交换区已满时返回 -1
+ */
+int32_t swap_slot_alloc(void) {
+    if (swap_part == NULL) {
+        return -1;
+    }
+    enum intr_status old_status = intr_disable();
+    int32_t slot = bitmap_scan(&slot_bitmap, 1);
+    if (slot != -1) {
+        bitmap_set(&slot_bitmap, slot, 1);
+        slot_map_cnt[slot] = 1;
+        slot_used++;
+    }
+    intr_set_status(old_status);
+    return slot;
+}
+
+/**
+ * @brief fork 时子进程的页表项也引用交换槽 slot
+ *
+ * @param slot
+ */
+void swap_slot_dup(uint32_t slot) {
+    ASSERT(slot < slot_cnt && slot_map_cnt[slot] > 0 && slot_map_cnt[slot] < 0xffff);
+    enum intr_status old_status = intr_disable();
+    slot_map_cnt[slot]++;
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 一个页表项不再引用交换槽 slot，没有引用时回收
+ *
+ * @param slot
+ */
+void swap_slot_free(uint32_t slot) {
+    ASSERT(slot < slot_cnt && slot_map_cnt[slot] > 0);
+    enum intr_status old_status = intr_disable();
+    if (--slot_map_cnt[slot] == 0) {
+        bitmap_set(&slot_bitmap, slot, 0);
+        slot_used--;
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 把交换槽 slot 中的一页读到 buf
+ *
+ * @param slot
+ * @param buf
+ */
+void swap_read(uint32_t slot, void* buf) {
+    ASSERT(slot < slot_cnt);
+    ide_read(swap_part->my_disk, swap_part->start_lba + slot * SWAP_SLOT_SECS, buf, SWAP_SLOT_SECS);
+    swap_in_cnt++;
+}
+
+/**
+ * @brief 把 buf 中的一页写到交换槽 slot
+ *
+ * @param slot
+ * @param buf
+ */
+void swap_write(uint32_t slot, void* buf) {
+    ASSERT(slot < slot_cnt);
+    ide_write(swap_part->my_disk, swap_part->start_lba + slot * SWAP_SLOT_SECS, buf, SWAP_SLOT_SECS);
+    swap_out_cnt++;
+}
+
+/**
+ * @brief 打印交换区的使用情况
+ *
+ */
+void sys_swapinfo(void) {
+    if (swap_part == NULL) {
+        printk("no swap partition\n");
+        return;
+    }
+    printk("swap on %s: %d/%d slots used\n", swap_part->name, slot_used, slot_cnt);
+    printk("pages swapped in: %d  out: %d\n", swap_in_cnt, swap_out_cnt);
+}
@@ -0,0 +1,25 @@
+/**
+ * @file swap.h
+ * @author your name (you@domain.com)
+ * @brief 用户页的交换区，位于从盘上分区类型为 0x82 的分区
+ * @version 0.1
+ * @date 2023-07-12
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef KERNEL_SWAP_H_
+#define KERNEL_SWAP_H_
+
+#include "lib/stdint.h"
+
+void swap_init(void);
+int32_t swap_slot_alloc(void);
+void swap_slot_dup(uint32_t slot);
+void swap_slot_free(uint32_t slot);
+void swap_read(uint32_t slot, void* buf);
+void swap_write(uint32_t slot, void* buf);
+void sys_swapinfo(void);
+
+#endif  // KERNEL_SWAP_H_
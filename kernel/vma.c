@@ -0,0 +1,400 @@
+#include "kernel/vma.h"
+#include "kernel/memory.h"
+#include "kernel/global.h"
+#include "kernel/debug.h"
+
+// vm_area 的对象缓存
+static struct kmem_cache* vma_cache;
+
+/**
+ * @brief 初始化 vm_area 的对象缓存
+ *
+ */
+void vma_init(void) {
+    vma_cache = kmem_cache_create("vm_area", sizeof(struct vm_area), sizeof(uint32_t), NULL);
+    ASSERT(vma_cache != NULL);
+}
+
+/**
+ * @brief 初始化空的虚拟地址空间
+ *
+ * @param space
+ */
+void vm_space_init(struct vm_space* space) {
+    list_init(&space->area_list);
+    space->root = NULL;
+    space->area_cnt = 0;
+}
+
+static int32_t vma_height(struct vm_area* a) {
+    return a == NULL ? 0 : a->height;
+}
+
+static void vma_update_height(struct vm_area* a) {
+    int32_t lh = vma_height(a->left), rh = vma_height(a->right);
+    a->height = (lh > rh ? lh : rh) + 1;
+}
+
+static struct vm_area* vma_rotate_right(struct vm_area* a) {
+    struct vm_area* l = a->left;
+    a->left = l->right;
+    l->right = a;
+    vma_update_height(a);
+    vma_update_height(l);
+    return l;
+}
+
+static struct vm_area* vma_rotate_left(struct vm_area* a) {
+    struct vm_area* r = a->right;
+    a->right = r->left;
+    r->left = a;
+    vma_update_height(a);
+    vma_update_height(r);
+    return r;
+}
+
+/**
+ * @brief 更新 a 的高度，左右子树高度差超过 1 时旋转
+ *
+ * @param a
+ * @return struct vm_area* 平衡后子树的根
+ */
+static struct vm_area* vma_balance(struct vm_area* a) {
+    vma_update_height(a);
+    int32_t factor = vma_height(a->left) - vma_height(a->right);
+    if (factor > 1) {
+        if (vma_height(a->left->left) < vma_height(a->left->right)) {
+            a->left = vma_rotate_left(a->left);
+        }
+        return vma_rotate_right(a);
+    }
+    if (factor < -1) {
+        if (vma_height(a->right->right) < vma_height(a->right->left)) {
+            a->right = vma_rotate_right(a->right);
+        }
+        return vma_rotate_left(a);
+    }
+    return a;
+}
+
+static struct vm_area* vma_tree_insert(struct vm_area* root, struct vm_area* a) {
+    if (root == NULL) {
+        return a;
+    }
+    if (a->start < root->start) {
+        root->left = vma_tree_insert(root->left, a);
+    } else {
+        root->right = vma_tree_insert(root->right, a);
+    }
+    return vma_balance(root);
+}
+
+/**
+ * @brief 摘下子树中 start 最小的节点，通过 min 返回
+ *
+ * @param root
+ * @param min
+ * @return struct vm_area* 摘除后子树的根
+ */
+static struct vm_area* vma_tree_remove_min(struct vm_area* root, struct vm_area** min) {
+    if (root->left == NULL) {
+        *min = root;
+        return root->right;
+    }
+    root->left = vma_tree_remove_min(root->left, min);
+    return vma_balance(root);
+}
+
+static struct vm_area* vma_tree_remove(struct vm_area* root, uint32_t start) {
+    ASSERT(root != NULL);
+    if (start < root->start) {
+        root->left = vma_tree_remove(root->left, start);
+    } else if (start > root->start) {
+        root->right = vma_tree_remove(root->right, start);
+    } else {
+        struct vm_area* l = root->left;
+        struct vm_area* r = root->right;
+        if (r == NULL) {
+            return l;
+        }
+        struct vm_area* min;
+        r = vma_tree_remove_min(r, &min);
+        min->left = l;
+        min->right = r;
+        return vma_balance(min);
+    }
+    return vma_balance(root);
+}
+
+/**
+ * @brief 返回地址最低的区域，没有区域时返回 NULL
+ *
+ * @param space
+ * @return struct vm_area*
+ */
+struct vm_area* vma_first(struct vm_space* space) {
+    if (list_empty(&space->area_list)) {
+        return NULL;
+    }
+    return elem2entry(struct vm_area, area_tag, space->area_list.head.next);
+}
+
+/**
+ * @brief 返回 a 之后的下一个区域，a 是最后一个区域时返回 NULL
+ *
+ * @param space
+ * @param a
+ * @return struct vm_area*
+ */
+struct vm_area* vma_next(struct vm_space* space, struct vm_area* a) {
+    if (a->area_tag.next == &space->area_list.tail) {
+        return NULL;
+    }
+    return elem2entry(struct vm_area, area_tag, a->area_tag.next);
+}
+
+/**
+ * @brief 返回包含 addr 的区域，没有时返回 NULL
+ *
+ * @param space
+ * @param addr
+ * @return struct vm_area*
+ */
+struct vm_area* vma_find(struct vm_space* space, uint32_t addr) {
+    struct vm_area* a = space->root;
+    while (a != NULL) {
+        if (addr < a->start) {
+            a = a->left;
+        } else if (addr >= a->end) {
+            a = a->right;
+        } else {
+            return a;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 返回起始地址小于 addr 的区域中地址最高的一个，没有时返回 NULL
+ *
+ * @param space
+ * @param addr
+ * @return struct vm_area*
+ */
+static struct vm_area* vma_find_prev(struct vm_space* space, uint32_t addr) {
+    struct vm_area* a = space->root;
+    struct vm_area* prev = NULL;
+    while (a != NULL) {
+        if (a->start < addr) {
+            prev = a;
+            a = a->right;
+        } else {
+            a = a->left;
+        }
+    }
+    return prev;
+}
+
+/**
+ * @brief 新建区域 [start, end) 并插入到 prev 之后
+ *
+ * @param space
+ * @param prev 为 NULL 时插入到最前面
+ * @param start
+ * @param end
+ * @param flags
+ * @return bool
+ */
+static bool vma_insert(struct vm_space* space, struct vm_area* prev, uint32_t start, uint32_t end, uint32_t flags) {
+    struct vm_area* a = kmem_cache_alloc(vma_cache);
+    if (a == NULL) {
+        return false;
+    }
+    a->start = start;
+    a->end = end;
+    a->flags = flags;
+    a->left = a->right = NULL;
+    a->height = 1;
+    if (prev != NULL) {
+        list_insert_before(prev->area_tag.next, &a->area_tag);
+    } else {
+        list_push(&space->area_list, &a->area_tag);
+    }
+    space->root = vma_tree_insert(space->root, a);
+    space->area_cnt++;
+    return true;
+}
+
+static void vma_remove(struct vm_space* space, struct vm_area* a) {
+    space->root = vma_tree_remove(space->root, a->start);
+    list_remove(&a->area_tag);
+    space->area_cnt--;
+    kmem_cache_free(vma_cache, a);
+}
+
+/**
+ * @brief 把 [start, end) 加入地址空间，与相邻且用途相同的区域合并
+ *
+ * @param space
+ * @param start 页对齐
+ * @param end 页对齐
+ * @param flags
+ * @return bool 与已有区域重叠或内存不足时返回 false
+ */
+bool vma_map(struct vm_space* space, uint32_t start, uint32_t end, uint32_t flags) {
+    ASSERT(start < end && start % PAGE_SIZE == 0 && end % PAGE_SIZE == 0);
+    // 区域之间互不重叠，只需检查起始地址小于 end 的最后一个区域
+    struct vm_area* prev = vma_find_prev(space, end);
+    if (prev != NULL && prev->end > start) {
+        return false;
+    }
+    struct vm_area* next = prev != NULL ? vma_next(space, prev) : vma_first(space);
+    if (prev != NULL && prev->end == start && prev->flags == flags) {
+        prev->end = end;
+        if (next != NULL && next->start == end && next->flags == flags) {
+            prev->end = next->end;
+            vma_remove(space, next);
+        }
+        return true;
+    }
+    if (next != NULL && next->start == end && next->flags == flags) {
+        // 键变小但仍大于 prev 的起始地址，树中的顺序不变
+        next->start = start;
+        return true;
+    }
+    return vma_insert(space, prev, start, end, flags);
+}
+
+/**
+ * @brief 从地址空间中移除 [start, end)，必要时截断或拆分区域
+ *
+ * @param space
+ * @param start 页对齐
+ * @param end 页对齐
+ * @return bool 需要拆分区域而内存不足时返回 false, 此时地址空间不变
+ */
+bool vma_unmap(struct vm_space* space, uint32_t start, uint32_t end) {
+    ASSERT(start < end && start % PAGE_SIZE == 0 && end % PAGE_SIZE == 0);
+    struct vm_area* a = vma_find(space, start);
+    if (a == NULL) {
+        struct vm_area* prev = vma_find_prev(space, start);
+        a = prev != NULL ? vma_next(space, prev) : vma_first(space);
+    }
+    while (a != NULL && a->start < end) {
+        struct vm_area* next = vma_next(space, a);
+        if (a->start < start && a->end > end) {
+            // 从中间挖去一段，拆成两个区域，先建好后一半，失败时什么也不改
+            // 新区域的起始地址大于 a 的，树中的顺序不变
+            if (!vma_insert(space, a, end, a->end, a->flags)) {
+                return false;
+            }
+            a->end = start;
+            break;
+        } else if (a->start < start) {
+            a->end = start;
+        } else if (a->end > end) {
+            // 键变大但仍小于下一个区域的起始地址，树中的顺序不变
+            a->start = end;
+        } else {
+            vma_remove(space, a);
+        }
+        a = next;
+    }
+    return true;
+}
+
+/**
+ * @brief 在 [low, high) 中首次适配一段 size 字节的空闲地址
+ *
+ * @param space
+ * @param size
+ * @param low
+ * @param high
+ * @return uint32_t 失败返回 0
+ */
+uint32_t vma_get_unmapped(struct vm_space* space, uint32_t size, uint32_t low, uint32_t high) {
+    uint32_t candidate = low;
+    struct vm_area* a = vma_find(space, low);
+    if (a == NULL) {
+        struct vm_area* prev = vma_find_prev(space, low);
+        a = prev != NULL ? vma_next(space, prev) : vma_first(space);
+    }
+    while (a != NULL && a->start < high) {
+        if (a->start >= candidate && a->start - candidate >= size) {
+            return candidate;
+        }
+        if (a->end > candidate) {
+            candidate = a->end;
+        }
+        a = vma_next(space, a);
+    }
+    if (candidate < high && high - candidate >= size) {
+        return candidate;
+    }
+    return 0;
+}
+
+/**
+ * @brief 把 src 中的全部区域复制到空的 dst 中，fork 时使用
+ *
+ * @param dst
+ * @param src
+ * @return bool
+ */
+bool vma_copy(struct vm_space* dst, struct vm_space* src) {
+    struct vm_area* prev = NULL;
+    struct vm_area* a = vma_first(src);
+    ASSERT(dst->area_cnt == 0);
+    while (a != NULL) {
+        if (!vma_insert(dst, prev, a->start, a->end, a->flags)) {
+            return false;
+        }
+        prev = elem2entry(struct vm_area, area_tag, dst->area_list.tail.prev);
+        a = vma_next(src, a);
+    }
+    return true;
+}
+
+/**
+ * @brief 释放 space 中的全部区域
+ *
+ * @param space
+ */
+void vma_destroy(struct vm_space* space) {
+    struct vm_area* a = vma_first(space);
+    while (a != NULL) {
+        struct vm_area* next = vma_next(space, a);
+        vma_remove(space, a);
+        a = next;
+    }
+}
+
+/**
+ * @brief 把 src 中的全部区域移入 dst，不分配内存，src 变为空
+ *        调用者保证两者的区域互不重叠，exec 时把预先建好的区域装入进程
+ *
+ * @param dst
+ * @param src
+ */
+void vma_move(struct vm_space* dst, struct vm_space* src) {
+    struct vm_area* a = vma_first(src);
+    while (a != NULL) {
+        struct vm_area* next = vma_next(src, a);
+        src->root = vma_tree_remove(src->root, a->start);
+        list_remove(&a->area_tag);
+        src->area_cnt--;
+        struct vm_area* prev = vma_find_prev(dst, a->start);
+        ASSERT(prev == NULL || prev->end <= a->start);
+        ASSERT(vma_find_prev(dst, a->end) == prev);
+        a->left = a->right = NULL;
+        a->height = 1;
+        if (prev != NULL) {
+            list_insert_before(prev->area_tag.next, &a->area_tag);
+        } else {
+            list_push(&dst->area_list, &a->area_tag);
+        }
+        dst->root = vma_tree_insert(dst->root, a);
+        dst->area_cnt++;
+        a = next;
+    }
+}
@@ -0,0 +1,71 @@
+/**
+ * @file vma.h
+ * @author your name (you@domain.com)
+ * @brief 用户进程虚拟地址空间的区域管理
+ * @version 0.1
+ * @date 2023-07-08
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef KERNEL_VMA_H_
+#define KERNEL_VMA_H_
+
+#include "lib/stdint.h"
+#include "lib/kernel/list.h"
+#include "kernel/global.h"
+
+// 区域的用途
+// 匿名内存，如内核代替用户进程申请的堆内存
+#define VMA_ANON 0x1
+// 可执行文件的段，页面在首次访问时从文件加载
+#define VMA_EXEC 0x2
+// 用户栈，按需向下增长
+#define VMA_STACK 0x4
+// brk 管理的用户堆
+#define VMA_HEAP 0x8
+
+/**
+ * @brief 一段连续的、用途相同的用户虚拟地址区域 [start, end)
+ *        同时挂在按地址排序的链表和以 start 为键的 AVL 树上
+ *
+ */
+struct vm_area {
+    uint32_t start;
+    uint32_t end;
+    uint32_t flags;
+    // 按地址升序排列的链表中的节点
+    struct list_elem area_tag;
+    // AVL 树的左右子树及高度
+    struct vm_area* left;
+    struct vm_area* right;
+    int32_t height;
+};
+
+/**
+ * @brief 用户进程的虚拟地址空间
+ *
+ */
+struct vm_space {
+    // 按地址升序排列的区域链表，用于遍历和查找空闲区间
+    struct list area_list;
+    // 区域的 AVL 树，用于按地址查找
+    struct vm_area* root;
+    // 区域个数
+    uint32_t area_cnt;
+};
+
+void vma_init(void);
+void vm_space_init(struct vm_space* space);
+struct vm_area* vma_first(struct vm_space* space);
+struct vm_area* vma_next(struct vm_space* space, struct vm_area* a);
+struct vm_area* vma_find(struct vm_space* space, uint32_t addr);
+bool vma_map(struct vm_space* space, uint32_t start, uint32_t end, uint32_t flags);
+bool vma_unmap(struct vm_space* space, uint32_t start, uint32_t end);
+uint32_t vma_get_unmapped(struct vm_space* space, uint32_t size, uint32_t low, uint32_t high);
+bool vma_copy(struct vm_space* dst, struct vm_space* src);
+void vma_destroy(struct vm_space* space);
+void vma_move(struct vm_space* dst, struct vm_space* src);
+
+#endif  // KERNEL_VMA_H_
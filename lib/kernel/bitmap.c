@@ -5,8 +5,168 @@
 #include "kernel/interrupt.h"
 #include "kernel/debug.h"
 
+// 位图中 32 位字的个数
+#define BITMAP_WORDS(bmap) DIV_ROUND_UP((bmap)->bmap_bytes_len, 4)
+
+/**
+ * @brief 返回 val 中最低的为 1 的位的下标，val 不能为 0
+ *
+ * @param val
+ * @return uint32_t
+ */
+static inline uint32_t bit_scan_forward(uint32_t val) {
+    uint32_t idx;
+    asm ("bsf %1, %0" : "=r" (idx) : "rm" (val));
+    return idx;
+}
+
+/**
+ * @brief 读取位图的第 word_idx 个 32 位字
+ *        超出位图长度的位视为已占用
+ *
+ * @param bmap
+ * @param word_idx
+ * @return uint32_t
+ */
+static uint32_t bitmap_word(struct bitmap* bmap, uint32_t word_idx) {
+    uint32_t byte_idx = word_idx * 4;
+    if (byte_idx + 4 <= bmap->bmap_bytes_len) {
+        return *(uint32_t*)(bmap->bits + byte_idx);
+    }
+    // 位图末尾不足一个字的部分，逐字节拼起来
+    uint32_t word = 0xffffffff;
+    uint32_t i;
+    for (i = 0; byte_idx + i < bmap->bmap_bytes_len; i++) {
+        word &= ~(0xffU << (i * 8));
+        word |= (uint32_t)bmap->bits[byte_idx + i] << (i * 8);
+    }
+    return word;
+}
+
+/**
+ * @brief 根据位图第 word_idx 个字的内容更新摘要位图
+ *
+ * @param bmap
+ * @param word_idx
+ */
+static void bitmap_summary_update(struct bitmap* bmap, uint32_t word_idx) {
+    if (bmap->summary == NULL) {
+        return;
+    }
+    if (bitmap_word(bmap, word_idx) == 0xffffffff) {
+        bmap->summary[word_idx / 32] |= (1U << (word_idx % 32));
+    } else {
+        bmap->summary[word_idx / 32] &= ~(1U << (word_idx % 32));
+    }
+}
+
+/**
+ * @brief 借助摘要位图，返回从 word_idx 开始第一个未满的字的下标
+ *        没有摘要位图时直接返回 word_idx，找不到时返回值 >= word_end
+ *
+ * @param bmap
+ * @param word_idx
+ * @param word_end
+ * @return uint32_t
+ */
+static uint32_t bitmap_next_free_word(struct bitmap* bmap, uint32_t word_idx, uint32_t word_end) {
+    if (bmap->summary == NULL) {
+        return word_idx;
+    }
+    uint32_t sum_idx = word_idx / 32;
+    // 屏蔽掉 word_idx 之前的字
+    uint32_t sum_word = bmap->summary[sum_idx] | ((1U << (word_idx % 32)) - 1);
+    while (sum_word == 0xffffffff) {
+        sum_idx++;
+        if (sum_idx * 32 >= word_end) {
+            return word_end;
+        }
+        sum_word = bmap->summary[sum_idx];
+    }
+    return sum_idx * 32 + bit_scan_forward(~sum_word);
+}
+
+/**
+ * @brief 在位图的 [start, end) 位区间内找连续 cnt 个空闲位
+ *        整字为 0 时一次累加 32 位，整字已满时直接跳过
+ *
+ * @param bmap
+ * @param start
+ * @param end
+ * @param cnt
+ * @return int 成功返回起始位下标，失败返回 -1
+ */
+static int bitmap_scan_range(struct bitmap* bmap, uint32_t start, uint32_t end, uint32_t cnt) {
+    uint32_t word_idx = start / 32;
+    uint32_t word_end = DIV_ROUND_UP(end, 32);
+    uint32_t run_start = start, run_len = 0;
+    while (word_idx < word_end) {
+        // 当前没有正在累计的空闲段时，可以跳过整字已满的区域
+        if (run_len == 0) {
+            word_idx = bitmap_next_free_word(bmap, word_idx, word_end);
+            if (word_idx >= word_end) {
+                break;
+            }
+        }
+        uint32_t base = word_idx * 32;
+        uint32_t word = bitmap_word(bmap, word_idx);
+        // 区间之外的位视为已占用
+        if (base < start) {
+            word |= (1U << (start - base)) - 1;
+        }
+        if (end < base + 32) {
+            word |= ~((1U << (end - base)) - 1);
+        }
+        if (word == 0) {
+            if (run_len == 0) {
+                run_start = base;
+            }
+            run_len += 32;
+        } else if (word == 0xffffffff) {
+            run_len = 0;
+        } else if (cnt == 1) {
+            return base + bit_scan_forward(~word);
+        } else {
+            // 字内既有空闲位又有占用位，逐位累计
+            uint32_t bit;
+            for (bit = 0; bit < 32; bit++) {
+                if (word & (BITMAP_MASK << bit)) {
+                    run_len = 0;
+                    continue;
+                }
+                if (run_len == 0) {
+                    run_start = base + bit;
+                }
+                if (++run_len == cnt) {
+                    return run_start;
+                }
+            }
+        }
+        if (run_len >= cnt) {
+            return run_start;
+        }
+        word_idx++;
+    }
+    return -1;
+}
+
 void bitmap_init(struct bitmap* bitmap) {
     memset(bitmap->bits, 0, bitmap->bmap_bytes_len);
+    bitmap->next_fit = 0;
+    if (bitmap->summary != NULL) {
+        memset(bitmap->summary, 0, BITMAP_SUMMARY_BYTES(bitmap->bmap_bytes_len));
+        // 末尾不足一个字的部分会被视为已占用，可能使最后一个字变满
+        bitmap_summary_update(bitmap, BITMAP_WORDS(bitmap) - 1);
+    }
+}
+
+void bitmap_summary_attach(struct bitmap* bmap, uint32_t* summary) {
+    bmap->summary = summary;
+    memset(summary, 0, BITMAP_SUMMARY_BYTES(bmap->bmap_bytes_len));
+    uint32_t word_idx;
+    for (word_idx = 0; word_idx < BITMAP_WORDS(bmap); word_idx++) {
+        bitmap_summary_update(bmap, word_idx);
+    }
 }
 
 bool bitmap_scan_test(struct bitmap* bmap, uint32_t bit_idx) {
@@ -15,52 +175,25 @@ bool bitmap_scan_test(struct bitmap* bmap, uint32_t bit_idx) {
     return (bmap->bits[byte_idx] & (BITMAP_MASK << bit_odd));
 }
 
-int bitmap_scan(struct bitmap* bmap, uint32_t cnt) {
-    uint32_t idx_byte = 0;
-    // 1 表示该位已分配，若为 0xff，则表示该字节内已无空闲位，向下一字节继续找
-    // 逐字节比较
-    while ((0xff == bmap->bits[idx_byte]) && (idx_byte < bmap->bmap_bytes_len)) {
-        idx_byte++;
-    }
-    // asm volatile ("xchg %%bx, %%bx" ::);
-    // put_str("idx_byte: ");
-    // put_int(idx_byte);
-    // put_str("\n");
-    // put_str("bmap->bmap_bytes_len: ");
-    // put_int(bmap->bmap_bytes_len);
-    // put_str("\n");
-    ASSERT(idx_byte < bmap->bmap_bytes_len);
-    if (idx_byte == bmap->bmap_bytes_len) {
+int bitmap_scan_near(struct bitmap* bmap, uint32_t goal, uint32_t cnt) {
+    uint32_t bits_len = bmap->bmap_bytes_len * 8;
+    if (cnt == 0 || cnt > bits_len) {
         return -1;
     }
-    // 若在位图数组范围内的某字节内找到了空闲位
-    // 在该字节内逐位比对，返回空闲位的索引
-    int idx_bit = 0;
-    while ((uint8_t)(BITMAP_MASK << idx_bit) & bmap->bits[idx_byte]) {
-        idx_bit++;
-    }
-    int bit_idx_start = idx_byte * 8 + idx_bit;
-    if (cnt == 1) {
-        return bit_idx_start;
+    uint32_t start = goal < bits_len ? goal : 0;
+    int bit_idx_start = bitmap_scan_range(bmap, start, bits_len, cnt);
+    // 后半段没有找到，再从头找，区间要覆盖跨越 start 的空闲段
+    if (bit_idx_start == -1 && start != 0) {
+        uint32_t end = start + cnt - 1 < bits_len ? start + cnt - 1 : bits_len;
+        bit_idx_start = bitmap_scan_range(bmap, 0, end, cnt);
     }
-    uint32_t bit_left = (bmap->bmap_bytes_len * 8 - bit_idx_start);
-    uint32_t next_bit = bit_idx_start + 1;
-    uint32_t count = 1;
-    // 先将其置为 -1，若找不到连续的位就直接返回
-    bit_idx_start = -1;
-    while (bit_left-- > 0) {
-        if (!bitmap_scan_test(bmap, next_bit)) {
-            // 如果 next_bit 为 0
-            count++;
-        } else {
-            count = 0;
-        }
-        // 找到了连续的 cnt 个空位
-        if (count == cnt) {
-            bit_idx_start = next_bit - cnt + 1;
-            break;
-        }
-        next_bit++;
+    return bit_idx_start;
+}
+
+int bitmap_scan(struct bitmap* bmap, uint32_t cnt) {
+    int bit_idx_start = bitmap_scan_near(bmap, bmap->next_fit, cnt);
+    if (bit_idx_start != -1) {
+        bmap->next_fit = bit_idx_start + cnt;
     }
     return bit_idx_start;
 }
@@ -74,4 +207,5 @@ void bitmap_set(struct bitmap* bmap, uint32_t bit_idx, int8_t value) {
     } else {
         bmap->bits[byte_idx] &= ~(BITMAP_MASK << bit_odd);
     }
+    bitmap_summary_update(bmap, bit_idx / 32);
 }
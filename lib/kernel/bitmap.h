@@ -16,9 +16,17 @@
 
 #define BITMAP_MASK 1
 
+// 长度为 bytes_len 字节的位图所需的摘要位图字节数
+// 摘要位图中一位对应位图中的一个 32 位字，为 1 表示该字已全部被占用
+#define BITMAP_SUMMARY_BYTES(bytes_len) (DIV_ROUND_UP(DIV_ROUND_UP(bytes_len, 4), 32) * 4)
+
 struct bitmap {
     uint32_t bmap_bytes_len;
     uint8_t* bits;
+    // 摘要位图，可以为 NULL，此时扫描时不跳过已满的字
+    uint32_t* summary;
+    // 下次扫描的起始位，使连续的申请不必每次都从第 0 位开始
+    uint32_t next_fit;
 };
 
 /**
@@ -28,6 +36,15 @@ struct bitmap {
  */
 void bitmap_init(struct bitmap* bitmap);
 
+/**
+ * @brief 为位图挂上摘要位图，并根据位图当前内容重建摘要
+ *        summary 至少要有 BITMAP_SUMMARY_BYTES(bmap->bmap_bytes_len) 字节
+ * 
+ * @param bmap 
+ * @param summary 
+ */
+void bitmap_summary_attach(struct bitmap* bmap, uint32_t* summary);
+
 /**
  * @brief 判断 bit_idx 位是否为 1，若为 1，则返回 true，否则返回 false
  * 
@@ -40,6 +57,7 @@ bool bitmap_scan_test(struct bitmap* bmap, uint32_t bit_idx);
 
 /**
  * @brief 在位图上申请连续 cnt 个位，成功，则返回其起始位下标；失败，返回 -1
+ *        从上次成功的位置之后开始找，找到末尾后再从头找
  * 
  * @param bmap 
  * @param cnt 
@@ -47,6 +65,17 @@ bool bitmap_scan_test(struct bitmap* bmap, uint32_t bit_idx);
  */
 int bitmap_scan(struct bitmap* bmap, uint32_t cnt);
 
+/**
+ * @brief 在位图上申请连续 cnt 个位，从 goal 开始找，找到末尾后再从头找
+ *        不改变 next_fit，用于希望结果靠近 goal 的申请
+ * 
+ * @param bmap 
+ * @param goal 
+ * @param cnt 
+ * @return int 成功返回起始位下标，失败返回 -1
+ */
+int bitmap_scan_near(struct bitmap* bmap, uint32_t goal, uint32_t cnt);
+
 /**
  * @brief 将位图的 bit_idx 位设置为 value
  * 
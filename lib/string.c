@@ -70,6 +70,15 @@ int8_t strncmp(const char *a, const char *b, uint32_t size) {
     return *a < *b ? -1 : *a > *b;
 }
 
+int8_t strcmp(const char *a, const char *b) {
+    ASSERT(a != NULL && b != NULL);
+    for (; (*a != 0) && (*a == *b);) {
+        a++;
+        b++;
+    }
+    return *a < *b ? -1 : *a > *b;
+}
+
 char* strchr(const char* str, const uint8_t ch) {
     ASSERT(str != NULL);
     for (; *str != 0;) {
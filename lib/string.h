@@ -71,6 +71,16 @@ uint32_t strlen(const char* str);
  */
 int8_t strncmp(const char *a, const char *b, uint32_t size);
 
+/**
+ * @brief 比较两个完整的字符串
+ *        若 a 中字符串大于 b 中字符串，返回 1；相等返回 0； 否则返回 -1
+ * 
+ * @param a 
+ * @param b 
+ * @return int8_t 
+ */
+int8_t strcmp(const char *a, const char *b);
+
 /**
  * @brief 从左到右查找字符串 str 中首次出现字符 ch 的地址
  * 
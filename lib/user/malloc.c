@@ -0,0 +1,272 @@
+#include "lib/user/malloc.h"
+#include "lib/user/syscall.h"
+#include "lib/string.h"
+#include "kernel/global.h"
+#include "user_process/process.h"
+
+// 小块内存的规格：16，32，64，128，256，512，1024
+#define HEAP_CLASS_CNT 7
+#define HEAP_SMALL_MAX 1024
+// 页头中表示大块内存的规格下标
+#define HEAP_CLASS_LARGE 0xffffffff
+// 堆不够用时每次至少向内核申请的页数
+#define HEAP_GROW_PAGES 16
+// 堆顶连续空闲的页数达到此值时归还给内核
+#define HEAP_TRIM_PAGES 32
+
+/**
+ * @brief 每个小块页或大块页段开头的页头
+ *
+ */
+struct heap_page {
+    // 页段占用的页数，小块页为 1
+    uint32_t pg_cnt;
+    // 小块内存的规格下标，大块内存为 HEAP_CLASS_LARGE
+    uint32_t class_idx;
+};
+
+/**
+ * @brief 空闲的小块内存
+ *
+ */
+struct heap_block {
+    struct heap_block* next;
+};
+
+/**
+ * @brief 空闲的页段，借用页段本身的空间存放
+ *
+ */
+struct heap_run {
+    uint32_t pg_cnt;
+    struct heap_run* next;
+};
+
+/**
+ * @brief 分配器的状态
+ *        用户进程的代码可能位于各进程共享的内核映像中（如 init 和 shell），不能放在全局变量里，
+ *        所以放在每个进程私有的堆的第一页，该页由内核在创建进程时映射好并清零
+ */
+struct heap_state {
+    bool initialized;
+    // 当前的堆末尾，与内核中的 heap_brk 保持一致，避免每次都要查询
+    uint32_t brk;
+    // 各规格的空闲小块链表
+    struct heap_block* free_blocks[HEAP_CLASS_CNT];
+    // 按地址升序排列的空闲页段链表
+    struct heap_run* free_runs;
+};
+
+#define heap ((struct heap_state*)USER_HEAP_START)
+
+/**
+ * @brief 返回能容纳 size 字节的最小规格的下标
+ *
+ * @param size
+ * @return uint32_t
+ */
+static uint32_t size_to_class(uint32_t size) {
+    uint32_t class_idx = 0, block_size = 16;
+    while (block_size < size) {
+        block_size *= 2;
+        class_idx++;
+    }
+    return class_idx;
+}
+
+/**
+ * @brief 将从 run 开始的 pg_cnt 页按地址顺序放回空闲页段链表，并与相邻的页段合并
+ *
+ * @param run
+ * @param pg_cnt
+ */
+static void run_free(struct heap_run* run, uint32_t pg_cnt) {
+    struct heap_run* prev = NULL;
+    struct heap_run* next = heap->free_runs;
+    while (next != NULL && next < run) {
+        prev = next;
+        next = next->next;
+    }
+    run->pg_cnt = pg_cnt;
+    run->next = next;
+    // 与后一个页段相邻则合并
+    if (next != NULL && (uint32_t)run + run->pg_cnt * PAGE_SIZE == (uint32_t)next) {
+        run->pg_cnt += next->pg_cnt;
+        run->next = next->next;
+    }
+    // 与前一个页段相邻则合并
+    if (prev != NULL && (uint32_t)prev + prev->pg_cnt * PAGE_SIZE == (uint32_t)run) {
+        prev->pg_cnt += run->pg_cnt;
+        prev->next = run->next;
+    } else if (prev != NULL) {
+        prev->next = run;
+    } else {
+        heap->free_runs = run;
+    }
+}
+
+/**
+ * @brief 堆顶连续空闲的页足够多时归还给内核
+ *
+ */
+static void heap_trim(void) {
+    struct heap_run* prev = NULL;
+    struct heap_run* last = heap->free_runs;
+    if (last == NULL) {
+        return;
+    }
+    while (last->next != NULL) {
+        prev = last;
+        last = last->next;
+    }
+    if (last->pg_cnt < HEAP_TRIM_PAGES || (uint32_t)last + last->pg_cnt * PAGE_SIZE != heap->brk) {
+        return;
+    }
+    if (brk((uint32_t)last) != (uint32_t)last) {
+        return;
+    }
+    heap->brk = (uint32_t)last;
+    if (prev != NULL) {
+        prev->next = NULL;
+    } else {
+        heap->free_runs = NULL;
+    }
+}
+
+/**
+ * @brief 从空闲页段链表中首次适配 pg_cnt 页，不够时一次向内核多申请一些页
+ *
+ * @param pg_cnt
+ * @return struct heap_page* 失败返回 NULL
+ */
+static struct heap_page* run_alloc(uint32_t pg_cnt) {
+    struct heap_run* prev = NULL;
+    struct heap_run* run = heap->free_runs;
+    while (run != NULL && run->pg_cnt < pg_cnt) {
+        prev = run;
+        run = run->next;
+    }
+    if (run == NULL) {
+        uint32_t grow_pages = pg_cnt > HEAP_GROW_PAGES ? pg_cnt : HEAP_GROW_PAGES;
+        uint32_t old_brk = heap->brk;
+        uint32_t new_brk = old_brk + grow_pages * PAGE_SIZE;
+        if (new_brk < old_brk || brk(new_brk) != new_brk) {
+            return NULL;
+        }
+        heap->brk = new_brk;
+        // 新申请的页并入空闲页段链表，可能和堆顶原有的空闲页段合并，再重新查找
+        run_free((struct heap_run*)old_brk, grow_pages);
+        return run_alloc(pg_cnt);
+    }
+    // 从页段头部切下 pg_cnt 页
+    struct heap_run* rest = run->next;
+    if (run->pg_cnt > pg_cnt) {
+        rest = (struct heap_run*)((uint32_t)run + pg_cnt * PAGE_SIZE);
+        rest->pg_cnt = run->pg_cnt - pg_cnt;
+        rest->next = run->next;
+    }
+    if (prev != NULL) {
+        prev->next = rest;
+    } else {
+        heap->free_runs = rest;
+    }
+    struct heap_page* page = (struct heap_page*)run;
+    page->pg_cnt = pg_cnt;
+    return page;
+}
+
+/**
+ * @brief 为第 class_idx 种规格切分一页新的小块内存
+ *
+ * @param class_idx
+ * @return bool
+ */
+static bool class_refill(uint32_t class_idx) {
+    struct heap_page* page = run_alloc(1);
+    if (page == NULL) {
+        return false;
+    }
+    page->class_idx = class_idx;
+    uint32_t block_size = 16 << class_idx;
+    uint32_t block_cnt = (PAGE_SIZE - sizeof(struct heap_page)) / block_size;
+    uint32_t block_idx;
+    // 倒序压入，使分配顺序与地址顺序一致
+    for (block_idx = block_cnt; block_idx > 0; block_idx--) {
+        struct heap_block* b = (struct heap_block*)((uint32_t)(page + 1) + (block_idx - 1) * block_size);
+        b->next = heap->free_blocks[class_idx];
+        heap->free_blocks[class_idx] = b;
+    }
+    return true;
+}
+
+/**
+ * @brief 申请 size 字节内存，返回的内存已清零
+ *        只有堆空间不够时才会通过 brk 进入内核
+ *
+ * @param size
+ * @return void*
+ */
+void* malloc(uint32_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    if (!heap->initialized) {
+        heap->brk = brk(0);
+        heap->initialized = true;
+    }
+    if (size <= HEAP_SMALL_MAX) {
+        uint32_t class_idx = size_to_class(size);
+        if (heap->free_blocks[class_idx] == NULL && !class_refill(class_idx)) {
+            return NULL;
+        }
+        struct heap_block* b = heap->free_blocks[class_idx];
+        heap->free_blocks[class_idx] = b->next;
+        memset(b, 0, 16 << class_idx);
+        return (void*)b;
+    }
+    if (size > 0xffffffff - sizeof(struct heap_page) - PAGE_SIZE) {
+        return NULL;
+    }
+    uint32_t pg_cnt = DIV_ROUND_UP(size + sizeof(struct heap_page), PAGE_SIZE);
+    struct heap_page* page = run_alloc(pg_cnt);
+    if (page == NULL) {
+        return NULL;
+    }
+    page->class_idx = HEAP_CLASS_LARGE;
+    memset(page + 1, 0, size);
+    return (void*)(page + 1);
+}
+
+/**
+ * @brief 申请 cnt 个 size 字节的元素，返回的内存已清零
+ *
+ * @param cnt
+ * @param size
+ * @return void*
+ */
+void* calloc(uint32_t cnt, uint32_t size) {
+    if (size != 0 && cnt > 0xffffffff / size) {
+        return NULL;
+    }
+    return malloc(cnt * size);
+}
+
+/**
+ * @brief 释放 malloc 申请的内存
+ *
+ * @param ptr
+ */
+void free(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    struct heap_page* page = (struct heap_page*)((uint32_t)ptr & 0xfffff000);
+    if (page->class_idx == HEAP_CLASS_LARGE) {
+        run_free((struct heap_run*)page, page->pg_cnt);
+        heap_trim();
+        return;
+    }
+    struct heap_block* b = (struct heap_block*)ptr;
+    b->next = heap->free_blocks[page->class_idx];
+    heap->free_blocks[page->class_idx] = b;
+}
@@ -0,0 +1,21 @@
+/**
+ * @file malloc.h
+ * @author your name (you@domain.com)
+ * @brief 用户态堆内存分配器
+ * @version 0.1
+ * @date 2023-07-02
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef LIB_USER_MALLOC_H_
+#define LIB_USER_MALLOC_H_
+
+#include "lib/stdint.h"
+
+void* malloc(uint32_t size);
+void* calloc(uint32_t cnt, uint32_t size);
+void free(void* ptr);
+
+#endif  // LIB_USER_MALLOC_H_
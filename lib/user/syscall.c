@@ -28,12 +28,16 @@ uint32_t getpid(void) {
     return _syscall0(SYS_GETPID);
 }
 
-void* malloc(uint32_t size) {
-    return (void*)_syscall1(SYS_MALLOC, size);
+uint32_t brk(uint32_t addr) {
+    return _syscall1(SYS_BRK, addr);
 }
 
-void free(void* ptr) {
-    _syscall1(SYS_FREE, ptr);
+void* sbrk(int32_t increment) {
+    uint32_t old_brk = brk(0);
+    if (increment != 0 && brk(old_brk + increment) != old_brk + increment) {
+        return (void*)-1;
+    }
+    return (void*)old_brk;
 }
 
 int16_t fork(void) {
@@ -116,3 +120,27 @@ void ps(void) {
 int execv(const char* pathname, char** argv) {
     return _syscall2(SYS_EXECV, pathname, argv);
 }
+
+void slabinfo(void) {
+    _syscall0(SYS_SLABINFO);
+}
+
+void switchinfo(void) {
+    _syscall0(SYS_SWITCHINFO);
+}
+
+void swapinfo(void) {
+    _syscall0(SYS_SWAPINFO);
+}
+
+void sync(void) {
+    _syscall0(SYS_SYNC);
+}
+
+int32_t fsync(int32_t fd) {
+    return _syscall1(SYS_FSYNC, fd);
+}
+
+void frag(const char* path) {
+    _syscall1(SYS_FRAG, path);
+}
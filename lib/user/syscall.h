@@ -38,12 +38,19 @@ enum SYSCALL_NR {
     SYS_REWINDDIR,
     SYS_STAT,
     SYS_PS,
-    SYS_EXECV
+    SYS_EXECV,
+    SYS_SLABINFO,
+    SYS_BRK,
+    SYS_SWITCHINFO,
+    SYS_SWAPINFO,
+    SYS_SYNC,
+    SYS_FSYNC,
+    SYS_FRAG
 };
 
 uint32_t getpid(void);
-void* malloc(uint32_t size);
-void free(void* ptr);
+uint32_t brk(uint32_t addr);
+void* sbrk(int32_t increment);
 int16_t fork(void);
 int32_t read(int32_t fd, void* buf, uint32_t count);
 uint32_t write(uint32_t fd, const void* buf, uint32_t count);
@@ -64,5 +71,11 @@ int32_t stat(const char* path, struct stat* buf);
 int32_t chdir(const char* path);
 void ps(void);
 int execv(const char* pathname, char** argv);
+void slabinfo(void);
+void switchinfo(void);
+void swapinfo(void);
+void sync(void);
+int32_t fsync(int32_t fd);
+void frag(const char* path);
 
 #endif  // LIB_USER_SYSCALL_H_
@@ -22,7 +22,7 @@ else
 fi
 
 # if [ -e hd80M.img ];then
-#     echo -e  "n\np\n1\n\n+4M\nn\ne\n2\n\n\nn\n\n+5M\nn\n\n+6M\nn\n\n+7M\nn\n\n+8M\nn\n\n+9M\nn\n\n\nw\n" | fdisk hd80M.img &> /dev/null
+#     echo -e  "n\np\n1\n\n+4M\nn\ne\n2\n\n\nn\n\n+5M\nn\n\n+6M\nn\n\n+7M\nn\n\n+8M\nn\n\n+9M\nn\n\n\nt\n10\n82\nw\n" | fdisk hd80M.img &> /dev/null
 # else
 #     echo "no hd80M.img!"
 #     exit 1
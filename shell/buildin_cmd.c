@@ -239,6 +239,85 @@ void buildin_ps(uint32_t argc, char** argv) {
     ps();
 }
 
+/**
+ * @brief 内建命令：slabinfo，打印内核对象缓存的使用情况
+ * 
+ * @param argc 
+ * @param UNUSED 
+ */
+void buildin_slabinfo(uint32_t argc, char** argv) {
+    (void)argv;
+    if (argc != 1) {
+        printf("slabinfo: no argument support!\n");
+        return;
+    }
+    slabinfo();
+}
+
+/**
+ * @brief 内建命令：switchinfo，打印上下文切换的统计
+ * 
+ * @param argc 
+ * @param UNUSED 
+ */
+void buildin_switchinfo(uint32_t argc, char** argv) {
+    (void)argv;
+    if (argc != 1) {
+        printf("switchinfo: no argument support!\n");
+        return;
+    }
+    switchinfo();
+}
+
+/**
+ * @brief 内建命令：swapinfo，打印交换区的使用情况
+ * 
+ * @param argc 
+ * @param UNUSED 
+ */
+void buildin_swapinfo(uint32_t argc, char** argv) {
+    (void)argv;
+    if (argc != 1) {
+        printf("swapinfo: no argument support!\n");
+        return;
+    }
+    swapinfo();
+}
+
+/**
+ * @brief 内建命令：sync，把缓存中的脏数据写回硬盘
+ * 
+ * @param argc 
+ * @param UNUSED 
+ */
+void buildin_sync(uint32_t argc, char** argv) {
+    (void)argv;
+    if (argc != 1) {
+        printf("sync: no argument support!\n");
+        return;
+    }
+    sync();
+}
+
+/**
+ * @brief 内建命令：frag，打印空闲空间的碎片情况，给出文件时再打印其区段数
+ * 
+ * @param argc 
+ * @param argv 
+ */
+void buildin_frag(uint32_t argc, char** argv) {
+    if (argc > 2) {
+        printf("frag: only support 1 argument!\n");
+        return;
+    }
+    if (argc == 1) {
+        frag(NULL);
+        return;
+    }
+    make_clear_abs_path(argv[1], final_path);
+    frag(final_path);
+}
+
 /**
  * @brief 内建命令：clear
  * 
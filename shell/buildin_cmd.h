@@ -22,6 +22,11 @@ int32_t buildin_rmdir(uint32_t argc, char** argv);
 int32_t buildin_rm(uint32_t argc, char** argv);
 void buildin_pwd(uint32_t argc, char** argv);
 void buildin_ps(uint32_t argc, char** argv);
+void buildin_slabinfo(uint32_t argc, char** argv);
+void buildin_switchinfo(uint32_t argc, char** argv);
+void buildin_swapinfo(uint32_t argc, char** argv);
+void buildin_sync(uint32_t argc, char** argv);
+void buildin_frag(uint32_t argc, char** argv);
 void buildin_clear(uint32_t argc, char** argv);
 
 #endif  // SHELL_BUILDIN_CMD_H_
@@ -163,6 +163,16 @@ void my_shell(void) {
             buildin_pwd(argc, argv);
         } else if (!strncmp("ps", argv[0], 2)) {
             buildin_ps(argc, argv);
+        } else if (!strncmp("slabinfo", argv[0], 8)) {
+            buildin_slabinfo(argc, argv);
+        } else if (!strncmp("switchinfo", argv[0], 10)) {
+            buildin_switchinfo(argc, argv);
+        } else if (!strncmp("swapinfo", argv[0], 8)) {
+            buildin_swapinfo(argc, argv);
+        } else if (!strncmp("sync", argv[0], 4)) {
+            buildin_sync(argc, argv);
+        } else if (!strncmp("frag", argv[0], 4)) {
+            buildin_frag(argc, argv);
         } else if (!strncmp("clear", argv[0], 5)) {
             buildin_clear(argc, argv);
         } else if (!strncmp("mkdir", argv[0], 5)) {
@@ -10,6 +10,7 @@
 #include "fs/fs.h"
 #include "fs/file.h"
 #include "lib/stdio.h"
+#include "lib/kernel/stdio_kernel.h"
 
 #define MAIN_THREAD_PRIO_VALUE (31)
 
@@ -23,9 +24,23 @@ struct list thread_ready_list;
 struct list thread_all_list;
 // 分配 pid 锁
 struct lock pid_lock;
+// PCB 的对象缓存
+struct kmem_cache* task_cache;
 // 用于保存队列中的线程节点
 static struct list_elem* thread_tag;
 
+// 上下文切换的统计，用于衡量切换的开销
+// 切换次数
+static uint32_t switch_cnt;
+// 切换开始时时间戳计数器的低 32 位，由换上 CPU 的任务在 switch_to 返回后计算耗时
+static uint32_t switch_start_tsc;
+// 已计时的切换次数，新建的任务第一次上 CPU 时不经过 switch_to 的返回处，不计时
+static uint32_t switch_timed_cnt;
+// 单次切换的时钟周期数：滑动平均值、最小值、最大值
+static uint32_t switch_cycles_avg;
+static uint32_t switch_cycles_min = 0xffffffff;
+static uint32_t switch_cycles_max;
+
 extern void switch_to(struct task_struct* cur, struct task_struct* next);
 extern void init(void);
 
@@ -33,8 +48,15 @@ static void idle(void* arg) {
     (void)arg;
     for (;;) {
         thread_block(TASK_BLOCKED);
-        // 执行 hlt 时必须要保证目前处于开中断的情况下
-        asm volatile("sti; hlt" : : : "memory");
+        // 被唤醒说明就绪队列为空，先开中断利用这段空闲时间预先清零物理页
+        intr_enable();
+        zeroed_frames_refill();
+        // 关中断再检查，避免检查之后、hlt 之前有任务就绪却要等到下一次中断
+        intr_disable();
+        if (list_empty(&thread_ready_list)) {
+            // 执行 hlt 时必须要保证目前处于开中断的情况下, sti 的效果延迟到 hlt 执行后才生效
+            asm volatile("sti; hlt" : : : "memory");
+        }
     }
 }
 
@@ -138,7 +160,7 @@ struct task_struct* thread_start(char* name, int prio, thread_func func, void* f
     // put_str(func_arg);
     // put_str("\n");
     // PCB 都位于内核空间，包括用户进程的 PCB 也是在内核空间
-    struct task_struct* thread = get_kernel_pages(1);
+    struct task_struct* thread = kmem_cache_alloc(task_cache);
     init_thread(thread, name, prio);
     thread_create(thread, func, func_arg);
     // 确保之前不在就绪队列中
@@ -173,6 +195,38 @@ static void make_main_thread(void) {
     list_append(&thread_all_list, &main_thread->all_list_tag);
 }
 
+/**
+ * @brief 读取时间戳计数器的低 32 位，用于计算短时间间隔的时钟周期数
+ * 
+ * @return uint32_t 
+ */
+static uint32_t rdtsc_low(void) {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a" (low), "=d" (high));
+    (void)high;
+    return low;
+}
+
+/**
+ * @brief 记录一次上下文切换耗费的时钟周期数
+ * 
+ * @param cycles 
+ */
+static void switch_cycles_account(uint32_t cycles) {
+    if (switch_timed_cnt++ == 0) {
+        switch_cycles_avg = cycles;
+    } else {
+        // 按 1/8 的权重滑动平均，避免 64 位除法
+        switch_cycles_avg = switch_cycles_avg - switch_cycles_avg / 8 + cycles / 8;
+    }
+    if (cycles < switch_cycles_min) {
+        switch_cycles_min = cycles;
+    }
+    if (cycles > switch_cycles_max) {
+        switch_cycles_max = cycles;
+    }
+}
+
 /**
  * @brief 任务调度
  * 
@@ -201,9 +255,13 @@ void schedule(void) {
     thread_tag = list_pop(&thread_ready_list);
     struct task_struct* next = elem2entry(struct task_struct, general_tag, thread_tag);
     next->status = TASK_RUNNING;
+    switch_cnt++;
+    switch_start_tsc = rdtsc_low();
     // 激活任务页表
     process_activate(next);
     switch_to(cur, next);
+    // 此时已是换上 CPU 的任务在运行，统计这次切换的耗时
+    switch_cycles_account(rdtsc_low() - switch_start_tsc);
     return;
 }
 
@@ -350,12 +408,24 @@ void sys_ps(void) {
     list_traversal(&thread_all_list, elem2thread_info, 0);
 }
 
+/**
+ * @brief 打印上下文切换的次数、cr3 的重新加载次数及单次切换的耗时
+ * 
+ */
+void sys_switchinfo(void) {
+    printk("switches: %d  cr3 loads: %d\n", switch_cnt, cr3_load_cnt);
+    printk("cycles per switch: avg %d  min %d  max %d\n", switch_cycles_avg,
+        switch_timed_cnt == 0 ? 0 : switch_cycles_min, switch_cycles_max);
+}
+
 /**
  * @brief 初始化线程
  * 
  */
 void thread_init(void) {
     put_str("thread_init start\n");
+    // PCB 与 0 级栈共占一页，且必须页对齐，running_thread 依赖这一点
+    task_cache = kmem_cache_create("task_struct", PAGE_SIZE, PAGE_SIZE, NULL);
     list_init(&thread_ready_list);
     list_init(&thread_all_list);
     lock_init(&pid_lock);
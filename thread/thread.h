@@ -15,6 +15,8 @@
 #include "lib/stdint.h"
 #include "lib/kernel/list.h"
 #include "kernel/memory.h"
+#include "kernel/vma.h"
+#include "fs/readahead.h"
 
 // task_struct 中 stack_magic 的魔数值
 #define TASK_STACK_MAGIC_VALUE (0x19971216)
@@ -22,6 +24,8 @@
 #define TASK_NAME_LEN 16
 // 每个线程可以打开的文件数
 #define MAX_FILES_OPEN_PER_PROC 8
+// 每个进程最多记录的可执行文件可加载段数
+#define EXEC_SEG_MAX 4
 
 // 函数类型
 typedef void thread_func(void* arg);
@@ -37,6 +41,23 @@ enum task_status {
     TASK_DIED
 };
 
+struct inode;
+
+/**
+ * @brief 可执行文件中的可加载段，exec 时只记录下来，页面在首次访问时由缺页异常加载
+ * 
+ */
+struct exec_segment {
+    // 段的起始虚拟地址
+    uint32_t vaddr;
+    // 段在文件中的偏移
+    uint32_t offset;
+    // 段在文件中的大小
+    uint32_t filesz;
+    // 段在内存中的大小，超出 filesz 的部分是 bss
+    uint32_t memsz;
+};
+
 /**
  * @brief 中断栈
  * 用于中断发生时保护程序（线程或者进程）的上下文环境
@@ -135,6 +156,8 @@ struct task_struct {
     // 此任务自从上 CPU 运行后至今占用了多少 cpu 滴答数
     // 任务运行了多久
     uint32_t elapsed_ticks;
+    // 在 timer_sleep 中睡眠时, 到 ticks 等于它时被唤醒
+    uint32_t wakeup_tick;
     // 用于线程在一般队列中的节点（比如：就绪队列或者其他队列）
     struct list_elem general_tag;
     // 用于线程队列 thread_all_list 中的节点
@@ -142,10 +165,20 @@ struct task_struct {
     // 进程自己页表的虚拟地址
     // 如果是线程，则此字段为 NULL
     uint32_t* pg_dir;
-    // 用户进程的虚拟地址
-    struct virtual_addr user_process_vaddr;
+    // 用户进程的虚拟地址空间，由若干区域组成
+    struct vm_space user_vm;
+    // 用户进程堆的末尾，堆的范围为 [USER_HEAP_START, heap_brk)
+    uint32_t heap_brk;
+    // 进程正在运行的可执行文件，按需加载段时从中读取
+    struct inode* exec_inode;
+    uint32_t exec_seg_cnt;
+    struct exec_segment exec_segs[EXEC_SEG_MAX];
+    // 缺页时读取可执行文件的预读状态
+    struct file_ra exec_ra;
     // 用户进程内存块描述符
     struct mem_block_desc u_block_desc[DESC_CNT];
+    // 每种规格内存块的弹匣
+    struct mem_magazine mags[DESC_CNT];
     // 已打开文件数组
     int32_t fd_table[MAX_FILES_OPEN_PER_PROC];
     // 进程所在的工作目录的 inode 编号
@@ -161,6 +194,7 @@ struct task_struct {
 };
 
 extern struct list thread_ready_list;
+extern struct kmem_cache* task_cache;
 extern struct list thread_all_list;
 
 void thread_create(struct task_struct* pthread, thread_func func, void* func_arg);
@@ -174,5 +208,6 @@ void thread_yield(void);
 void thread_init(void);
 pid_t fork_pid(void);
 void sys_ps(void);
+void sys_switchinfo(void);
 
 #endif  // THREAD_THREAD_H_
@@ -5,6 +5,10 @@
 #include "lib/string.h"
 #include "kernel/global.h"
 #include "kernel/memory.h"
+#include "kernel/debug.h"
+#include "user_process/process.h"
+#include "fs/file.h"
+#include "fs/inode.h"
 
 typedef uint32_t Elf32_Word, Elf32_Addr, Elf32_Off;
 typedef uint16_t Elf32_Half;
@@ -53,58 +57,16 @@ enum segment_type {
 };
 
 /**
- * @brief 将文件描述符 fd 指向的文件中, 偏移为 offset, 大小为 filesz 的段加载到虚拟地址为 vaddr 的内存
- * 
- * @param fd 
- * @param offset 
- * @param filesz 
- * @param vaddr 
- * @return true 
- * @return false 
- */
-static bool segment_load(int32_t fd, uint32_t offset, uint32_t filesz, uint32_t vaddr) {
-    // vaddr 地址所在的页框
-    uint32_t vaddr_first_page = vaddr & 0xfffff000;
-    // 加载到内存后, 文件在第一个页框中占用的字节大小
-    uint32_t size_in_first_page = PAGE_SIZE - (vaddr & 0x00000fff);
-    uint32_t occupy_pages = 0;
-    // 若一个页框容不下该段
-    if (filesz > size_in_first_page) {
-        uint32_t left_size = filesz - size_in_first_page;
-        // 1 是指 vaddr_first_page
-        occupy_pages = DIV_ROUND_UP(left_size, PAGE_SIZE) + 1;
-    } else {
-        occupy_pages = 1;
-    }
-    // 为进程分配内存
-    uint32_t page_idx = 0;
-    uint32_t vaddr_page = vaddr_first_page;
-    while (page_idx < occupy_pages) {
-        uint32_t* pde = pde_ptr(vaddr_page);
-        uint32_t* pte = pte_ptr(vaddr_page);
-        // 如果 pde 不存在, 或者 pte 不存在就分配内存.
-        // pde 的判断要在 pte 之前, 否则 pde 若不存在会导致
-        // 判断 pte 时缺页异常
-        if (!(*pde & 0x00000001) || !(*pte & 0x00000001)) {
-            if (get_a_page(PF_USER, vaddr_page) == NULL) {
-                return false;
-            }
-        }  // 如果原进程的页表已经分配了, 利用现有的物理页, 直接覆盖进程体
-        vaddr_page += PAGE_SIZE;
-        page_idx++;
-    }
-    sys_lseek(fd, offset, SEEK_SET);
-    sys_read(fd, (void*)vaddr, filesz);
-    return true;
-}
-
-/**
- * @brief 从文件系统上加载用户程序 pathname, 成功则返回程序的起始地址, 否则返回 -1
+ * @brief 从文件系统上读取用户程序 pathname 的程序头, 只记录可加载段而不加载
+ *        成功则返回程序的起始地址, 并通过 segs, seg_cnt, inode 返回段信息和可执行文件的 inode, 否则返回 -1
  * 
  * @param pathname 
+ * @param segs 
+ * @param seg_cnt 
+ * @param inode 
  * @return int32_t 
  */
-static int32_t load(const char* pathname) {
+static int32_t load(const char* pathname, struct exec_segment* segs, uint32_t* seg_cnt, struct inode** inode) {
     int32_t ret = -1;
     struct Elf32_Ehdr elf_header;
     struct Elf32_Phdr prog_header;
@@ -132,6 +94,7 @@ static int32_t load(const char* pathname) {
 
     // 遍历所有程序头
     uint32_t prog_idx = 0;
+    *seg_cnt = 0;
     while (prog_idx < elf_header.e_phnum) {
         memset(&prog_header, 0, prog_header_size);
         // 将文件的指针定位到程序头
@@ -141,25 +104,129 @@ static int32_t load(const char* pathname) {
             ret = -1;
             goto done;
         }
-        // 如果是可加载段就调用 segment_load 加载到内存
+        // 如果是可加载段就记录下来, 等到访问时再由缺页异常加载
         if (PT_LOAD == prog_header.p_type) {
-            if (!segment_load(fd, prog_header.p_offset, prog_header.p_filesz, prog_header.p_vaddr)) {
+            // 段必须位于用户堆之下, 且在文件中的部分不能超过 memsz
+            if (*seg_cnt == EXEC_SEG_MAX \
+                || prog_header.p_vaddr < USER_VADDR_START \
+                || prog_header.p_filesz > prog_header.p_memsz \
+                || prog_header.p_memsz > USER_HEAP_START - prog_header.p_vaddr) {
                 ret = -1;
                 goto done;
             }
+            segs[*seg_cnt].vaddr = prog_header.p_vaddr;
+            segs[*seg_cnt].offset = prog_header.p_offset;
+            segs[*seg_cnt].filesz = prog_header.p_filesz;
+            segs[*seg_cnt].memsz = prog_header.p_memsz;
+            (*seg_cnt)++;
         }
         // 更新下一个程序头的偏移
         prog_header_offset += elf_header.e_phentsize;
         prog_idx++;
     }
+    // 可执行文件在进程运行期间保持打开, 供按需加载时读取
+    *inode = file_table[running_thread()->fd_table[fd]].fd_inode;
+    (*inode)->i_open_cnts++;
     ret = elf_header.e_entry;
 done:
     sys_close(fd);
     return ret;
 }
 
+/**
+ * @brief 处理当前进程可执行文件段中尚未加载的页的缺页
+ *        页中有文件内容时分配新页并从文件读入, 纯 bss 页映射共享的全 0 页
+ * 
+ * @param vaddr 
+ * @return true 
+ * @return false vaddr 不属于任何可加载段或加载失败
+ */
+bool exec_segment_fault(uint32_t vaddr) {
+    struct task_struct* cur = running_thread();
+    if (cur->pg_dir == NULL || cur->exec_inode == NULL) {
+        return false;
+    }
+    uint32_t page_vaddr = vaddr & 0xfffff000;
+    bool covered = false, has_data = false;
+    uint32_t seg_idx;
+    // 同一页可能同时属于相邻的两个段
+    for (seg_idx = 0; seg_idx < cur->exec_seg_cnt; seg_idx++) {
+        struct exec_segment* seg = &cur->exec_segs[seg_idx];
+        if (page_vaddr + PAGE_SIZE <= seg->vaddr || page_vaddr >= seg->vaddr + seg->memsz) {
+            continue;
+        }
+        covered = true;
+        if (page_vaddr < seg->vaddr + seg->filesz) {
+            has_data = true;
+        }
+    }
+    if (!covered) {
+        return false;
+    }
+    if (!has_data) {
+        page_map_zero(page_vaddr);
+        return true;
+    }
+    // 虚拟地址已在 exec 时预留, 新页已清零, 文件内容之外的部分即为 0
+    if (get_a_page_without_opvaddrbitmap(PF_USER, page_vaddr) == NULL) {
+        return false;
+    }
+    for (seg_idx = 0; seg_idx < cur->exec_seg_cnt; seg_idx++) {
+        struct exec_segment* seg = &cur->exec_segs[seg_idx];
+        uint32_t data_start = page_vaddr > seg->vaddr ? page_vaddr : seg->vaddr;
+        uint32_t data_end = seg->vaddr + seg->filesz;
+        if (data_end > page_vaddr + PAGE_SIZE) {
+            data_end = page_vaddr + PAGE_SIZE;
+        }
+        if (data_start >= data_end) {
+            continue;
+        }
+        struct file file;
+        file.fd_pos = seg->offset + (data_start - seg->vaddr);
+        file.fd_flag = O_RDONLY;
+        file.fd_inode = cur->exec_inode;
+        // 缺页通常按地址顺序发生, 预读状态跨缺页保留
+        file.fd_ra = cur->exec_ra;
+        if (file_read(&file, (void*)data_start, data_end - data_start) != (int32_t)(data_end - data_start)) {
+            return false;
+        }
+        cur->exec_ra = file.fd_ra;
+    }
+    return true;
+}
+
+/**
+ * @brief 把 path 和 argv 中的字符串依次复制到内核页 buf 中
+ *        原程序的用户内存在 exec 中途会被释放, 参数需先保存到内核
+ * 
+ * @param buf 
+ * @param path 
+ * @param argv 
+ * @param argc 
+ * @return int32_t 复制的总字节数, 连同 argv 指针数组放不进一页时返回 -1
+ */
+static int32_t exec_args_save(char* buf, const char* path, const char* argv[], uint32_t argc) {
+    // 用户栈上还要放 argc + 1 个指针
+    uint32_t limit = PAGE_SIZE - (argc + 1) * sizeof(char*);
+    uint32_t len = 0, arg_idx;
+    if ((argc + 1) * sizeof(char*) >= PAGE_SIZE) {
+        return -1;
+    }
+    for (arg_idx = 0; arg_idx <= argc; arg_idx++) {
+        const char* str = arg_idx == 0 ? path : argv[arg_idx - 1];
+        uint32_t str_len = strlen(str) + 1;
+        if (str_len > limit - len) {
+            return -1;
+        }
+        memcpy(buf + len, str, str_len);
+        len += str_len;
+    }
+    return len;
+}
+
 /**
  * @brief 用 path 指向的程序替换当前进程
+ *        参数字符串和新程序的虚拟地址区域都在释放原程序之前准备好, 之前的任何失败都返回 -1 且原程序不受影响
  * 
  * @param path 
  * @param argv 
@@ -170,22 +237,79 @@ int32_t sys_execv(const char* path, const char* argv[]) {
     while (argv[argc]) {
         argc++;
     }
-    int32_t entry_point = load(path);
+    // 1. 参数字符串复制到内核页中, 页首是 path, 之后依次是各个参数
+    char* args = get_kernel_pages(1);
+    if (args == NULL) {
+        return -1;
+    }
+    int32_t args_len = exec_args_save(args, path, argv, argc);
+    if (args_len == -1) {
+        mfree_page(PF_KERNEL, args, 1);
+        return -1;
+    }
+    // 2. 读取程序头
+    struct exec_segment segs[EXEC_SEG_MAX];
+    uint32_t seg_cnt = 0;
+    struct inode* inode = NULL;
+    int32_t entry_point = load(args, segs, &seg_cnt, &inode);
     // 若加载失败则返回 -1
     if (entry_point == -1) {
+        mfree_page(PF_KERNEL, args, 1);
         return -1;
     }
+    // 3. 在单独的地址空间中为各段建好区域, 首次访问时再由缺页异常加载
+    struct vm_space exec_vm;
+    vm_space_init(&exec_vm);
+    uint32_t seg_idx;
+    for (seg_idx = 0; seg_idx < seg_cnt; seg_idx++) {
+        uint32_t seg_start = segs[seg_idx].vaddr & 0xfffff000;
+        uint32_t seg_end = DIV_ROUND_UP(segs[seg_idx].vaddr + segs[seg_idx].memsz, PAGE_SIZE) * PAGE_SIZE;
+        // 相邻的段可能共用一页, 该页已在前一个段的区域中
+        if (vma_find(&exec_vm, seg_start) != NULL) {
+            seg_start += PAGE_SIZE;
+        }
+        if (seg_start < seg_end && !vma_map(&exec_vm, seg_start, seg_end, VMA_EXEC)) {
+            vma_destroy(&exec_vm);
+            inode_close(inode);
+            mfree_page(PF_KERNEL, args, 1);
+            return -1;
+        }
+    }
     struct task_struct* cur = running_thread();
+    // 4. 释放原程序的用户页, 新程序使用全新的堆, 只保留用户栈
+    user_space_reset();
+    if (cur->exec_inode != NULL) {
+        inode_close(cur->exec_inode);
+    }
+    // 各段都在用户堆之下, 与保留下来的堆首页和用户栈不重叠
+    vma_move(&cur->user_vm, &exec_vm);
+    cur->exec_inode = inode;
+    file_ra_init(&cur->exec_ra);
+    cur->exec_seg_cnt = seg_cnt;
+    memcpy(cur->exec_segs, segs, sizeof(segs));
+    // 5. 参数字符串和 argv 指针数组压入新的用户栈, 栈顶是 argv[0]
+    char* ustr = (char*)(0xc0000000 - args_len);
+    memcpy(ustr, args, args_len);
+    char** uargv = (char**)(((uint32_t)ustr & ~(sizeof(char*) - 1)) - (argc + 1) * sizeof(char*));
+    uint32_t arg_idx;
+    // 跳过 path
+    char* str = ustr + strlen(args) + 1;
+    for (arg_idx = 0; arg_idx < argc; arg_idx++) {
+        uargv[arg_idx] = str;
+        str += strlen(str) + 1;
+    }
+    uargv[argc] = NULL;
     // 修改进程名
-    memcpy(cur->name, path, TASK_NAME_LEN);
+    memcpy(cur->name, args, TASK_NAME_LEN);
     cur->name[TASK_NAME_LEN-1] = 0;
+    mfree_page(PF_KERNEL, args, 1);
     struct intr_stack* intr_0_stack = (struct intr_stack*)((uint32_t)cur + PAGE_SIZE - sizeof(struct intr_stack));
     // 参数传递给用户进程
-    intr_0_stack->ebx = (int32_t)argv;
+    intr_0_stack->ebx = (int32_t)uargv;
     intr_0_stack->ecx = argc;
     intr_0_stack->eip = (void*)entry_point;
-    // 使新用户进程的栈地址为最高用户空间地址
-    intr_0_stack->esp = (void*)0xc0000000;
+    // 新用户进程的栈从参数之下开始
+    intr_0_stack->esp = (void*)uargv;
     // exec 不同于 fork, 为使新进程更快被执行, 直接从中断返回
     asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (intr_0_stack) : "memory");
     return 0;
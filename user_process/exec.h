@@ -13,7 +13,9 @@
 #define USER_PROCESS_EXEC_H_
 
 #include "lib/stdint.h"
+#include "kernel/global.h"
 
 int32_t sys_execv(const char* path, const char* argv[]);
+bool exec_segment_fault(uint32_t vaddr);
 
 #endif  // USER_PROCESS_EXEC_H_
@@ -1,6 +1,7 @@
 #include "user_process/fork.h"
 #include "user_process/process.h"
 #include "kernel/memory.h"
+#include "kernel/swap.h"
 #include "kernel/interrupt.h"
 #include "kernel/debug.h"
 #include "fs/file.h"
@@ -9,13 +10,13 @@
 extern void intr_exit(void);
 
 /**
- * @brief 将父进程的 pcb、虚拟地址位图拷贝给子进程
+ * @brief 将父进程的 pcb、虚拟地址区域拷贝给子进程
  * 
  * @param child_thread 
  * @param parent_thread 
  * @return int32_t 
  */
-static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct* child_thread, struct task_struct* parent_thread) {
+static int32_t copy_pcb_vm_stack0(struct task_struct* child_thread, struct task_struct* parent_thread) {
     // 1. 复制 pcb 所在的整个页, 里面包含进程 pcb 信息及特级 0 极的栈, 里面包含了返回地址, 然后再单独修改个别部分
     memcpy(child_thread, parent_thread, PAGE_SIZE);
     child_thread->pid = fork_pid();
@@ -28,16 +29,13 @@ static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct* child_thread, str
     child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
     child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
     block_desc_init(child_thread->u_block_desc);
-    // 2. 复制父进程的虚拟地址池的位图
-    uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PAGE_SIZE / 8, PAGE_SIZE);
-    void* vaddr_btmp = get_kernel_pages(bitmap_pg_cnt);
-    if (vaddr_btmp == NULL) {
+    // 父进程弹匣中的块属于父进程的内存块描述符，子进程不能沿用
+    memset(child_thread->mags, 0, sizeof(child_thread->mags));
+    // 2. 复制父进程的虚拟地址区域，开销只与区域个数有关
+    vm_space_init(&child_thread->user_vm);
+    if (!vma_copy(&child_thread->user_vm, &parent_thread->user_vm)) {
         return -1;
     }
-    // 此时 child_thread->userprog_vaddr.vaddr_bitmap.bits 还是指向父进程虚拟地址的位图地址
-    // 下面将 child_thread->userprog_vaddr.vaddr_bitmap.bits 指向自己的位图 vaddr_btmp
-    memcpy(vaddr_btmp, child_thread->user_process_vaddr.vaddr_bitmap.bits, bitmap_pg_cnt * PAGE_SIZE);
-    child_thread->user_process_vaddr.vaddr_bitmap.bits = vaddr_btmp;
     // 调试用
     // pcb.name 的长度是 16, 为避免下面 strcat 越界
     ASSERT(strlen(child_thread->name) < 11);
@@ -46,44 +44,54 @@ static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct* child_thread, str
 }
 
 /**
- * @brief 复制子进程的进程体(代码和数据)及用户栈
+ * @brief 让子进程以写时复制的方式共享父进程的进程体(代码和数据)及用户栈
+ *        父子进程的页表项都指向同一页框并设为只读，任何一方写入时才在缺页异常中复制
  * 
  * @param child_thread 
  * @param parent_thread 
- * @param buf_page 
+ * @return int32_t 
  */
-static void copy_body_stack3(struct task_struct* child_thread, struct task_struct* parent_thread, void* buf_page) {
-    uint8_t* vaddr_btmp = parent_thread->user_process_vaddr.vaddr_bitmap.bits;
-    uint32_t btmp_bytes_len = parent_thread->user_process_vaddr.vaddr_bitmap.bmap_bytes_len;
-    uint32_t vaddr_start = parent_thread->user_process_vaddr.vaddr_start;
-    uint32_t idx_byte = 0;
-    uint32_t idx_bit = 0;
+static int32_t share_body_stack3(struct task_struct* child_thread, struct task_struct* parent_thread) {
+    struct vm_area* area = vma_first(&parent_thread->user_vm);
     uint32_t process_vaddr = 0;
-    // 在父进程的用户空间中查找已有数据的页
-    while (idx_byte < btmp_bytes_len) {
-        if (vaddr_btmp[idx_byte]) {
-            idx_bit = 0;
-            while (idx_bit < 8) {
-                if ((BITMAP_MASK << idx_bit) & vaddr_btmp[idx_byte]) {
-                    process_vaddr = (idx_byte * 8 + idx_bit) * PAGE_SIZE + vaddr_start;
-                    // 下面的操作是将父进程用户空间中的数据通过内核空间做中转,最终复制到子进程的用户空间
-                    // 1. 将父进程在用户空间中的数据复制到内核缓冲区 buf_page,
-                    // 目的是下面切换到子进程的页表后,还能访问到父进程的数据
-                    memcpy(buf_page, (void*)process_vaddr, PAGE_SIZE);
-                    // 2. 将页表切换到子进程,目的是避免下面申请内存的函数将 pte 及 pde 安装在父进程的页表中
-                    page_dir_activate(child_thread);
-                    // 3. 申请虚拟地址 process_vaddr
-                    get_a_page_without_opvaddrbitmap(PF_USER, process_vaddr);
-                    // 4. 从内核缓冲区中将父进程数据复制到子进程的用户空间
-                    memcpy((void*)process_vaddr, buf_page, PAGE_SIZE);
-                    // 5. 恢复父进程页表
-                    page_dir_activate(parent_thread);
+    // 子进程当前正在填写的页表及其在页目录中的下标
+    uint32_t* child_pt = NULL;
+    uint32_t child_pde_idx = 0;
+    // 只遍历父进程已有的区域
+    for (; area != NULL; area = vma_next(&parent_thread->user_vm, area)) {
+        for (process_vaddr = area->start; process_vaddr < area->end; process_vaddr += PAGE_SIZE) {
+            // 整个页表都不存在时跳到下一个 4M 区域
+            if (!(*pde_ptr(process_vaddr) & PG_P_1)) {
+                process_vaddr = (process_vaddr | 0x003fffff) + 1 - PAGE_SIZE;
+                continue;
+            }
+            // 按需加载的页或尚未增长到的栈页没有映射, 子进程访问时同样会触发缺页
+            if (!(*pte_ptr(process_vaddr) & (PG_P_1 | PG_SWAP))) {
+                continue;
+            }
+            // 1. 父进程的页表项改为写时复制，已换出的页由父子进程共享交换槽，各自换入时再复制
+            if (*pte_ptr(process_vaddr) & PG_P_1) {
+                page_share_cow(process_vaddr);
+            } else {
+                swap_slot_dup(*pte_ptr(process_vaddr) >> 12);
+            }
+            // 2. 区域按地址升序遍历，同一页表覆盖的页是连续出现的，进入新的 4M 区域时为子进程创建页表
+            //    页表从内核堆中申请，通过内核虚拟地址直接填写，不必切换到子进程的页表
+            if (child_pt == NULL || PDE_IDX(process_vaddr) != child_pde_idx) {
+                child_pt = get_kernel_pages(1);
+                if (child_pt == NULL) {
+                    return -1;
                 }
-                idx_bit++;
+                child_pde_idx = PDE_IDX(process_vaddr);
+                child_thread->pg_dir[child_pde_idx] = addr_v2p((uint32_t)child_pt) | PG_US_U | PG_RW_W | PG_P_1;
             }
+            // 3. 子进程的页表项与父进程的相同
+            child_pt[PTE_IDX(process_vaddr)] = *pte_ptr(process_vaddr);
         }
-        idx_byte++;
     }
+    // 父进程的页表项已改为只读，重新加载 cr3 刷新用户空间的 TLB
+    tlb_flush_user();
+    return 0;
 }
 
 /**
@@ -142,6 +150,10 @@ static void update_inode_open_cnts(struct task_struct* thread) {
         }
         local_fd++;
     }
+    // 子进程同样要从可执行文件中按需加载
+    if (thread->exec_inode != NULL) {
+        thread->exec_inode->i_open_cnts++;
+    }
 }
 
 /**
@@ -152,13 +164,8 @@ static void update_inode_open_cnts(struct task_struct* thread) {
  * @return int32_t 
  */
 static int32_t copy_process(struct task_struct* child_thread, struct task_struct* parent_thread) {
-    // 内核缓冲区, 作为父进程用户空间的数据复制到子进程用户空间的中转
-    void* buf_page = get_kernel_pages(1);
-    if (buf_page == NULL) {
-        return -1;
-    }
     // 1. 复制父进程的 pcb、虚拟地址位图、内核栈到子进程
-    if (copy_pcb_vaddrbitmap_stack0(child_thread, parent_thread) == -1) {
+    if (copy_pcb_vm_stack0(child_thread, parent_thread) == -1) {
         return -1;
     }
     // 2. 为子进程创建页表,此页表仅包括内核空间
@@ -166,14 +173,14 @@ static int32_t copy_process(struct task_struct* child_thread, struct task_struct
     if (child_thread->pg_dir == NULL) {
         return -1;
     }
-    // 3. 复制父进程进程体及用户栈给子进程
-    copy_body_stack3(child_thread, parent_thread, buf_page);
+    // 3. 子进程以写时复制的方式共享父进程的进程体及用户栈
+    if (share_body_stack3(child_thread, parent_thread) == -1) {
+        return -1;
+    }
     // 4. 构建子进程 thread_stack 和修改返回值 pid
     build_child_stack(child_thread);
     // 5. 更新文件 inode 的打开数
     update_inode_open_cnts(child_thread);
-
-    mfree_page(PF_KERNEL, buf_page, 1);
     return 0;
 }
 
@@ -185,7 +192,7 @@ static int32_t copy_process(struct task_struct* child_thread, struct task_struct
 pid_t sys_fork(void) {
     struct task_struct* parent_thread = running_thread();
     // 为子进程创建 pcb(task_struct结构)
-    struct task_struct* child_thread = get_kernel_pages(1);
+    struct task_struct* child_thread = kmem_cache_alloc(task_cache);
     if (child_thread == NULL) {
         return -1;
     }
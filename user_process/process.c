@@ -10,6 +10,9 @@
 
 extern void intr_exit(void);
 
+// 重新加载 cr3 的次数，与上下文切换次数对比可以看出省掉了多少次 TLB 刷新
+uint32_t cr3_load_cnt;
+
 /**
  * @brief 创建用户进程
  * 
@@ -18,9 +21,13 @@ extern void intr_exit(void);
  */
 void process_execute(void* process_name, char* name) {
     // pcb 内核的数据结构，由内核来维护进程信息，因此要在内核内存池中申请
-    struct task_struct* thread = get_kernel_pages(1);
+    struct task_struct* thread = kmem_cache_alloc(task_cache);
     init_thread(thread, name, DEFAULT_PRIO);
-    create_user_vaddr_bitmap(thread);
+    if (!create_user_vm_space(thread)) {
+        console_put_str("process_execute: no memory for stack vm_area\n");
+        kmem_cache_free(task_cache, thread);
+        return;
+    }
     thread_create(thread, start_process, process_name);
     thread->pg_dir = create_page_dir();
     block_desc_init(thread->u_block_desc);
@@ -59,6 +66,9 @@ void start_process(void* process_name) {
     proc_stack->cs = SELECTOR_U_CODE;
     proc_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1);
     proc_stack->esp = (void*)((uint32_t)get_a_page(PF_USER, USER_STACK3_VADDR) + PAGE_SIZE);
+    // 映射堆的第一页，新分配的页已清零
+    get_a_page(PF_USER, USER_HEAP_START);
+    cur->heap_brk = USER_HEAP_START + PAGE_SIZE;
     proc_stack->ss = SELECTOR_U_DATA;
     asm volatile("movl %0, %%esp; jmp intr_exit" : : "g" (proc_stack) : "memory");
 }
@@ -81,25 +91,25 @@ void process_activate(struct task_struct* p_thread) {
 
 /**
  * @brief 激活页表
+ *        内核线程不访问用户空间，各进程页目录中的内核部分又都指向同一组页表，
+ *        所以内核线程沿用上一个任务的页表（lazy TLB）；与当前页表相同时也不重新加载 cr3
+ *        将来释放进程页目录时，须先确认它不再是当前 cr3 所指的页目录
  * 
  * @param p_thread 
  */
 void page_dir_activate(struct task_struct* p_thread) {
-    /********************************************************
-     * 执行此函数时,当前任务可能是线程。
-     * 之所以对线程也要重新安装页表, 原因是上一次被调度的可能是进程,
-     * 否则不恢复页表的话,线程就会使用进程的页表了。
-     ********************************************************/
-
-    // 若为内核线程，需要重新填充页表为 0x100000
-    // 默认为内核的页目录物理地址,也就是内核线程所用的页目录表
-    uint32_t page_dir_phy_addr = 0x100000;
-    // 用户态进程有自己的页目录表
-    if (p_thread->pg_dir != NULL) {
-        page_dir_phy_addr = addr_v2p((uint32_t)p_thread->pg_dir);
+    if (p_thread->pg_dir == NULL) {
+        return;
+    }
+    uint32_t page_dir_phy_addr = addr_v2p((uint32_t)p_thread->pg_dir);
+    uint32_t cur_page_dir_phy_addr;
+    asm volatile("movl %%cr3, %0" : "=r" (cur_page_dir_phy_addr));
+    if (page_dir_phy_addr == cur_page_dir_phy_addr) {
+        return;
     }
-    // 更新页目录寄存器 cr3，使新页表生效
+    // 更新页目录寄存器 cr3，使新页表生效，内核空间的全局页仍保留在 TLB 中
     asm volatile("movl %0, %%cr3" : : "r" (page_dir_phy_addr) : "memory");
+    cr3_load_cnt++;
 }
 
 /**
@@ -118,7 +128,8 @@ uint32_t* create_page_dir(void) {
 
     /************************** 1  先复制页表  *************************************/
     /*  page_dir_vaddr + 0x300*4 是内核页目录的第768项 */
-    memcpy((uint32_t*)((uint32_t)page_dir_vaddr + 0x300*4), (uint32_t*)(0xfffff000+0x300*4), 1024);
+    /*  内核堆的页表在启动时已全部建好, 内核页目录项不再变化, 复制后各进程共享同一组内核页表 */
+    memcpy((uint32_t*)((uint32_t)page_dir_vaddr + 0x300*4), kernel_page_dir + 0x300, 1024);
     /*****************************************************************************/
 
     /************************** 2  更新页目录地址 **********************************/
@@ -129,10 +140,13 @@ uint32_t* create_page_dir(void) {
     return page_dir_vaddr;
 }
 
-void create_user_vaddr_bitmap(struct task_struct* user_prog) {
-    user_prog->user_process_vaddr.vaddr_start = USER_VADDR_START;
-    uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PAGE_SIZE / 8 , PAGE_SIZE);
-    user_prog->user_process_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_pg_cnt);
-    user_prog->user_process_vaddr.vaddr_bitmap.bmap_bytes_len = (0xc0000000 - USER_VADDR_START) / PAGE_SIZE / 8;
-    bitmap_init(&user_prog->user_process_vaddr.vaddr_bitmap);
+/**
+ * @brief 初始化用户进程的虚拟地址空间，并预留用户栈可以增长到的区域
+ * 
+ * @param user_prog 
+ * @return bool 没有内存建立栈区域时返回 false
+ */
+bool create_user_vm_space(struct task_struct* user_prog) {
+    vm_space_init(&user_prog->user_vm);
+    return vma_map(&user_prog->user_vm, USER_STACK_LIMIT, 0xc0000000, VMA_STACK);
 }
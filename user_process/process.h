@@ -17,13 +17,21 @@
 
 #define DEFAULT_PRIO (31)
 #define USER_STACK3_VADDR (0xc0000000 - 0x1000)
+// 用户栈按需向下增长的下限，栈最大 8M
+#define USER_STACK_LIMIT (0xc0000000 - 0x800000)
 #define USER_VADDR_START (0x8048000)
+// 用户进程堆的起始地址，堆的第一页在创建进程时就映射好，供用户态分配器存放自身状态
+#define USER_HEAP_START (0x40000000)
+// 用户进程堆的上限
+#define USER_HEAP_END (0xa0000000)
+
+extern uint32_t cr3_load_cnt;
 
 void process_execute(void* process_name, char* name);
 void start_process(void* process_name);
 void process_activate(struct task_struct* p_thread);
 void page_dir_activate(struct task_struct* p_thread);
 uint32_t* create_page_dir(void);
-void create_user_vaddr_bitmap(struct task_struct* user_prog);
+bool create_user_vm_space(struct task_struct* user_prog);
 
 #endif  // USER_PROCESS_PROCESS_H_
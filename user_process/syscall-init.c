@@ -7,6 +7,7 @@
 #include "fs/fs.h"
 #include "user_process/fork.h"
 #include "user_process/exec.h"
+#include "kernel/swap.h"
 
 #define syscall_nr 32
 
@@ -50,5 +51,12 @@ void syscall_init(void) {
     syscall_table[SYS_STAT] = sys_stat;
     syscall_table[SYS_PS] = sys_ps;
     syscall_table[SYS_EXECV] = sys_execv;
+    syscall_table[SYS_SLABINFO] = sys_slabinfo;
+    syscall_table[SYS_BRK] = sys_brk;
+    syscall_table[SYS_SWITCHINFO] = sys_switchinfo;
+    syscall_table[SYS_SWAPINFO] = sys_swapinfo;
+    syscall_table[SYS_SYNC] = sys_sync;
+    syscall_table[SYS_FSYNC] = sys_fsync;
+    syscall_table[SYS_FRAG] = sys_frag;
     put_str("syscall_init done\n");
 }